@@ -82,6 +82,34 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
+
+        # check the headers of the new block and its predecessor
+        prevblockhash = json_obj['previousblockhash']
+        response = http_get_call(url.hostname, url.port, '/rest/headers/2/'+prevblockhash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_equal(int(response.getheader('content-length')) % 2, 0)
+        json_string = http_get_call(url.hostname, url.port, '/rest/headers/2/'+prevblockhash+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj), 2)
+        assert_equal(json_obj[0]['hash'], prevblockhash)
+        assert_equal(json_obj[1]['hash'], newblockhash[0])
+
+        # check the chain info
+        json_string = http_get_call(url.hostname, url.port, '/rest/chaininfo'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj['peak'], newblockhash[0])
+
+        # the mined transactions left the mempool, their outputs are unspent
+        json_string = http_get_call(url.hostname, url.port, '/rest/mempool/contents'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        for tx in txs:
+            assert_equal(tx in json_obj, False)
+
+        json_string = http_get_call(url.hostname, url.port, '/rest/getutxos/checkmempool/'+txs[0]+'-0/'+txs[0]+'-9'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj['chaintipHash'], newblockhash[0])
+        assert_equal(json_obj['bitmap'][1], '0')
+        assert_equal(len(json_obj['utxos']), json_obj['bitmap'].count('1'))
                 
         
 
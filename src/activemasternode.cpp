@@ -283,6 +283,7 @@ bool CActiveMasternode::Register(CTxIn vin, CService service, CKey keyCollateral
         CMasterNode mn(service, vin, pubKeyCollateralAddress, vchMasterNodeSignature, masterNodeSignatureTime, pubKeyMasternode, PROTOCOL_VERSION);
         mn.UpdateLastSeen(masterNodeSignatureTime);
         vecMasternodes.push_back(mn);
+        nMasternodeListGeneration++;
     }
 
     //send to all peers
@@ -0,0 +1,283 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "crypto/common.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+/** Address types of the address index */
+enum AddressIndexType {
+    ADDRESS_INDEX_NONE = 0,
+    ADDRESS_INDEX_PUBKEYHASH = 1,
+    ADDRESS_INDEX_SCRIPTHASH = 2,
+};
+
+/** Index key fields; heights are big endian so LevelDB keeps entries in height order */
+template <typename Stream>
+inline void ser_writedata8(Stream& s, uint8_t x)
+{
+    WRITEDATA(s, x);
+}
+
+template <typename Stream>
+inline uint8_t ser_readdata8(Stream& s)
+{
+    uint8_t x;
+    READDATA(s, x);
+    return x;
+}
+
+template <typename Stream>
+inline void ser_writedata32(Stream& s, uint32_t x)
+{
+    WRITEDATA(s, x);
+}
+
+template <typename Stream>
+inline uint32_t ser_readdata32(Stream& s)
+{
+    uint32_t x;
+    READDATA(s, x);
+    return x;
+}
+
+template <typename Stream>
+inline void ser_writedata32be(Stream& s, uint32_t x)
+{
+    unsigned char buf[4];
+    WriteBE32(buf, x);
+    s.write((char*)buf, 4);
+}
+
+template <typename Stream>
+inline uint32_t ser_readdata32be(Stream& s)
+{
+    unsigned char buf[4];
+    s.read((char*)buf, 4);
+    return ReadBE32(buf);
+}
+
+/**
+ * Address index entry: one per output paying to and input spending from an address.
+ * The value is the amount received (or the negative amount spent).
+ */
+struct CAddressIndexKey {
+    unsigned int type;
+    uint160 hashBytes;
+    int blockHeight;
+    unsigned int txindex;
+    uint256 txhash;
+    unsigned int index;
+    bool spending;
+
+    CAddressIndexKey()
+    {
+        SetNull();
+    }
+
+    CAddressIndexKey(unsigned int addressType, const uint160& addressHash, int height, unsigned int blockindex,
+                     const uint256& txid, unsigned int indexValue, bool isSpending)
+    {
+        type = addressType;
+        hashBytes = addressHash;
+        blockHeight = height;
+        txindex = blockindex;
+        txhash = txid;
+        index = indexValue;
+        spending = isSpending;
+    }
+
+    void SetNull()
+    {
+        type = ADDRESS_INDEX_NONE;
+        hashBytes = 0;
+        blockHeight = 0;
+        txindex = 0;
+        txhash = 0;
+        index = 0;
+        spending = false;
+    }
+
+    size_t GetSerializeSize(int nType, int nVersion) const
+    {
+        return 66;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s, nType, nVersion);
+        // heights are stored big endian for ordered range iteration
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+        txhash.Serialize(s, nType, nVersion);
+        ser_writedata32(s, index);
+        ser_writedata8(s, spending);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s, nType, nVersion);
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+        txhash.Unserialize(s, nType, nVersion);
+        index = ser_readdata32(s);
+        spending = ser_readdata8(s) != 0;
+    }
+};
+
+/** Prefix of CAddressIndexKey, to seek to the entries of an address from a given height */
+struct CAddressIndexIteratorKey {
+    unsigned int type;
+    uint160 hashBytes;
+    int blockHeight;
+
+    CAddressIndexIteratorKey(unsigned int addressType, const uint160& addressHash, int height = 0)
+    {
+        type = addressType;
+        hashBytes = addressHash;
+        blockHeight = height;
+    }
+
+    size_t GetSerializeSize(int nType, int nVersion) const
+    {
+        return 25;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, blockHeight);
+    }
+};
+
+/** Unspent outputs of an address */
+struct CAddressUnspentKey {
+    unsigned int type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int index;
+
+    CAddressUnspentKey()
+    {
+        SetNull();
+    }
+
+    CAddressUnspentKey(unsigned int addressType, const uint160& addressHash, const uint256& txid, unsigned int indexValue)
+    {
+        type = addressType;
+        hashBytes = addressHash;
+        txhash = txid;
+        index = indexValue;
+    }
+
+    void SetNull()
+    {
+        type = ADDRESS_INDEX_NONE;
+        hashBytes = 0;
+        txhash = 0;
+        index = 0;
+    }
+
+    size_t GetSerializeSize(int nType, int nVersion) const
+    {
+        return 57;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s, nType, nVersion);
+        txhash.Serialize(s, nType, nVersion);
+        ser_writedata32(s, index);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s, nType, nVersion);
+        txhash.Unserialize(s, nType, nVersion);
+        index = ser_readdata32(s);
+    }
+};
+
+struct CAddressUnspentValue {
+    CAmount satoshis;
+    CScript script;
+    int blockHeight;
+
+    CAddressUnspentValue()
+    {
+        SetNull();
+    }
+
+    CAddressUnspentValue(CAmount sats, const CScript& scriptPubKey, int height)
+    {
+        satoshis = sats;
+        script = scriptPubKey;
+        blockHeight = height;
+    }
+
+    void SetNull()
+    {
+        satoshis = -1;
+        script.clear();
+        blockHeight = 0;
+    }
+
+    bool IsNull() const
+    {
+        return satoshis == -1;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(satoshis);
+        READWRITE(script);
+        READWRITE(blockHeight);
+    }
+};
+
+/** Prefix of CAddressUnspentKey, to seek to the unspent outputs of an address */
+struct CAddressUnspentIteratorKey {
+    unsigned int type;
+    uint160 hashBytes;
+
+    CAddressUnspentIteratorKey(unsigned int addressType, const uint160& addressHash)
+    {
+        type = addressType;
+        hashBytes = addressHash;
+    }
+
+    size_t GetSerializeSize(int nType, int nVersion) const
+    {
+        return 21;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s, nType, nVersion);
+    }
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -0,0 +1,19 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/phi1612.h"
+#include "util.h"
+
+int main(int argc, char** argv)
+{
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+
+    Phi1612AutoDetect();
+
+    benchmark::BenchRunner::RunAll();
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chain.h"
+#include "main.h"
+#include "masternode.h"
+
+#include <vector>
+
+/* Size of the masternode list and of the chain the elections run on. */
+static const int BENCH_MASTERNODES = 5000;
+static const int BENCH_BLOCKS = 2000;
+
+static std::vector<uint256> vBlockHashes;
+static std::vector<CBlockIndex> vBlocks;
+
+static void SetupMasternodes()
+{
+    vBlockHashes.resize(BENCH_BLOCKS);
+    vBlocks.resize(BENCH_BLOCKS);
+    for (int i = 0; i < BENCH_BLOCKS; i++) {
+        vBlockHashes[i] = Hash(BEGIN(i), END(i));
+        vBlocks[i].phashBlock = &vBlockHashes[i];
+        vBlocks[i].nHeight = i;
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+        vBlocks[i].BuildSkip();
+    }
+    chainActive.SetTip(&vBlocks.back());
+
+    LOCK(cs_masternodes);
+    vecMasternodes.clear();
+    masternodeRanks.Clear();
+    for (int i = 0; i < BENCH_MASTERNODES; i++) {
+        CTxIn vin(Hash(BEGIN(i), END(i)), i % 2);
+        CMasterNode mn(CService("10.0.0.1", 28666), vin, CPubKey(), std::vector<unsigned char>(), GetAdjustedTime(), CPubKey(), MIN_MN_PROTO_VERSION);
+        mn.unitTest = true;
+        mn.UpdateLastSeen();
+        vecMasternodes.push_back(mn);
+    }
+}
+
+static void TeardownMasternodes()
+{
+    LOCK(cs_masternodes);
+    vecMasternodes.clear();
+    masternodeRanks.Clear();
+    chainActive.SetTip(NULL);
+}
+
+// Winner of a new block: every masternode is scored once
+static void MasternodeWinner_NewBlock(benchmark::State& state)
+{
+    SetupMasternodes();
+    int nHeight = 1;
+    while (state.KeepRunning()) {
+        GetCurrentMasterNode(1, nHeight);
+        nHeight = nHeight % (BENCH_BLOCKS - 1) + 1;
+    }
+    TeardownMasternodes();
+}
+
+// Rank lookups of InstantX votes at the current height
+static void MasternodeRank_Cached(benchmark::State& state)
+{
+    SetupMasternodes();
+    int nHeight = BENCH_BLOCKS - 1;
+    int i = 0;
+    while (state.KeepRunning()) {
+        GetMasternodeRank(vecMasternodes[i].vin, nHeight);
+        i = (i + 1) % BENCH_MASTERNODES;
+    }
+    TeardownMasternodes();
+}
+
+BENCHMARK(MasternodeWinner_NewBlock);
+BENCHMARK(MasternodeRank_Cached);
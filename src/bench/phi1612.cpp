@@ -0,0 +1,45 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/phi1612.h"
+
+#include <vector>
+
+/* Number of 80 byte block headers hashed per iteration. */
+static const size_t BENCH_HEADERS = 64;
+
+static std::vector<unsigned char> MakeHeaders()
+{
+    std::vector<unsigned char> headers(80 * BENCH_HEADERS);
+    for (size_t i = 0; i < headers.size(); i++)
+        headers[i] = (unsigned char)(i * 7 + 3);
+    return headers;
+}
+
+static void Phi1612_80b_Scalar(benchmark::State& state)
+{
+    std::vector<unsigned char> headers = MakeHeaders();
+    unsigned char out[PHI1612_OUTPUT_SIZE * BENCH_HEADERS];
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < BENCH_HEADERS; i++)
+            Phi1612Scalar(out + PHI1612_OUTPUT_SIZE * i, &headers[80 * i], 80);
+    }
+}
+
+static void Phi1612_80b_xN(benchmark::State& state)
+{
+    std::vector<unsigned char> headers = MakeHeaders();
+    const unsigned char* in[BENCH_HEADERS];
+    for (size_t i = 0; i < BENCH_HEADERS; i++)
+        in[i] = &headers[80 * i];
+    unsigned char out[PHI1612_OUTPUT_SIZE * BENCH_HEADERS];
+    while (state.KeepRunning()) {
+        Phi1612xN(out, in, 80, BENCH_HEADERS);
+    }
+}
+
+BENCHMARK(Phi1612_80b_Scalar);
+BENCHMARK(Phi1612_80b_xN);
@@ -0,0 +1,63 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "ecwrapper.h"
+#include "hash.h"
+#include "key.h"
+#include "pubkey.h"
+#include "utilstrencodings.h"
+
+#include <assert.h>
+#include <vector>
+
+/* Number of distinct signatures cycled through. One is verified per iteration,
+ * so the reported time per iteration is the inverse of sigs/s on one core. */
+static const size_t BENCH_SIGNATURES = 64;
+
+struct BenchSignature
+{
+    uint256 hash;
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+};
+
+static std::vector<BenchSignature> MakeSignatures()
+{
+    std::vector<BenchSignature> sigs(BENCH_SIGNATURES);
+    for (size_t i = 0; i < sigs.size(); i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        sigs[i].hash = Hash(BEGIN(i), END(i));
+        sigs[i].pubkey = key.GetPubKey();
+        key.Sign(sigs[i].hash, sigs[i].vchSig);
+    }
+    return sigs;
+}
+
+static void ECDSAVerify(benchmark::State& state)
+{
+    std::vector<BenchSignature> sigs = MakeSignatures();
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const BenchSignature& sig = sigs[i++ % sigs.size()];
+        assert(sig.pubkey.Verify(sig.hash, sig.vchSig));
+    }
+}
+
+static void ECDSAVerify_OpenSSL(benchmark::State& state)
+{
+    std::vector<BenchSignature> sigs = MakeSignatures();
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const BenchSignature& sig = sigs[i++ % sigs.size()];
+        CECKey key;
+        key.SetPubKey(sig.pubkey.begin(), sig.pubkey.size());
+        assert(key.Verify(sig.hash, sig.vchSig));
+    }
+}
+
+BENCHMARK(ECDSAVerify);
+BENCHMARK(ECDSAVerify_OpenSSL);
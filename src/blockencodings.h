@@ -0,0 +1,218 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+
+#include <ios>
+#include <limits>
+#include <vector>
+
+class CTxMemPool;
+
+/** Version of the compact block encoding (BIP 152) used by sendcmpct */
+static const uint64_t CMPCTBLOCK_VERSION = 1;
+
+/** Request for the transactions of a block that could not be reconstructed from the mempool */
+class BlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    //! Positions of the transactions in the block, ascending
+    std::vector<uint16_t> indexes;
+
+    size_t GetSerializeSize(int nType, int nVersion) const
+    {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    // Indexes are sent as the difference to the previous index plus one
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        blockhash.Serialize(s, nType, nVersion);
+        WriteCompactSize(s, indexes.size());
+        for (size_t i = 0; i < indexes.size(); i++)
+            WriteCompactSize(s, indexes[i] - (i == 0 ? 0 : (indexes[i - 1] + 1)));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        blockhash.Unserialize(s, nType, nVersion);
+        uint64_t nIndexes = ReadCompactSize(s);
+        indexes.clear();
+        uint64_t nOffset = 0;
+        while (indexes.size() < nIndexes) {
+            uint64_t nIndex = ReadCompactSize(s) + nOffset;
+            if (nIndex > std::numeric_limits<uint16_t>::max())
+                throw std::ios_base::failure("BlockTransactionsRequest::Unserialize : index overflowed 16 bits");
+            indexes.push_back(nIndex);
+            nOffset = nIndex + 1;
+        }
+    }
+};
+
+/** Answer to a BlockTransactionsRequest, the requested transactions in order */
+class BlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> txn;
+
+    BlockTransactions() {}
+    BlockTransactions(const BlockTransactionsRequest& req) : blockhash(req.blockhash), txn(req.indexes.size()) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        READWRITE(txn);
+    }
+};
+
+/** A transaction sent in full along with the short ids of a compact block */
+struct PrefilledTransaction
+{
+    //! On the wire the distance to the previous prefilled transaction, in memory its position in the block
+    uint16_t index;
+    CTransaction tx;
+
+    size_t GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(index) + tx.GetSerializeSize(nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, index);
+        tx.Serialize(s, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        uint64_t nIndex = ReadCompactSize(s);
+        if (nIndex > std::numeric_limits<uint16_t>::max())
+            throw std::ios_base::failure("PrefilledTransaction::Unserialize : index overflowed 16 bits");
+        index = nIndex;
+        tx.Unserialize(s, nType, nVersion);
+    }
+};
+
+enum ReadStatus {
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, //! Invalid object, peer is sending bogus data
+    READ_STATUS_FAILED,  //! Failed to process object, e.g. a short id collision
+};
+
+/**
+ * A block as relayed by the cmpctblock message: the header, the block signature
+ * of proof-of-stake blocks, the transactions the receiver can't have (the
+ * coinbase and the coinstake) and 6 byte short ids for all others.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    mutable uint64_t shorttxidk0, shorttxidk1;
+    uint64_t nonce;
+
+    void FillShortTxIDSelector() const;
+
+    friend class PartiallyDownloadedBlock;
+
+protected:
+    std::vector<uint64_t> shorttxids;
+    std::vector<PrefilledTransaction> prefilledtxn;
+
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+    // Dummy for deserialization
+    CBlockHeaderAndShortTxIDs() {}
+
+    CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+
+    size_t GetSerializeSize(int nType, int nVersion) const
+    {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, header, nType, nVersion);
+        ::Serialize(s, nonce, nType, nVersion);
+        WriteCompactSize(s, shorttxids.size());
+        for (size_t i = 0; i < shorttxids.size(); i++) {
+            // 6 bytes, little endian
+            ::Serialize(s, (uint32_t)(shorttxids[i] & 0xffffffff), nType, nVersion);
+            ::Serialize(s, (uint16_t)((shorttxids[i] >> 32) & 0xffff), nType, nVersion);
+        }
+        ::Serialize(s, prefilledtxn, nType, nVersion);
+        ::Serialize(s, vchBlockSig, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        ::Unserialize(s, header, nType, nVersion);
+        ::Unserialize(s, nonce, nType, nVersion);
+        uint64_t nShortTxIDs = ReadCompactSize(s);
+        shorttxids.clear();
+        for (uint64_t i = 0; i < nShortTxIDs; i++) {
+            uint32_t nLow;
+            uint16_t nHigh;
+            ::Unserialize(s, nLow, nType, nVersion);
+            ::Unserialize(s, nHigh, nType, nVersion);
+            shorttxids.push_back(((uint64_t)nHigh << 32) | nLow);
+        }
+        ::Unserialize(s, prefilledtxn, nType, nVersion);
+        ::Unserialize(s, vchBlockSig, nType, nVersion);
+
+        FillShortTxIDSelector();
+    }
+};
+
+/** A block being reconstructed from a compact block and the mempool */
+class PartiallyDownloadedBlock
+{
+protected:
+    std::vector<CTransaction> txn_available;
+    std::vector<bool> have_txn;
+    size_t prefilled_count, mempool_count;
+    CTxMemPool* pool;
+
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+    PartiallyDownloadedBlock(CTxMemPool* poolIn) : prefilled_count(0), mempool_count(0), pool(poolIn) {}
+
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
+    bool IsTxAvailable(size_t index) const;
+    /** Assemble the block, taking the transactions not available in order from vtx_missing */
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const;
+
+    size_t GetPrefilledCount() const { return prefilled_count; }
+    size_t GetMempoolCount() const { return mempool_count; }
+};
+
+#endif // BITCOIN_BLOCKENCODINGS_H
@@ -0,0 +1,226 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilecache.h"
+
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "sync.h"
+#include "util.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class CMappedBlockFile
+{
+private:
+    // Disallow copies
+    CMappedBlockFile(const CMappedBlockFile&);
+    CMappedBlockFile& operator=(const CMappedBlockFile&);
+
+public:
+    char* pbegin;
+    size_t nLength;
+
+    CMappedBlockFile() : pbegin(NULL), nLength(0) {}
+
+    ~CMappedBlockFile()
+    {
+#ifndef WIN32
+        if (pbegin)
+            munmap(pbegin, nLength);
+#endif
+    }
+
+    bool Map(const boost::filesystem::path& path)
+    {
+#ifdef WIN32
+        return false;
+#else
+        int fd = open(path.string().c_str(), O_RDONLY);
+        if (fd == -1)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        // The mapping stays valid after the descriptor is closed
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        pbegin = (char*)p;
+        nLength = st.st_size;
+        return true;
+#endif
+    }
+};
+
+namespace {
+
+/**
+ * Least recently used set of mapped block and undo files. Files are mapped
+ * in full; the file being appended to is remapped when a record beyond the
+ * end of its current mapping is requested.
+ */
+class CBlockFileCache
+{
+private:
+    typedef std::pair<std::string, int> CacheKey;
+    typedef std::list<CacheKey>::iterator LruIter;
+
+    struct CacheEntry
+    {
+        boost::shared_ptr<CMappedBlockFile> file;
+        LruIter itLru;
+    };
+
+    CCriticalSection cs;
+    std::map<CacheKey, CacheEntry> mapFiles;
+    //! most recently used first
+    std::list<CacheKey> lru;
+    unsigned int nMaxFiles;
+    uint64_t nMappedBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+
+    void Erase(std::map<CacheKey, CacheEntry>::iterator it)
+    {
+        nMappedBytes -= it->second.file->nLength;
+        lru.erase(it->second.itLru);
+        mapFiles.erase(it);
+    }
+
+public:
+    CBlockFileCache() : nMaxFiles(DEFAULT_BLOCKFILE_CACHE), nMappedBytes(0), nHits(0), nMisses(0), nEvictions(0) {}
+
+    void SetMaxFiles(unsigned int n)
+    {
+        LOCK(cs);
+        nMaxFiles = n;
+        while (mapFiles.size() > nMaxFiles) {
+            Erase(mapFiles.find(lru.back()));
+            nEvictions++;
+        }
+    }
+
+    //! Get a mapping of the file that covers at least nEnd bytes
+    boost::shared_ptr<CMappedBlockFile> Get(const CDiskBlockPos& pos, const char* prefix, uint64_t nEnd)
+    {
+        LOCK(cs);
+        if (nMaxFiles == 0)
+            return boost::shared_ptr<CMappedBlockFile>();
+
+        CacheKey key(prefix, pos.nFile);
+        std::map<CacheKey, CacheEntry>::iterator it = mapFiles.find(key);
+        if (it != mapFiles.end()) {
+            if (it->second.file->nLength >= nEnd) {
+                nHits++;
+                lru.splice(lru.begin(), lru, it->second.itLru);
+                return it->second.file;
+            }
+            // The file has grown since it was mapped
+            Erase(it);
+        }
+
+        nMisses++;
+        boost::shared_ptr<CMappedBlockFile> file(new CMappedBlockFile());
+        if (!file->Map(GetBlockPosFilename(pos, prefix)) || file->nLength < nEnd)
+            return boost::shared_ptr<CMappedBlockFile>();
+
+        while (mapFiles.size() >= nMaxFiles) {
+            Erase(mapFiles.find(lru.back()));
+            nEvictions++;
+        }
+        lru.push_front(key);
+        CacheEntry& entry = mapFiles[key];
+        entry.file = file;
+        entry.itLru = lru.begin();
+        nMappedBytes += file->nLength;
+        return file;
+    }
+
+    void Invalidate(int nFile)
+    {
+        LOCK(cs);
+        std::map<CacheKey, CacheEntry>::iterator it = mapFiles.find(CacheKey("blk", nFile));
+        if (it != mapFiles.end())
+            Erase(it);
+        it = mapFiles.find(CacheKey("rev", nFile));
+        if (it != mapFiles.end())
+            Erase(it);
+    }
+
+    void GetStats(CBlockFileCacheStats& stats)
+    {
+        LOCK(cs);
+        stats.nFiles = mapFiles.size();
+        stats.nCapacity = nMaxFiles;
+        stats.nMappedBytes = nMappedBytes;
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        stats.nEvictions = nEvictions;
+    }
+};
+
+CBlockFileCache blockFileCache;
+
+} // anon namespace
+
+void InitBlockFileCache(unsigned int nMaxFiles)
+{
+    blockFileCache.SetMaxFiles(nMaxFiles);
+}
+
+bool OpenBlockFileRecord(const CDiskBlockPos& pos, const char* prefix, unsigned int nTrailer, CBlockFileReader& reader)
+{
+#ifdef WIN32
+    return false;
+#else
+    // Magic and size are written in front of the record
+    if (pos.IsNull() || pos.nPos < 8)
+        return false;
+
+    boost::shared_ptr<CMappedBlockFile> file = blockFileCache.Get(pos, prefix, pos.nPos);
+    if (!file)
+        return false;
+
+    const char* pch = file->pbegin + pos.nPos;
+    unsigned int nSize = ReadLE32((const unsigned char*)pch - 4);
+    if (memcmp(pch - 8, Params().MessageStart(), MESSAGE_START_SIZE) != 0 || nSize > MAX_SIZE)
+        return error("%s : no %s record at %d:%u", __func__, prefix, pos.nFile, pos.nPos);
+
+    uint64_t nEnd = (uint64_t)pos.nPos + nSize + nTrailer;
+    if (file->nLength < nEnd) {
+        file = blockFileCache.Get(pos, prefix, nEnd);
+        if (!file)
+            return false;
+        pch = file->pbegin + pos.nPos;
+    }
+
+    reader.Init(file, pch, pch + nSize + nTrailer);
+    return true;
+#endif
+}
+
+void InvalidateBlockFileCache(int nFile)
+{
+    blockFileCache.Invalidate(nFile);
+}
+
+void GetBlockFileCacheStats(CBlockFileCacheStats& stats)
+{
+    blockFileCache.GetStats(stats);
+}
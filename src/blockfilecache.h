@@ -0,0 +1,108 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILECACHE_H
+#define BITCOIN_BLOCKFILECACHE_H
+
+#include "serialize.h"
+
+#include <ios>
+#include <stdint.h>
+#include <string.h>
+
+#include <boost/shared_ptr.hpp>
+
+struct CDiskBlockPos;
+
+/** Default number of block and undo files kept mapped */
+static const unsigned int DEFAULT_BLOCKFILE_CACHE = sizeof(void*) >= 8 ? 64 : 4;
+
+struct CBlockFileCacheStats
+{
+    uint64_t nFiles;
+    uint64_t nCapacity;
+    uint64_t nMappedBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+};
+
+/** A read-only mapping of a blk?????.dat or rev?????.dat file */
+class CMappedBlockFile;
+
+/**
+ * Stream over one record (a block or block undo entry) of a mapped block file.
+ * Holds a reference to the mapping, so it stays valid when the file is
+ * evicted from the cache while the record is being read.
+ */
+class CBlockFileReader
+{
+private:
+    boost::shared_ptr<CMappedBlockFile> file;
+    const char* pbegin;
+    const char* pcur;
+    const char* pend;
+    int nType;
+    int nVersion;
+
+public:
+    CBlockFileReader(int nTypeIn, int nVersionIn) : pbegin(NULL), pcur(NULL), pend(NULL), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    void Init(const boost::shared_ptr<CMappedBlockFile>& fileIn, const char* pbeginIn, const char* pendIn)
+    {
+        file = fileIn;
+        pbegin = pcur = pbeginIn;
+        pend = pendIn;
+    }
+
+    //! Bytes of the record not read yet
+    const char* data() const { return pcur; }
+    size_t size() const { return pend - pcur; }
+    bool empty() const { return pcur == pend; }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    CBlockFileReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CBlockFileReader::read : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    CBlockFileReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CBlockFileReader::ignore : end of data");
+        pcur += nSize;
+        return (*this);
+    }
+
+    template <typename T>
+    CBlockFileReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/** Set the number of files kept mapped */
+void InitBlockFileCache(unsigned int nMaxFiles);
+
+/**
+ * Open the record written at pos of a block ("blk") or undo ("rev") file. Records
+ * are preceded by the network magic and their size; the reader covers the record
+ * and nTrailer more bytes. Returns false if the file can not be mapped, in which
+ * case the caller falls back to reading it with stdio.
+ */
+bool OpenBlockFileRecord(const CDiskBlockPos& pos, const char* prefix, unsigned int nTrailer, CBlockFileReader& reader);
+
+/** Drop the mappings of block file nFile, after it has been truncated */
+void InvalidateBlockFileCache(int nFile);
+
+void GetBlockFileCacheStats(CBlockFileCacheStats& stats);
+
+#endif // BITCOIN_BLOCKFILECACHE_H
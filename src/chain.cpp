@@ -5,6 +5,9 @@
 
 #include "chain.h"
 
+#include <algorithm>
+#include <limits>
+
 using namespace std;
 
 /**
@@ -14,13 +17,27 @@ void CChain::SetTip(CBlockIndex* pindex)
 {
     if (pindex == NULL) {
         vChain.clear();
+        vTimeMin.clear();
         return;
     }
+    int nFork = pindex->nHeight + 1;
     vChain.resize(pindex->nHeight + 1);
     while (pindex && vChain[pindex->nHeight] != pindex) {
         vChain[pindex->nHeight] = pindex;
+        nFork = pindex->nHeight;
         pindex = pindex->pprev;
     }
+
+    // Update the minimum times from the tip down. Below the changed blocks
+    // this stops at the first height whose minimum stays the same.
+    vTimeMin.resize(vChain.size());
+    unsigned int nTimeMin = std::numeric_limits<unsigned int>::max();
+    for (int nHeight = vChain.size() - 1; nHeight >= 0; nHeight--) {
+        nTimeMin = std::min(nTimeMin, vChain[nHeight]->nTime);
+        if (nHeight < nFork && vTimeMin[nHeight] == nTimeMin)
+            break;
+        vTimeMin[nHeight] = nTimeMin;
+    }
 }
 
 CBlockLocator CChain::GetLocator(const CBlockIndex* pindex) const
@@ -61,6 +78,29 @@ const CBlockIndex* CChain::FindFork(const CBlockIndex* pindex) const
     return pindex;
 }
 
+static bool CompareTimeMax(const CBlockIndex* pindex, int64_t nTime)
+{
+    return pindex->nTimeMax < nTime;
+}
+
+CBlockIndex* CChain::FindEarliestAtLeast(int64_t nTime) const
+{
+    // nTimeMax never decreases along the chain, so no block before the first
+    // one reaching nTime has a timestamp of nTime or more
+    std::vector<CBlockIndex*>::const_iterator lower = std::lower_bound(vChain.begin(), vChain.end(), nTime, CompareTimeMax);
+    return (lower == vChain.end() ? NULL : *lower);
+}
+
+CBlockIndex* CChain::FindLatestBefore(int64_t nTime) const
+{
+    // vTimeMin never decreases either: past the last height where it is
+    // below nTime, all blocks have a timestamp of nTime or more
+    std::vector<unsigned int>::const_iterator lower = std::lower_bound(vTimeMin.begin(), vTimeMin.end(), nTime);
+    if (lower == vTimeMin.begin())
+        return NULL;
+    return vChain[lower - vTimeMin.begin() - 1];
+}
+
 uint256 CBlockIndex::GetBlockTrust() const
 {
     uint256 bnTarget;
@@ -175,6 +175,9 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    //! (memory only) Maximum nTime in the chain upto and including this block.
+    unsigned int nTimeMax;
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -189,6 +192,7 @@ public:
         nChainTx = 0;
         nStatus = 0;
         nSequenceId = 0;
+        nTimeMax = 0;
 
         nMint = 0;
         nMoneySupply = 0;
@@ -473,6 +477,8 @@ class CChain
 {
 private:
     std::vector<CBlockIndex*> vChain;
+    //! Minimum nTime of the blocks at and after each height
+    std::vector<unsigned int> vTimeMin;
 
 public:
     /** Returns the index entry for the genesis block of this chain, or NULL if none. */
@@ -540,6 +546,12 @@ public:
 
     /** Find the last common block between this chain and a block index entry. */
     const CBlockIndex* FindFork(const CBlockIndex* pindex) const;
+
+    /** Find the earliest block with timestamp equal or greater than the given, or a block before it. */
+    CBlockIndex* FindEarliestAtLeast(int64_t nTime) const;
+
+    /** Find the latest block with timestamp lower than the given, or a block after it. */
+    CBlockIndex* FindLatestBefore(int64_t nTime) const;
 };
 
 #endif // BITCOIN_CHAIN_H
@@ -7,6 +7,7 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -283,6 +284,17 @@ public:
                 return false;
         return true;
     }
+
+    //! memory held by the outputs and their scripts, not counting the CCoins itself
+    size_t DynamicMemoryUsage() const
+    {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH (const CTxOut& out, vout) {
+            const std::vector<unsigned char>* script = &out.scriptPubKey;
+            ret += memusage::DynamicUsage(*script);
+        }
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -307,6 +319,7 @@ public:
 struct CCoinsCacheEntry {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    std::vector<bool> vBaseAvailable; // Which outputs were unspent in the parent view when the entry was fetched.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -314,6 +327,20 @@ struct CCoinsCacheEntry {
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
+
+    //! Remember which outputs of coins, as just fetched from the parent view, are unspent there
+    void SetBaseAvailable()
+    {
+        vBaseAvailable.resize(coins.vout.size());
+        for (unsigned int n = 0; n < coins.vout.size(); n++)
+            vBaseAvailable[n] = coins.IsAvailable(n);
+    }
+
+    //! Whether output n was unspent in the parent view when the entry was fetched
+    bool IsBaseAvailable(unsigned int n) const
+    {
+        return n < vBaseAvailable.size() && vBaseAvailable[n];
+    }
 };
 
 typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
@@ -369,6 +396,7 @@ public:
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView& viewIn);
+    CCoinsView* GetBackend() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
 };
@@ -398,7 +426,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -421,6 +450,9 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -446,6 +478,15 @@ public:
      */
     CCoinsModifier ModifyCoins(const uint256& txid);
 
+    //! Check whether the coins of a transaction are in the cache, without fetching them
+    bool HaveCoinsInCache(const uint256& txid) const;
+
+    /**
+     * Add the coins of a transaction, as read from the backing view by the
+     * caller, to the cache. Nothing changes if the transaction is cached already.
+     */
+    void AddFetchedCoins(const uint256& txid, CCoins& coins);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
@@ -456,6 +497,9 @@ public:
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the memory used by the cache, in bytes
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of lux coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -0,0 +1,49 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_CPUID_H
+#define BITCOIN_CRYPTO_CPUID_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#define HAVE_X86_CPUID 1
+
+/** Instruction set extensions the multi-lane hash engines can use. */
+struct CPUFeatures
+{
+    bool fSSE41;
+    bool fAES;
+    bool fAVX2;
+};
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __asm__("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "0"(leaf), "2"(subleaf));
+}
+
+/** Query the CPU, and the OS for AVX register support. */
+static inline CPUFeatures GetCPUFeatures()
+{
+    CPUFeatures features;
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, eax, ebx, ecx, edx);
+    features.fSSE41 = (ecx >> 19) & 1;
+    features.fAES = (ecx >> 25) & 1;
+    features.fAVX2 = false;
+    const bool have_xsave = (ecx >> 27) & 1;
+    const bool have_avx = (ecx >> 28) & 1;
+    if (have_xsave && have_avx) {
+        uint32_t a, d;
+        __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+        if ((a & 6) == 6) {
+            cpuid(7, 0, eax, ebx, ecx, edx);
+            features.fAVX2 = (ebx >> 5) & 1;
+        }
+    }
+    return features;
+}
+#endif
+
+#endif // BITCOIN_CRYPTO_CPUID_H
@@ -0,0 +1,137 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/lux-config.h"
+#endif
+
+#include "crypto/phi1612.h"
+
+#include "crypto/cpuid.h"
+#include "crypto/sph_cubehash.h"
+#include "crypto/sph_echo.h"
+#include "crypto/sph_fugue.h"
+#include "crypto/sph_gost.h"
+#include "crypto/sph_jh.h"
+#include "crypto/sph_skein.h"
+
+#include <string.h>
+
+#if defined(HAVE_X86_CPUID)
+#if defined(ENABLE_SSE41)
+namespace phi1612_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* const* in, size_t len);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace phi1612_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* const* in, size_t len);
+}
+#endif
+#endif
+
+namespace
+{
+typedef void (*TransformNWayType)(unsigned char*, const unsigned char* const*, size_t);
+
+TransformNWayType TransformNWay = NULL;
+size_t nTransformLanes = 1;
+} // namespace
+
+void Phi1612Scalar(unsigned char* out, const unsigned char* in, size_t len)
+{
+    sph_skein512_context ctx_skein;
+    sph_jh512_context ctx_jh;
+    sph_cubehash512_context ctx_cubehash;
+    sph_fugue512_context ctx_fugue;
+    sph_gost512_context ctx_gost;
+    sph_echo512_context ctx_echo;
+    unsigned char hash[2][64];
+
+    sph_skein512_init(&ctx_skein);
+    sph_skein512(&ctx_skein, in, len);
+    sph_skein512_close(&ctx_skein, hash[0]);
+
+    sph_jh512_init(&ctx_jh);
+    sph_jh512(&ctx_jh, hash[0], 64);
+    sph_jh512_close(&ctx_jh, hash[1]);
+
+    sph_cubehash512_init(&ctx_cubehash);
+    sph_cubehash512(&ctx_cubehash, hash[1], 64);
+    sph_cubehash512_close(&ctx_cubehash, hash[0]);
+
+    sph_fugue512_init(&ctx_fugue);
+    sph_fugue512(&ctx_fugue, hash[0], 64);
+    sph_fugue512_close(&ctx_fugue, hash[1]);
+
+    sph_gost512_init(&ctx_gost);
+    sph_gost512(&ctx_gost, hash[1], 64);
+    sph_gost512_close(&ctx_gost, hash[0]);
+
+    sph_echo512_init(&ctx_echo);
+    sph_echo512(&ctx_echo, hash[0], 64);
+    sph_echo512_close(&ctx_echo, hash[1]);
+
+    memcpy(out, hash[1], PHI1612_OUTPUT_SIZE);
+}
+
+std::string Phi1612AutoDetect()
+{
+    std::string ret = "standard";
+    TransformNWay = NULL;
+    nTransformLanes = 1;
+#if defined(HAVE_X86_CPUID)
+    const CPUFeatures features = GetCPUFeatures();
+    (void)features;
+
+#if defined(ENABLE_AVX2)
+    if (features.fAVX2 && features.fAES) {
+        TransformNWay = phi1612_avx2::Transform_8way;
+        nTransformLanes = 8;
+        return "avx2(8way)";
+    }
+#endif
+#if defined(ENABLE_SSE41)
+    if (features.fSSE41 && features.fAES) {
+        TransformNWay = phi1612_sse41::Transform_4way;
+        nTransformLanes = 4;
+        return "sse4(4way)";
+    }
+#endif
+#endif
+    return ret;
+}
+
+size_t Phi1612Lanes()
+{
+    return nTransformLanes;
+}
+
+void Phi1612xN(unsigned char* out, const unsigned char* const* in, size_t len, size_t blocks)
+{
+    if (TransformNWay) {
+        while (blocks >= nTransformLanes) {
+            TransformNWay(out, in, len);
+            out += PHI1612_OUTPUT_SIZE * nTransformLanes;
+            in += nTransformLanes;
+            blocks -= nTransformLanes;
+        }
+        if (blocks > 1) {
+            // Fill the idle lanes with copies of the last message; one padded
+            // pass is still cheaper than hashing the leftovers one by one.
+            const unsigned char* pin[PHI1612_MAX_LANES];
+            unsigned char tmp[PHI1612_OUTPUT_SIZE * PHI1612_MAX_LANES];
+            for (size_t i = 0; i < nTransformLanes; i++)
+                pin[i] = in[i < blocks ? i : blocks - 1];
+            TransformNWay(tmp, pin, len);
+            memcpy(out, tmp, PHI1612_OUTPUT_SIZE * blocks);
+            return;
+        }
+    }
+    for (size_t i = 0; i < blocks; i++)
+        Phi1612Scalar(out + PHI1612_OUTPUT_SIZE * i, in[i], len);
+}
@@ -0,0 +1,33 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_PHI1612_H
+#define BITCOIN_CRYPTO_PHI1612_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** Size of a PHI1612 digest in bytes. */
+static const size_t PHI1612_OUTPUT_SIZE = 32;
+
+/** Widest lane count any PHI1612 engine uses. */
+static const size_t PHI1612_MAX_LANES = 8;
+
+/** Autodetect the best available multi-lane PHI1612 engine. Returns the name of the engine. */
+std::string Phi1612AutoDetect();
+
+/** Number of messages the selected engine hashes per pass (1 when only the portable code is available). */
+size_t Phi1612Lanes();
+
+/** Compute PHI1612 of a single message with the portable sph code. */
+void Phi1612Scalar(unsigned char* out, const unsigned char* in, size_t len);
+
+/**
+ * Compute PHI1612 of `blocks` messages of `len` bytes each. in[i] points to
+ * message i and out receives PHI1612_OUTPUT_SIZE bytes per message.
+ */
+void Phi1612xN(unsigned char* out, const unsigned char* const* in, size_t len, size_t blocks);
+
+#endif // BITCOIN_CRYPTO_PHI1612_H
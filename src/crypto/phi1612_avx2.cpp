@@ -0,0 +1,20 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Eight-lane PHI1612 engine, built with -mavx -mavx2 -maes.
+
+#ifdef ENABLE_AVX2
+
+#define PHI1612_VECTOR_BYTES 32
+#include "crypto/phi1612_lanes.h"
+
+namespace phi1612_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* const* in, size_t len)
+{
+    Phi1612Lanes(out, in, len);
+}
+}
+
+#endif
@@ -0,0 +1,735 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Multi-lane PHI1612 kernels shared by the per-ISA translation units.
+//
+// Every lane carries one independent message. The skein, jh and cubehash
+// stages keep their state transposed so that word i of several lanes lives in
+// one vector register: cubehash works on 32-bit words and covers all
+// PHI1612_LANES lanes at once, while the 64-bit skein and jh stages cover half
+// of them per pass. The echo stage runs on AES-NI one lane at a time, and
+// fugue and gost use the sph code.
+//
+// The including file must define PHI1612_VECTOR_BYTES to the register width
+// it is compiled for. Everything in here has internal linkage so that each
+// ISA gets its own copy.
+
+#ifndef PHI1612_VECTOR_BYTES
+#error "PHI1612_VECTOR_BYTES must be defined before including crypto/phi1612_lanes.h"
+#endif
+
+#define PHI1612_LANES (PHI1612_VECTOR_BYTES / 4)
+#define PHI1612_LANES64 (PHI1612_VECTOR_BYTES / 8)
+
+#include "crypto/common.h"
+#include "crypto/sph_fugue.h"
+#include "crypto/sph_gost.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+namespace
+{
+typedef uint64_t v64 __attribute__((vector_size(PHI1612_VECTOR_BYTES)));
+typedef uint32_t v32 __attribute__((vector_size(PHI1612_VECTOR_BYTES)));
+
+// Vectors are only passed by reference; by-value vector arguments wider than
+// the baseline ABI trigger -Wpsabi warnings.
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/** Broadcast a constant into every lane. */
+inline void Splat64(v64& r, uint64_t x)
+{
+    for (int i = 0; i < PHI1612_LANES64; i++)
+        r[i] = x;
+}
+
+inline void Splat32(v32& r, uint32_t x)
+{
+    for (int i = 0; i < PHI1612_LANES; i++)
+        r[i] = x;
+}
+
+/** Gather the little-endian 64-bit word at offset of every lane's message into one vector. */
+inline void Load64(v64& r, const unsigned char* const* in, size_t offset)
+{
+    for (int i = 0; i < PHI1612_LANES64; i++)
+        r[i] = ReadLE64(in[i] + offset);
+}
+
+inline void Store64(unsigned char (*out)[64], size_t offset, const v64& x)
+{
+    for (int i = 0; i < PHI1612_LANES64; i++)
+        WriteLE64(out[i] + offset, x[i]);
+}
+
+/* ----------- Skein-512 ----------------------------------------------------- */
+
+const uint64_t SKEIN_IV512[8] = {
+    0x4903ADFF749C51CEULL, 0x0D95DE399746DF03ULL,
+    0x8FD1934127C79BCEULL, 0x9A255629FF352CB1ULL,
+    0x5DB62599DF6CA7B0ULL, 0xEABE394CA9D5C3F4ULL,
+    0x991112C71A75B523ULL, 0xAE18A40B660FCC33ULL};
+
+#define SKEIN_MIX(x0, x1, rc) do { \
+        x0 += x1; \
+        x1 = ROTL64(x1, rc) ^ x0; \
+    } while (0)
+
+#define SKEIN_MIX8(w0, w1, w2, w3, w4, w5, w6, w7, rc0, rc1, rc2, rc3) do { \
+        SKEIN_MIX(p[w0], p[w1], rc0); \
+        SKEIN_MIX(p[w2], p[w3], rc1); \
+        SKEIN_MIX(p[w4], p[w5], rc2); \
+        SKEIN_MIX(p[w6], p[w7], rc3); \
+    } while (0)
+
+#define SKEIN_ADDKEY(s) do { \
+        for (int i = 0; i < 8; i++) \
+            p[i] += k[((s) + i) % 9]; \
+        p[5] += t[(s) % 3]; \
+        p[6] += t[((s) + 1) % 3]; \
+        p[7] += (uint64_t)(s); \
+    } while (0)
+
+/** One UBI block: h = Threefish-512(key h, tweak t0/t1)(m) ^ m. */
+inline void SkeinUBI(v64 h[8], const v64 m[8], uint64_t t0, uint64_t t1)
+{
+    const uint64_t t[3] = {t0, t1, t0 ^ t1};
+    v64 k[9], p[8];
+    Splat64(k[8], 0x1BD11BDAA9FC1A22ULL);
+    for (int i = 0; i < 8; i++) {
+        k[i] = h[i];
+        k[8] ^= h[i];
+        p[i] = m[i];
+    }
+    for (int s = 0; s < 18; s += 2) {
+        SKEIN_ADDKEY(s);
+        SKEIN_MIX8(0, 1, 2, 3, 4, 5, 6, 7, 46, 36, 19, 37);
+        SKEIN_MIX8(2, 1, 4, 7, 6, 5, 0, 3, 33, 27, 14, 42);
+        SKEIN_MIX8(4, 1, 6, 3, 0, 5, 2, 7, 17, 49, 36, 39);
+        SKEIN_MIX8(6, 1, 0, 7, 2, 5, 4, 3, 44, 9, 54, 56);
+        SKEIN_ADDKEY(s + 1);
+        SKEIN_MIX8(0, 1, 2, 3, 4, 5, 6, 7, 39, 30, 34, 24);
+        SKEIN_MIX8(2, 1, 4, 7, 6, 5, 0, 3, 13, 50, 10, 17);
+        SKEIN_MIX8(4, 1, 6, 3, 0, 5, 2, 7, 25, 29, 39, 43);
+        SKEIN_MIX8(6, 1, 0, 7, 2, 5, 4, 3, 8, 35, 56, 22);
+    }
+    SKEIN_ADDKEY(18);
+    for (int i = 0; i < 8; i++)
+        h[i] = m[i] ^ p[i];
+}
+
+#undef SKEIN_ADDKEY
+#undef SKEIN_MIX8
+#undef SKEIN_MIX
+
+/** Skein-512-512 of len bytes for PHI1612_LANES64 lanes, matching sph_skein512. */
+void Skein512(unsigned char (*out)[64], const unsigned char* const* in, size_t len)
+{
+    const size_t nBlocks = len == 0 ? 1 : (len + 63) / 64;
+    v64 h[8], m[8];
+    for (int i = 0; i < 8; i++)
+        Splat64(h[i], SKEIN_IV512[i]);
+
+    for (size_t b = 0; b + 1 < nBlocks; b++) {
+        for (int i = 0; i < 8; i++)
+            Load64(m[i], in, 64 * b + 8 * i);
+        SkeinUBI(h, m, 64 * (b + 1), (uint64_t)(96 + (b == 0 ? 128 : 0)) << 55);
+    }
+
+    // The final block is zero padded; copy the tails out so every lane can
+    // be loaded with full-width reads.
+    unsigned char tail[PHI1612_LANES64][64];
+    const unsigned char* ptail[PHI1612_LANES64];
+    const size_t nTail = len - 64 * (nBlocks - 1);
+    for (int i = 0; i < PHI1612_LANES64; i++) {
+        memset(tail[i], 0, 64);
+        if (nTail)
+            memcpy(tail[i], in[i] + 64 * (nBlocks - 1), nTail);
+        ptail[i] = tail[i];
+    }
+    for (int i = 0; i < 8; i++)
+        Load64(m[i], ptail, 8 * i);
+    SkeinUBI(h, m, len, (uint64_t)(352 + (nBlocks == 1 ? 128 : 0)) << 55);
+
+    // Output transform: a single zero block typed as output.
+    for (int i = 0; i < 8; i++)
+        Splat64(m[i], 0);
+    SkeinUBI(h, m, 8, (uint64_t)510 << 55);
+
+    for (int i = 0; i < 8; i++)
+        Store64(out, 8 * i, h[i]);
+}
+
+/* ----------- JH-512 -------------------------------------------------------- */
+
+#define JH_C64e(x) ((((uint64_t)(x)) >> 56) \
+        | ((((uint64_t)(x)) >> 40) & 0x000000000000FF00ULL) \
+        | ((((uint64_t)(x)) >> 24) & 0x0000000000FF0000ULL) \
+        | ((((uint64_t)(x)) >>  8) & 0x00000000FF000000ULL) \
+        | ((((uint64_t)(x)) <<  8) & 0x000000FF00000000ULL) \
+        | ((((uint64_t)(x)) << 24) & 0x0000FF0000000000ULL) \
+        | ((((uint64_t)(x)) << 40) & 0x00FF000000000000ULL) \
+        | ((((uint64_t)(x)) << 56) & 0xFF00000000000000ULL))
+
+const uint64_t JH_IV512[16] = {
+    JH_C64e(0x6fd14b963e00aa17ULL), JH_C64e(0x636a2e057a15d543ULL),
+    JH_C64e(0x8a225e8d0c97ef0bULL), JH_C64e(0xe9341259f2b3c361ULL),
+    JH_C64e(0x891da0c1536f801eULL), JH_C64e(0x2aa9056bea2b6d80ULL),
+    JH_C64e(0x588eccdb2075baa6ULL), JH_C64e(0xa90f3a76baf83bf7ULL),
+    JH_C64e(0x0169e60541e34a69ULL), JH_C64e(0x46b58a8e2e6fe65aULL),
+    JH_C64e(0x1047a7d0c1843c24ULL), JH_C64e(0x3b6e71b12d5ac199ULL),
+    JH_C64e(0xcf57f6ec9db1f856ULL), JH_C64e(0xa706887c5716b156ULL),
+    JH_C64e(0xe3c2fcdfe68517fbULL), JH_C64e(0x545a4678cc8cdd4bULL)};
+
+/** Round constants of E8, two 64-bit halves for the even and odd S-boxes. */
+const uint64_t JH_C[] = {
+    JH_C64e(0x72d5dea2df15f867ULL), JH_C64e(0x7b84150ab7231557ULL),
+    JH_C64e(0x81abd6904d5a87f6ULL), JH_C64e(0x4e9f4fc5c3d12b40ULL),
+    JH_C64e(0xea983ae05c45fa9cULL), JH_C64e(0x03c5d29966b2999aULL),
+    JH_C64e(0x660296b4f2bb538aULL), JH_C64e(0xb556141a88dba231ULL),
+    JH_C64e(0x03a35a5c9a190edbULL), JH_C64e(0x403fb20a87c14410ULL),
+    JH_C64e(0x1c051980849e951dULL), JH_C64e(0x6f33ebad5ee7cddcULL),
+    JH_C64e(0x10ba139202bf6b41ULL), JH_C64e(0xdc786515f7bb27d0ULL),
+    JH_C64e(0x0a2c813937aa7850ULL), JH_C64e(0x3f1abfd2410091d3ULL),
+    JH_C64e(0x422d5a0df6cc7e90ULL), JH_C64e(0xdd629f9c92c097ceULL),
+    JH_C64e(0x185ca70bc72b44acULL), JH_C64e(0xd1df65d663c6fc23ULL),
+    JH_C64e(0x976e6c039ee0b81aULL), JH_C64e(0x2105457e446ceca8ULL),
+    JH_C64e(0xeef103bb5d8e61faULL), JH_C64e(0xfd9697b294838197ULL),
+    JH_C64e(0x4a8e8537db03302fULL), JH_C64e(0x2a678d2dfb9f6a95ULL),
+    JH_C64e(0x8afe7381f8b8696cULL), JH_C64e(0x8ac77246c07f4214ULL),
+    JH_C64e(0xc5f4158fbdc75ec4ULL), JH_C64e(0x75446fa78f11bb80ULL),
+    JH_C64e(0x52de75b7aee488bcULL), JH_C64e(0x82b8001e98a6a3f4ULL),
+    JH_C64e(0x8ef48f33a9a36315ULL), JH_C64e(0xaa5f5624d5b7f989ULL),
+    JH_C64e(0xb6f1ed207c5ae0fdULL), JH_C64e(0x36cae95a06422c36ULL),
+    JH_C64e(0xce2935434efe983dULL), JH_C64e(0x533af974739a4ba7ULL),
+    JH_C64e(0xd0f51f596f4e8186ULL), JH_C64e(0x0e9dad81afd85a9fULL),
+    JH_C64e(0xa7050667ee34626aULL), JH_C64e(0x8b0b28be6eb91727ULL),
+    JH_C64e(0x47740726c680103fULL), JH_C64e(0xe0a07e6fc67e487bULL),
+    JH_C64e(0x0d550aa54af8a4c0ULL), JH_C64e(0x91e3e79f978ef19eULL),
+    JH_C64e(0x8676728150608dd4ULL), JH_C64e(0x7e9e5a41f3e5b062ULL),
+    JH_C64e(0xfc9f1fec4054207aULL), JH_C64e(0xe3e41a00cef4c984ULL),
+    JH_C64e(0x4fd794f59dfa95d8ULL), JH_C64e(0x552e7e1124c354a5ULL),
+    JH_C64e(0x5bdf7228bdfe6e28ULL), JH_C64e(0x78f57fe20fa5c4b2ULL),
+    JH_C64e(0x05897cefee49d32eULL), JH_C64e(0x447e9385eb28597fULL),
+    JH_C64e(0x705f6937b324314aULL), JH_C64e(0x5e8628f11dd6e465ULL),
+    JH_C64e(0xc71b770451b920e7ULL), JH_C64e(0x74fe43e823d4878aULL),
+    JH_C64e(0x7d29e8a3927694f2ULL), JH_C64e(0xddcb7a099b30d9c1ULL),
+    JH_C64e(0x1d1b30fb5bdc1be0ULL), JH_C64e(0xda24494ff29c82bfULL),
+    JH_C64e(0xa4e7ba31b470bfffULL), JH_C64e(0x0d324405def8bc48ULL),
+    JH_C64e(0x3baefc3253bbd339ULL), JH_C64e(0x459fc3c1e0298ba0ULL),
+    JH_C64e(0xe5c905fdf7ae090fULL), JH_C64e(0x947034124290f134ULL),
+    JH_C64e(0xa271b701e344ed95ULL), JH_C64e(0xe93b8e364f2f984aULL),
+    JH_C64e(0x88401d63a06cf615ULL), JH_C64e(0x47c1444b8752afffULL),
+    JH_C64e(0x7ebb4af1e20ac630ULL), JH_C64e(0x4670b6c5cc6e8ce6ULL),
+    JH_C64e(0xa4d5a456bd4fca00ULL), JH_C64e(0xda9d844bc83e18aeULL),
+    JH_C64e(0x7357ce453064d1adULL), JH_C64e(0xe8a6ce68145c2567ULL),
+    JH_C64e(0xa3da8cf2cb0ee116ULL), JH_C64e(0x33e906589a94999aULL),
+    JH_C64e(0x1f60b220c26f847bULL), JH_C64e(0xd1ceac7fa0d18518ULL),
+    JH_C64e(0x32595ba18ddd19d3ULL), JH_C64e(0x509a1cc0aaa5b446ULL),
+    JH_C64e(0x9f3d6367e4046bbaULL), JH_C64e(0xf6ca19ab0b56ee7eULL),
+    JH_C64e(0x1fb179eaa9282174ULL), JH_C64e(0xe9bdf7353b3651eeULL),
+    JH_C64e(0x1d57ac5a7550d376ULL), JH_C64e(0x3a46c2fea37d7001ULL),
+    JH_C64e(0xf735c1af98a4d842ULL), JH_C64e(0x78edec209e6b6779ULL),
+    JH_C64e(0x41836315ea3adba8ULL), JH_C64e(0xfac33b4d32832c83ULL),
+    JH_C64e(0xa7403b1f1c2747f3ULL), JH_C64e(0x5940f034b72d769aULL),
+    JH_C64e(0xe73e4e6cd2214ffdULL), JH_C64e(0xb8fd8d39dc5759efULL),
+    JH_C64e(0x8d9b0c492b49ebdaULL), JH_C64e(0x5ba2d74968f3700dULL),
+    JH_C64e(0x7d3baed07a8d5584ULL), JH_C64e(0xf5a5e9f0e4f88e65ULL),
+    JH_C64e(0xa0b8a2f436103b53ULL), JH_C64e(0x0ca8079e753eec5aULL),
+    JH_C64e(0x9168949256e8884fULL), JH_C64e(0x5bb05c55f8babc4cULL),
+    JH_C64e(0xe3bb3b99f387947bULL), JH_C64e(0x75daf4d6726b1c5dULL),
+    JH_C64e(0x64aeac28dc34b36dULL), JH_C64e(0x6c34a550b828db71ULL),
+    JH_C64e(0xf861e2f2108d512aULL), JH_C64e(0xe3db643359dd75fcULL),
+    JH_C64e(0x1cacbcf143ce3fa2ULL), JH_C64e(0x67bbd13c02e843b0ULL),
+    JH_C64e(0x330a5bca8829a175ULL), JH_C64e(0x7f34194db416535cULL),
+    JH_C64e(0x923b94c30e794d1eULL), JH_C64e(0x797475d7b6eeaf3fULL),
+    JH_C64e(0xeaa8d4f7be1a3921ULL), JH_C64e(0x5cf47e094c232751ULL),
+    JH_C64e(0x26a32453ba323cd2ULL), JH_C64e(0x44a3174a6da6d5adULL),
+    JH_C64e(0xb51d3ea6aff2c908ULL), JH_C64e(0x83593d98916b3c56ULL),
+    JH_C64e(0x4cf87ca17286604dULL), JH_C64e(0x46e23ecc086ec7f6ULL),
+    JH_C64e(0x2f9833b3b1bc765eULL), JH_C64e(0x2bd666a5efc4e62aULL),
+    JH_C64e(0x06f4b6e8bec1d436ULL), JH_C64e(0x74ee8215bcef2163ULL),
+    JH_C64e(0xfdc14e0df453c969ULL), JH_C64e(0xa77d5ac406585826ULL),
+    JH_C64e(0x7ec1141606e0fa16ULL), JH_C64e(0x7e90af3d28639d3fULL),
+    JH_C64e(0xd2c9f2e3009bd20cULL), JH_C64e(0x5faace30b7d40c30ULL),
+    JH_C64e(0x742a5116f2e03298ULL), JH_C64e(0x0deb30d8e3cef89aULL),
+    JH_C64e(0x4bc59e7bb5f17992ULL), JH_C64e(0xff51e66e048668d3ULL),
+    JH_C64e(0x9b234d57e6966731ULL), JH_C64e(0xcce6a6f3170a7505ULL),
+    JH_C64e(0xb17681d913326cceULL), JH_C64e(0x3c175284f805a262ULL),
+    JH_C64e(0xf42bcbb378471547ULL), JH_C64e(0xff46548223936a48ULL),
+    JH_C64e(0x38df58074e5e6565ULL), JH_C64e(0xf2fc7c89fc86508eULL),
+    JH_C64e(0x31702e44d00bca86ULL), JH_C64e(0xf04009a23078474eULL),
+    JH_C64e(0x65a0ee39d1f73883ULL), JH_C64e(0xf75ee937e42c3abdULL),
+    JH_C64e(0x2197b2260113f86fULL), JH_C64e(0xa344edd1ef9fdee7ULL),
+    JH_C64e(0x8ba0df15762592d9ULL), JH_C64e(0x3c85f7f612dc42beULL),
+    JH_C64e(0xd8a7ec7cab27b07eULL), JH_C64e(0x538d7ddaaa3ea8deULL),
+    JH_C64e(0xaa25ce93bd0269d8ULL), JH_C64e(0x5af643fd1a7308f9ULL),
+    JH_C64e(0xc05fefda174a19a5ULL), JH_C64e(0x974d66334cfd216aULL),
+    JH_C64e(0x35b49831db411570ULL), JH_C64e(0xea1e0fbbedcd549bULL),
+    JH_C64e(0x9ad063a151974072ULL), JH_C64e(0xf6759dbf91476fe2ULL)};
+
+#define JH_SB(x0, x1, x2, x3, c) do { \
+        x3 = ~x3; \
+        x0 ^= (c) & ~x2; \
+        tmp = (c) ^ (x0 & x1); \
+        x0 ^= x2 & x3; \
+        x3 ^= ~x1 & x2; \
+        x1 ^= x0 & x2; \
+        x2 ^= x0 & ~x3; \
+        x0 ^= x1 | x3; \
+        x3 ^= x1 & x2; \
+        x1 ^= tmp & x0; \
+        x2 ^= tmp; \
+    } while (0)
+
+#define JH_LB(x0, x1, x2, x3, x4, x5, x6, x7) do { \
+        x4 ^= x1; \
+        x5 ^= x2; \
+        x6 ^= x3 ^ x0; \
+        x7 ^= x0; \
+        x0 ^= x5; \
+        x1 ^= x6; \
+        x2 ^= x7 ^ x4; \
+        x3 ^= x4; \
+    } while (0)
+
+const uint64_t JH_WMASK[7] = {
+    0x5555555555555555ULL, 0x3333333333333333ULL, 0x0F0F0F0F0F0F0F0FULL,
+    0x00FF00FF00FF00FFULL, 0x0000FFFF0000FFFFULL, 0x00000000FFFFFFFFULL, 0};
+
+/** One round of E8; h[i][0] and h[i][1] are the high and low halves of word i. */
+template <int ro>
+inline void JHRound(v64 h[8][2], int r)
+{
+    v64 tmp;
+    for (int x = 0; x < 2; x++) {
+        const uint64_t ce = JH_C[4 * r + x];
+        const uint64_t co = JH_C[4 * r + 2 + x];
+        JH_SB(h[0][x], h[2][x], h[4][x], h[6][x], ce);
+        JH_SB(h[1][x], h[3][x], h[5][x], h[7][x], co);
+        JH_LB(h[0][x], h[2][x], h[4][x], h[6][x], h[1][x], h[3][x], h[5][x], h[7][x]);
+    }
+    for (int i = 1; i < 8; i += 2) {
+        if (ro == 6) {
+            tmp = h[i][0];
+            h[i][0] = h[i][1];
+            h[i][1] = tmp;
+        } else {
+            for (int x = 0; x < 2; x++) {
+                tmp = (h[i][x] & JH_WMASK[ro]) << (1 << ro);
+                h[i][x] = ((h[i][x] >> (1 << ro)) & JH_WMASK[ro]) | tmp;
+            }
+        }
+    }
+}
+
+/** The E8 bijection: 42 rounds, cycling through the seven bit permutations. */
+inline void JHE8(v64 h[8][2])
+{
+    for (int r = 0; r < 42; r += 7) {
+        JHRound<0>(h, r);
+        JHRound<1>(h, r + 1);
+        JHRound<2>(h, r + 2);
+        JHRound<3>(h, r + 3);
+        JHRound<4>(h, r + 4);
+        JHRound<5>(h, r + 5);
+        JHRound<6>(h, r + 6);
+    }
+}
+
+#undef JH_LB
+#undef JH_SB
+
+inline void JHF8(v64 h[8][2], const v64 m[8])
+{
+    for (int i = 0; i < 4; i++) {
+        h[i][0] ^= m[2 * i];
+        h[i][1] ^= m[2 * i + 1];
+    }
+    JHE8(h);
+    for (int i = 0; i < 4; i++) {
+        h[i + 4][0] ^= m[2 * i];
+        h[i + 4][1] ^= m[2 * i + 1];
+    }
+}
+
+/** JH-512 of a 64 byte message for PHI1612_LANES64 lanes, matching sph_jh512. */
+void JH512(unsigned char (*out)[64], const unsigned char* const* in)
+{
+    v64 h[8][2], m[8];
+    for (int i = 0; i < 8; i++) {
+        Splat64(h[i][0], JH_IV512[2 * i]);
+        Splat64(h[i][1], JH_IV512[2 * i + 1]);
+    }
+    for (int i = 0; i < 8; i++)
+        Load64(m[i], in, 8 * i);
+    JHF8(h, m);
+
+    // Padding block: a single 1 bit followed by the 128-bit big-endian
+    // message length in bits.
+    unsigned char pad[64] = {0x80};
+    pad[62] = 0x02;
+    for (int i = 0; i < 8; i++)
+        Splat64(m[i], ReadLE64(pad + 8 * i));
+    JHF8(h, m);
+
+    for (int i = 0; i < 8; i++)
+        Store64(out, 8 * i, h[4 + i / 2][i % 2]);
+}
+
+/* ----------- CubeHash-512 (CubeHash16/32) ---------------------------------- */
+
+const uint32_t CUBEHASH_IV512[32] = {
+    0x2AEA2A61, 0x50F494D4, 0x2D538B8B, 0x4167D83E,
+    0x3FEE2313, 0xC701CF8C, 0xCC39968E, 0x50AC5695,
+    0x4D42C787, 0xA647A8B3, 0x97CF0BEF, 0x825B4537,
+    0xEEF864D2, 0xF22090C4, 0xD0E5CD33, 0xA23911AE,
+    0xFCD398D9, 0x148FE485, 0x1B017BEF, 0xB6444532,
+    0x6A536159, 0x2FF5781C, 0x91FA7934, 0x0DBADEA9,
+    0xD65C8A2B, 0xA5A70E75, 0xB1C62456, 0xBC796576,
+    0x1921C8F7, 0xE7989AF1, 0x7795D246, 0xD43E3B44};
+
+// The round macros follow sph's cubehash.c: the word swaps of the
+// specification are folded into a renaming, which an even number of rounds
+// undoes.
+#define CUBEHASH_ROUND_EVEN do { \
+        x[16] += x[0]; \
+        x[0] = ROTL32(x[0], 7); \
+        x[17] += x[1]; \
+        x[1] = ROTL32(x[1], 7); \
+        x[18] += x[2]; \
+        x[2] = ROTL32(x[2], 7); \
+        x[19] += x[3]; \
+        x[3] = ROTL32(x[3], 7); \
+        x[20] += x[4]; \
+        x[4] = ROTL32(x[4], 7); \
+        x[21] += x[5]; \
+        x[5] = ROTL32(x[5], 7); \
+        x[22] += x[6]; \
+        x[6] = ROTL32(x[6], 7); \
+        x[23] += x[7]; \
+        x[7] = ROTL32(x[7], 7); \
+        x[24] += x[8]; \
+        x[8] = ROTL32(x[8], 7); \
+        x[25] += x[9]; \
+        x[9] = ROTL32(x[9], 7); \
+        x[26] += x[10]; \
+        x[10] = ROTL32(x[10], 7); \
+        x[27] += x[11]; \
+        x[11] = ROTL32(x[11], 7); \
+        x[28] += x[12]; \
+        x[12] = ROTL32(x[12], 7); \
+        x[29] += x[13]; \
+        x[13] = ROTL32(x[13], 7); \
+        x[30] += x[14]; \
+        x[14] = ROTL32(x[14], 7); \
+        x[31] += x[15]; \
+        x[15] = ROTL32(x[15], 7); \
+        x[8] ^= x[16]; \
+        x[9] ^= x[17]; \
+        x[10] ^= x[18]; \
+        x[11] ^= x[19]; \
+        x[12] ^= x[20]; \
+        x[13] ^= x[21]; \
+        x[14] ^= x[22]; \
+        x[15] ^= x[23]; \
+        x[0] ^= x[24]; \
+        x[1] ^= x[25]; \
+        x[2] ^= x[26]; \
+        x[3] ^= x[27]; \
+        x[4] ^= x[28]; \
+        x[5] ^= x[29]; \
+        x[6] ^= x[30]; \
+        x[7] ^= x[31]; \
+        x[18] += x[8]; \
+        x[8] = ROTL32(x[8], 11); \
+        x[19] += x[9]; \
+        x[9] = ROTL32(x[9], 11); \
+        x[16] += x[10]; \
+        x[10] = ROTL32(x[10], 11); \
+        x[17] += x[11]; \
+        x[11] = ROTL32(x[11], 11); \
+        x[22] += x[12]; \
+        x[12] = ROTL32(x[12], 11); \
+        x[23] += x[13]; \
+        x[13] = ROTL32(x[13], 11); \
+        x[20] += x[14]; \
+        x[14] = ROTL32(x[14], 11); \
+        x[21] += x[15]; \
+        x[15] = ROTL32(x[15], 11); \
+        x[26] += x[0]; \
+        x[0] = ROTL32(x[0], 11); \
+        x[27] += x[1]; \
+        x[1] = ROTL32(x[1], 11); \
+        x[24] += x[2]; \
+        x[2] = ROTL32(x[2], 11); \
+        x[25] += x[3]; \
+        x[3] = ROTL32(x[3], 11); \
+        x[30] += x[4]; \
+        x[4] = ROTL32(x[4], 11); \
+        x[31] += x[5]; \
+        x[5] = ROTL32(x[5], 11); \
+        x[28] += x[6]; \
+        x[6] = ROTL32(x[6], 11); \
+        x[29] += x[7]; \
+        x[7] = ROTL32(x[7], 11); \
+        x[12] ^= x[18]; \
+        x[13] ^= x[19]; \
+        x[14] ^= x[16]; \
+        x[15] ^= x[17]; \
+        x[8] ^= x[22]; \
+        x[9] ^= x[23]; \
+        x[10] ^= x[20]; \
+        x[11] ^= x[21]; \
+        x[4] ^= x[26]; \
+        x[5] ^= x[27]; \
+        x[6] ^= x[24]; \
+        x[7] ^= x[25]; \
+        x[0] ^= x[30]; \
+        x[1] ^= x[31]; \
+        x[2] ^= x[28]; \
+        x[3] ^= x[29]; \
+    } while (0)
+
+#define CUBEHASH_ROUND_ODD do { \
+        x[19] += x[12]; \
+        x[12] = ROTL32(x[12], 7); \
+        x[18] += x[13]; \
+        x[13] = ROTL32(x[13], 7); \
+        x[17] += x[14]; \
+        x[14] = ROTL32(x[14], 7); \
+        x[16] += x[15]; \
+        x[15] = ROTL32(x[15], 7); \
+        x[23] += x[8]; \
+        x[8] = ROTL32(x[8], 7); \
+        x[22] += x[9]; \
+        x[9] = ROTL32(x[9], 7); \
+        x[21] += x[10]; \
+        x[10] = ROTL32(x[10], 7); \
+        x[20] += x[11]; \
+        x[11] = ROTL32(x[11], 7); \
+        x[27] += x[4]; \
+        x[4] = ROTL32(x[4], 7); \
+        x[26] += x[5]; \
+        x[5] = ROTL32(x[5], 7); \
+        x[25] += x[6]; \
+        x[6] = ROTL32(x[6], 7); \
+        x[24] += x[7]; \
+        x[7] = ROTL32(x[7], 7); \
+        x[31] += x[0]; \
+        x[0] = ROTL32(x[0], 7); \
+        x[30] += x[1]; \
+        x[1] = ROTL32(x[1], 7); \
+        x[29] += x[2]; \
+        x[2] = ROTL32(x[2], 7); \
+        x[28] += x[3]; \
+        x[3] = ROTL32(x[3], 7); \
+        x[4] ^= x[19]; \
+        x[5] ^= x[18]; \
+        x[6] ^= x[17]; \
+        x[7] ^= x[16]; \
+        x[0] ^= x[23]; \
+        x[1] ^= x[22]; \
+        x[2] ^= x[21]; \
+        x[3] ^= x[20]; \
+        x[12] ^= x[27]; \
+        x[13] ^= x[26]; \
+        x[14] ^= x[25]; \
+        x[15] ^= x[24]; \
+        x[8] ^= x[31]; \
+        x[9] ^= x[30]; \
+        x[10] ^= x[29]; \
+        x[11] ^= x[28]; \
+        x[17] += x[4]; \
+        x[4] = ROTL32(x[4], 11); \
+        x[16] += x[5]; \
+        x[5] = ROTL32(x[5], 11); \
+        x[19] += x[6]; \
+        x[6] = ROTL32(x[6], 11); \
+        x[18] += x[7]; \
+        x[7] = ROTL32(x[7], 11); \
+        x[21] += x[0]; \
+        x[0] = ROTL32(x[0], 11); \
+        x[20] += x[1]; \
+        x[1] = ROTL32(x[1], 11); \
+        x[23] += x[2]; \
+        x[2] = ROTL32(x[2], 11); \
+        x[22] += x[3]; \
+        x[3] = ROTL32(x[3], 11); \
+        x[25] += x[12]; \
+        x[12] = ROTL32(x[12], 11); \
+        x[24] += x[13]; \
+        x[13] = ROTL32(x[13], 11); \
+        x[27] += x[14]; \
+        x[14] = ROTL32(x[14], 11); \
+        x[26] += x[15]; \
+        x[15] = ROTL32(x[15], 11); \
+        x[29] += x[8]; \
+        x[8] = ROTL32(x[8], 11); \
+        x[28] += x[9]; \
+        x[9] = ROTL32(x[9], 11); \
+        x[31] += x[10]; \
+        x[10] = ROTL32(x[10], 11); \
+        x[30] += x[11]; \
+        x[11] = ROTL32(x[11], 11); \
+        x[0] ^= x[17]; \
+        x[1] ^= x[16]; \
+        x[2] ^= x[19]; \
+        x[3] ^= x[18]; \
+        x[4] ^= x[21]; \
+        x[5] ^= x[20]; \
+        x[6] ^= x[23]; \
+        x[7] ^= x[22]; \
+        x[8] ^= x[25]; \
+        x[9] ^= x[24]; \
+        x[10] ^= x[27]; \
+        x[11] ^= x[26]; \
+        x[12] ^= x[29]; \
+        x[13] ^= x[28]; \
+        x[14] ^= x[31]; \
+        x[15] ^= x[30]; \
+    } while (0)
+
+/** Sixteen CubeHash rounds. */
+inline void CubeHashRounds(v32 x[32])
+{
+    for (int r = 0; r < 8; r++) {
+        CUBEHASH_ROUND_EVEN;
+        CUBEHASH_ROUND_ODD;
+    }
+}
+
+#undef CUBEHASH_ROUND_ODD
+#undef CUBEHASH_ROUND_EVEN
+
+/** CubeHash-512 of a 64 byte message per lane, matching sph_cubehash512. */
+void CubeHash512(unsigned char (*out)[64], const unsigned char* const* in)
+{
+    v32 x[32];
+    for (int i = 0; i < 32; i++)
+        Splat32(x[i], CUBEHASH_IV512[i]);
+    for (int b = 0; b < 2; b++) {
+        for (int i = 0; i < 8; i++) {
+            v32 w;
+            for (int l = 0; l < PHI1612_LANES; l++)
+                w[l] = ReadLE32(in[l] + 32 * b + 4 * i);
+            x[i] ^= w;
+        }
+        CubeHashRounds(x);
+    }
+    x[0] ^= 0x80;
+    CubeHashRounds(x);
+    x[31] ^= 1;
+    for (int i = 0; i < 10; i++)
+        CubeHashRounds(x);
+    for (int i = 0; i < 16; i++)
+        for (int l = 0; l < PHI1612_LANES; l++)
+            WriteLE32(out[l] + 4 * i, x[i][l]);
+}
+
+/* ----------- ECHO-512 (AES-NI) --------------------------------------------- */
+
+inline __m128i EchoXtime(__m128i x)
+{
+    const __m128i hi = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(hi, _mm_set1_epi8(0x1B)));
+}
+
+inline void EchoMixColumn(__m128i* W, int ia, int ib, int ic, int id)
+{
+    const __m128i a = W[ia], b = W[ib], c = W[ic], d = W[id];
+    const __m128i ab = _mm_xor_si128(a, b);
+    const __m128i bc = _mm_xor_si128(b, c);
+    const __m128i cd = _mm_xor_si128(c, d);
+    const __m128i abx = EchoXtime(ab);
+    const __m128i bcx = EchoXtime(bc);
+    const __m128i cdx = EchoXtime(cd);
+    W[ia] = _mm_xor_si128(abx, _mm_xor_si128(bc, d));
+    W[ib] = _mm_xor_si128(bcx, _mm_xor_si128(a, cd));
+    W[ic] = _mm_xor_si128(cdx, _mm_xor_si128(ab, d));
+    W[id] = _mm_xor_si128(_mm_xor_si128(abx, bcx), _mm_xor_si128(_mm_xor_si128(cdx, ab), c));
+}
+
+/** ECHO-512 of a 64 byte message, matching sph_echo512. */
+void Echo512(unsigned char* out, const unsigned char* in)
+{
+    // A 64 byte message fits a single 1024-bit block: message, the padding
+    // bit, the 16-bit output size and the 128-bit bit counter.
+    unsigned char buf[128] = {0};
+    memcpy(buf, in, 64);
+    buf[64] = 0x80;
+    WriteLE32(buf + 108, 512 << 16);
+    WriteLE32(buf + 112, 512);
+
+    __m128i V[8], W[16], t;
+    for (int i = 0; i < 8; i++) {
+        V[i] = _mm_set_epi64x(0, 512);
+        W[i] = V[i];
+        W[i + 8] = _mm_loadu_si128((const __m128i*)(buf + 16 * i));
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t k = 512;
+    for (int r = 0; r < 10; r++) {
+        for (int i = 0; i < 16; i++) {
+            W[i] = _mm_aesenc_si128(W[i], _mm_set_epi32(0, 0, 0, k++));
+            W[i] = _mm_aesenc_si128(W[i], zero);
+        }
+        t = W[1]; W[1] = W[5]; W[5] = W[9]; W[9] = W[13]; W[13] = t;
+        t = W[2]; W[2] = W[10]; W[10] = t;
+        t = W[6]; W[6] = W[14]; W[14] = t;
+        t = W[15]; W[15] = W[11]; W[11] = W[7]; W[7] = W[3]; W[3] = t;
+        EchoMixColumn(W, 0, 1, 2, 3);
+        EchoMixColumn(W, 4, 5, 6, 7);
+        EchoMixColumn(W, 8, 9, 10, 11);
+        EchoMixColumn(W, 12, 13, 14, 15);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        V[i] = _mm_xor_si128(V[i], _mm_loadu_si128((const __m128i*)(buf + 16 * i)));
+        V[i] = _mm_xor_si128(V[i], _mm_xor_si128(W[i], W[i + 8]));
+        _mm_storeu_si128((__m128i*)(out + 16 * i), V[i]);
+    }
+}
+
+/* ----------- PHI1612 ------------------------------------------------------- */
+
+/** Hash PHI1612_LANES messages of len bytes each; out receives 32 bytes per lane. */
+void Phi1612Lanes(unsigned char* out, const unsigned char* const* in, size_t len)
+{
+    unsigned char hash[PHI1612_LANES][64];
+    const unsigned char* phash[PHI1612_LANES];
+    for (int i = 0; i < PHI1612_LANES; i++)
+        phash[i] = hash[i];
+
+    for (int g = 0; g < PHI1612_LANES; g += PHI1612_LANES64) {
+        Skein512(hash + g, in + g, len);
+        JH512(hash + g, phash + g);
+    }
+    CubeHash512(hash, phash);
+
+    for (int i = 0; i < PHI1612_LANES; i++) {
+        sph_fugue512_context ctx_fugue;
+        sph_gost512_context ctx_gost;
+        unsigned char tmp[64];
+
+        sph_fugue512_init(&ctx_fugue);
+        sph_fugue512(&ctx_fugue, hash[i], 64);
+        sph_fugue512_close(&ctx_fugue, tmp);
+
+        sph_gost512_init(&ctx_gost);
+        sph_gost512(&ctx_gost, tmp, 64);
+        sph_gost512_close(&ctx_gost, hash[i]);
+
+        Echo512(tmp, hash[i]);
+        memcpy(out + 32 * i, tmp, 32);
+    }
+}
+
+} // namespace
@@ -0,0 +1,20 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Four-lane PHI1612 engine, built with -msse4.1 -maes.
+
+#ifdef ENABLE_SSE41
+
+#define PHI1612_VECTOR_BYTES 16
+#include "crypto/phi1612_lanes.h"
+
+namespace phi1612_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* const* in, size_t len)
+{
+    Phi1612Lanes(out, in, len);
+}
+}
+
+#endif
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,16 @@ public:
     CSHA256& Reset();
 };
 
+/** Autodetect the best available multi-lane double-SHA256 engine. Returns the name of the engine. */
+std::string SHA256DAutoDetect();
+
+/** Number of messages SHA256DxN hashes per pass (1 when only the portable code is available). */
+size_t SHA256DLanes();
+
+/**
+ * Compute double-SHA256 of `blocks` messages of `len` bytes each. in[i] points
+ * to message i and out receives CSHA256::OUTPUT_SIZE bytes per message.
+ */
+void SHA256DxN(unsigned char* out, const unsigned char* const* in, size_t len, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
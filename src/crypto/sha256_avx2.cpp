@@ -0,0 +1,20 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Eight-lane double-SHA256, built with -mavx -mavx2.
+
+#ifdef ENABLE_AVX2
+
+#define SHA256_VECTOR_BYTES 32
+#include "crypto/sha256_lanes.h"
+
+namespace sha256d_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* const* in, size_t len)
+{
+    SHA256DLanes(out, in, len);
+}
+}
+
+#endif
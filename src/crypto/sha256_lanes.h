@@ -0,0 +1,134 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Multi-lane double-SHA256 shared by the per-ISA translation units.
+//
+// Every lane carries one independent message of the same length; word i of
+// all lanes lives in one vector register. The including file must define
+// SHA256_VECTOR_BYTES to the register width it is compiled for. Everything in
+// here has internal linkage so that each ISA gets its own copy.
+
+#ifndef SHA256_VECTOR_BYTES
+#error "SHA256_VECTOR_BYTES must be defined before including crypto/sha256_lanes.h"
+#endif
+
+#define SHA256_LANES (SHA256_VECTOR_BYTES / 4)
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+#include <string.h>
+
+namespace
+{
+typedef uint32_t v32 __attribute__((vector_size(SHA256_VECTOR_BYTES)));
+
+// Vectors are only passed by reference; by-value vector arguments wider than
+// the baseline ABI trigger -Wpsabi warnings.
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA256_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define SHA256_SIGMA0(x) (SHA256_ROTR(x, 2) ^ SHA256_ROTR(x, 13) ^ SHA256_ROTR(x, 22))
+#define SHA256_SIGMA1(x) (SHA256_ROTR(x, 6) ^ SHA256_ROTR(x, 11) ^ SHA256_ROTR(x, 25))
+#define SHA256_sigma0(x) (SHA256_ROTR(x, 7) ^ SHA256_ROTR(x, 18) ^ ((x) >> 3))
+#define SHA256_sigma1(x) (SHA256_ROTR(x, 17) ^ SHA256_ROTR(x, 19) ^ ((x) >> 10))
+
+const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t SHA256_IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+/** Broadcast a constant into every lane. */
+inline void Splat32(v32& r, uint32_t x)
+{
+    for (int i = 0; i < SHA256_LANES; i++)
+        r[i] = x;
+}
+
+/** Compress one 64-byte block per lane; w holds the big-endian decoded message words. */
+inline void SHA256Compress(v32 s[8], v32 w[16])
+{
+    v32 a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16)
+            w[i & 15] += SHA256_sigma1(w[(i - 2) & 15]) + w[(i - 7) & 15] + SHA256_sigma0(w[(i - 15) & 15]);
+        v32 t1 = h + SHA256_SIGMA1(e) + SHA256_CH(e, f, g) + SHA256_K[i] + w[i & 15];
+        v32 t2 = SHA256_SIGMA0(a) + SHA256_MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s[0] += a;
+    s[1] += b;
+    s[2] += c;
+    s[3] += d;
+    s[4] += e;
+    s[5] += f;
+    s[6] += g;
+    s[7] += h;
+}
+
+/** Compute double-SHA256 of SHA256_LANES messages of len bytes each. */
+void SHA256DLanes(unsigned char* out, const unsigned char* const* in, size_t len)
+{
+    v32 s[8], w[16];
+    for (int i = 0; i < 8; i++)
+        Splat32(s[i], SHA256_IV[i]);
+
+    const size_t nBlocks = (len + 9 + 63) / 64;
+    for (size_t b = 0; b < nBlocks; b++) {
+        const size_t offset = b * 64;
+        if (offset + 64 <= len) {
+            for (int lane = 0; lane < SHA256_LANES; lane++)
+                for (int i = 0; i < 16; i++)
+                    w[i][lane] = ReadBE32(in[lane] + offset + 4 * i);
+        } else {
+            // Tail block: copy what is left of the message and append the padding.
+            unsigned char tail[64];
+            const size_t nTail = len > offset ? len - offset : 0;
+            for (int lane = 0; lane < SHA256_LANES; lane++) {
+                memset(tail, 0, sizeof(tail));
+                if (nTail)
+                    memcpy(tail, in[lane] + offset, nTail);
+                if (len >= offset)
+                    tail[nTail] = 0x80;
+                if (b == nBlocks - 1)
+                    WriteBE64(tail + 56, (uint64_t)len << 3);
+                for (int i = 0; i < 16; i++)
+                    w[i][lane] = ReadBE32(tail + 4 * i);
+            }
+        }
+        SHA256Compress(s, w);
+    }
+
+    // Second pass over the 32-byte digest, which never leaves the registers.
+    for (int i = 0; i < 8; i++)
+        w[i] = s[i];
+    Splat32(w[8], 0x80000000);
+    for (int i = 9; i < 15; i++)
+        Splat32(w[i], 0);
+    Splat32(w[15], 256);
+    for (int i = 0; i < 8; i++)
+        Splat32(s[i], SHA256_IV[i]);
+    SHA256Compress(s, w);
+
+    for (int lane = 0; lane < SHA256_LANES; lane++)
+        for (int i = 0; i < 8; i++)
+            WriteBE32(out + 32 * lane + 4 * i, s[i][lane]);
+}
+
+} // namespace
@@ -0,0 +1,20 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Four-lane double-SHA256, built with -msse4.1.
+
+#ifdef ENABLE_SSE41
+
+#define SHA256_VECTOR_BYTES 16
+#include "crypto/sha256_lanes.h"
+
+namespace sha256d_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* const* in, size_t len)
+{
+    SHA256DLanes(out, in, len);
+}
+}
+
+#endif
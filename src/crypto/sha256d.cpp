@@ -0,0 +1,102 @@
+// Copyright (c) 2018 The LUX developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/lux-config.h"
+#endif
+
+#include "crypto/sha256.h"
+
+#include "crypto/cpuid.h"
+
+#include <string.h>
+
+#if defined(HAVE_X86_CPUID)
+#if defined(ENABLE_SSE41)
+namespace sha256d_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* const* in, size_t len);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace sha256d_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* const* in, size_t len);
+}
+#endif
+#endif
+
+namespace
+{
+typedef void (*TransformNWayType)(unsigned char*, const unsigned char* const*, size_t);
+
+/** Largest lane count of any engine. */
+const size_t MAX_LANES = 8;
+
+TransformNWayType TransformNWay = NULL;
+size_t nTransformLanes = 1;
+
+void SHA256DScalar(unsigned char* out, const unsigned char* in, size_t len)
+{
+    unsigned char buf[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(in, len).Finalize(buf);
+    CSHA256().Write(buf, sizeof(buf)).Finalize(out);
+}
+} // namespace
+
+std::string SHA256DAutoDetect()
+{
+    TransformNWay = NULL;
+    nTransformLanes = 1;
+#if defined(HAVE_X86_CPUID)
+    const CPUFeatures features = GetCPUFeatures();
+    (void)features;
+
+#if defined(ENABLE_AVX2)
+    if (features.fAVX2) {
+        TransformNWay = sha256d_avx2::Transform_8way;
+        nTransformLanes = 8;
+        return "avx2(8way)";
+    }
+#endif
+#if defined(ENABLE_SSE41)
+    if (features.fSSE41) {
+        TransformNWay = sha256d_sse41::Transform_4way;
+        nTransformLanes = 4;
+        return "sse4(4way)";
+    }
+#endif
+#endif
+    return "standard";
+}
+
+size_t SHA256DLanes()
+{
+    return nTransformLanes;
+}
+
+void SHA256DxN(unsigned char* out, const unsigned char* const* in, size_t len, size_t blocks)
+{
+    if (TransformNWay) {
+        while (blocks >= nTransformLanes) {
+            TransformNWay(out, in, len);
+            out += CSHA256::OUTPUT_SIZE * nTransformLanes;
+            in += nTransformLanes;
+            blocks -= nTransformLanes;
+        }
+        if (blocks > 1) {
+            // Fill the idle lanes with copies of the last message.
+            const unsigned char* pin[MAX_LANES];
+            unsigned char tmp[CSHA256::OUTPUT_SIZE * MAX_LANES];
+            for (size_t i = 0; i < nTransformLanes; i++)
+                pin[i] = in[i < blocks ? i : blocks - 1];
+            TransformNWay(tmp, pin, len);
+            memcpy(out, tmp, CSHA256::OUTPUT_SIZE * blocks);
+            return;
+        }
+    }
+    for (size_t i = 0; i < blocks; i++)
+        SHA256DScalar(out + CSHA256::OUTPUT_SIZE * i, in[i], len);
+}
@@ -28,6 +28,7 @@ using namespace std;
 using namespace boost;
 
 CCriticalSection cs_darksend;
+CCriticalSection cs_process_message;
 
 /** The main object for accessing darksend */
 CDarkSendPool darkSendPool;
@@ -126,21 +127,24 @@ void ProcessDarksend(CNode* pfrom, const std::string& strCommand, CDataStream& v
         vRecv >> nDenom >> txCollateral;
 
         std::string error = "";
-        int mn = GetMasternodeByVin(activeMasternode.vin);
-        if(mn == -1){
-            std::string strError = _("Not in the masternode list.");
-            pfrom->PushMessage("dssu", darkSendPool.sessionID, darkSendPool.GetState(), darkSendPool.GetEntriesCount(), MASTERNODE_REJECTED, strError);
-            return;
-        }
-
-        if(darkSendPool.sessionUsers == 0) {
-            if(vecMasternodes[mn].nLastDsq != 0 &&
-                vecMasternodes[mn].nLastDsq + CountMasternodesAboveProtocol(darkSendPool.MIN_PEER_PROTO_VERSION)/5 > darkSendPool.nDsqCount){
-                //LogPrintf("dsa -- last dsq too recent, must wait. %s \n", vecMasternodes[mn].addr.ToString().c_str());
-                std::string strError = _("Last Darksend was too recent.");
+        {
+            LOCK(cs_masternodes);
+            int mn = GetMasternodeByVin(activeMasternode.vin);
+            if(mn == -1){
+                std::string strError = _("Not in the masternode list.");
                 pfrom->PushMessage("dssu", darkSendPool.sessionID, darkSendPool.GetState(), darkSendPool.GetEntriesCount(), MASTERNODE_REJECTED, strError);
                 return;
             }
+
+            if(darkSendPool.sessionUsers == 0) {
+                if(vecMasternodes[mn].nLastDsq != 0 &&
+                    vecMasternodes[mn].nLastDsq + CountMasternodesAboveProtocol(darkSendPool.MIN_PEER_PROTO_VERSION)/5 > darkSendPool.nDsqCount){
+                    //LogPrintf("dsa -- last dsq too recent, must wait. %s \n", vecMasternodes[mn].addr.ToString().c_str());
+                    std::string strError = _("Last Darksend was too recent.");
+                    pfrom->PushMessage("dssu", darkSendPool.sessionID, darkSendPool.GetState(), darkSendPool.GetEntriesCount(), MASTERNODE_REJECTED, strError);
+                    return;
+                }
+            }
         }
 
         if(!darkSendPool.IsCompatibleWithSession(nDenom, txCollateral, error))
@@ -172,8 +176,7 @@ void ProcessDarksend(CNode* pfrom, const std::string& strCommand, CDataStream& v
 
         if(dsq.IsExpired()) return;
 
-        int mn = GetMasternodeByVin(dsq.vin);
-        if(mn == -1) return;
+        if(GetMasternodeByVin(dsq.vin) == -1) return;
 
         // if the queue is ready, submit if we can
         if(dsq.ready) {
@@ -189,6 +192,10 @@ void ProcessDarksend(CNode* pfrom, const std::string& strCommand, CDataStream& v
                 if(q.vin == dsq.vin) return;
             }
 
+            LOCK(cs_masternodes);
+            int mn = GetMasternodeByVin(dsq.vin);
+            if(mn == -1) return;
+
             if(fDebug) LogPrintf("dsq last %d last2 %d count %d\n", vecMasternodes[mn].nLastDsq, vecMasternodes[mn].nLastDsq + (int)vecMasternodes.size()/5, darkSendPool.nDsqCount);
             //don't allow a few nodes to dominate the queuing process
             if(vecMasternodes[mn].nLastDsq != 0 &&
@@ -317,7 +324,8 @@ void ProcessDarksend(CNode* pfrom, const std::string& strCommand, CDataStream& v
             }
 
             bool* pfMissingInputs = nullptr;
-	    if (!AcceptableInputs(mempool, state, tx, false, pfMissingInputs)) {
+            LOCK(cs_main);
+            if (!AcceptableInputs(mempool, state, tx, false, pfMissingInputs)) {
                 LogPrintf("dsi -- transaction not valid! \n");
                 error = _("Transaction not valid.");
                 pfrom->PushMessage("dssu", darkSendPool.sessionID, darkSendPool.GetState(), darkSendPool.GetEntriesCount(), MASTERNODE_REJECTED, error);
@@ -728,6 +736,7 @@ void CDarkSendPool::ChargeFees(){
                 // This queue entry didn't send us the promised transaction
                 if(!found && r > target){
                     LogPrintf("CDarkSendPool::ChargeFees -- found uncooperative node (didn't send transaction). charging fees.\n");
+                    LOCK(cs_main);
 
                     CWalletTx wtxCollateral = CWalletTx(pwalletMain, txCollateral);
 
@@ -749,6 +758,7 @@ void CDarkSendPool::ChargeFees(){
                 BOOST_FOREACH(const CDarkSendEntryVin s, v.sev) {
                     if(!s.isSigSet && r > target){
                         LogPrintf("CDarkSendPool::ChargeFees -- found uncooperative node (didn't sign). charging fees.\n");
+                        LOCK(cs_main);
 
                         CWalletTx wtxCollateral = CWalletTx(pwalletMain, v.collateral);
 
@@ -788,6 +798,7 @@ void CDarkSendPool::ChargeRandomFees(){
             if(r <= 20)
             {
                 LogPrintf("CDarkSendPool::ChargeRandomFees -- charging random fees. %u\n", i);
+                LOCK(cs_main);
 
                 CWalletTx wtxCollateral = CWalletTx(pwalletMain, txCollateral);
 
@@ -988,6 +999,7 @@ bool CDarkSendPool::IsCollateralValid(const CTransaction& txCollateral){
 
     CValidationState state;
     bool* pfMissingInputs = nullptr;
+    LOCK(cs_main);
     if(!AcceptableInputs(mempool, state, txCollateral, false, pfMissingInputs)){
         if(fDebug) LogPrintf ("CDarkSendPool::IsCollateralValid - didn't pass IsAcceptable\n");
         return false;
@@ -1167,8 +1179,9 @@ void CDarkSendPool::SendDarksendDenominate(std::vector<CTxIn>& vin, std::vector<
             if(fDebug) LogPrintf("dsi -- tx in %s\n", i.ToString().c_str());
         }
 
-	bool* pfMissingInputs = nullptr;
-	if(!AcceptableInputs(mempool, state, tx, false, pfMissingInputs)){
+        bool* pfMissingInputs = nullptr;
+        LOCK(cs_main);
+        if(!AcceptableInputs(mempool, state, tx, false, pfMissingInputs)){
             LogPrintf("dsi -- transaction not valid! %s \n", tx.ToString().c_str());
             return;
         }
@@ -1346,6 +1359,7 @@ void CDarkSendPool::CompletedTransaction(bool error, std::string lastMessageNew)
         myEntries.clear();
 
         // To avoid race conditions, we'll only let DS run once per block
+        LOCK(cs_main);
         cachedLastSuccess = chainActive.Tip()->nHeight;
     }
     lastMessage = lastMessageNew;
@@ -1374,7 +1388,12 @@ bool CDarkSendPool::DoAutomaticDenominating(bool fDryRun, bool ready)
     if(fMasterNode) return false;
     if(state == POOL_STATUS_ERROR || state == POOL_STATUS_SUCCESS) return false;
 
-    if(chainActive.Tip()->nHeight - cachedLastSuccess < minBlockSpacing) {
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = chainActive.Height();
+    }
+    if(nHeight - cachedLastSuccess < minBlockSpacing) {
         LogPrintf("CDarkSendPool::DoAutomaticDenominating - Last successful darksend action was too recent\n");
         strAutoDenomResult = _("Last successful darksend action was too recent.");
         return false;
@@ -2169,6 +2188,7 @@ void ThreadCheckDarkSendPool()
                 if((*it).enabled == 4 || (*it).enabled == 3){
                     LogPrintf("Removing inactive masternode %s\n", (*it).addr.ToString().c_str());
                     it = vecMasternodes.erase(it);
+                    nMasternodeListGeneration++;
                 } else {
                     ++it;
                 }
@@ -44,6 +44,8 @@ extern std::vector<CDarksendQueue> vecDarksendQueue;
 extern std::string strMasterNodePrivKey;
 extern map<uint256, CDarksendBroadcastTx> mapDarksendBroadcastTxes;
 extern CActiveMasternode activeMasternode;
+// serializes the Darksend, masternode and InstantX message handlers, taken before cs_main
+extern CCriticalSection cs_process_message;
 
 //specific messages for the Darksend protocol
 void ProcessDarksend(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, bool &isDarksend);
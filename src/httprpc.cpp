@@ -122,6 +122,11 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (!valRequest.read(req->ReadBody()))
             throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
+        // Return immediately if in warmup
+        std::string strWarmupStatus;
+        if (RPCIsInWarmup(&strWarmupStatus))
+            throw JSONRPCError(RPC_IN_WARMUP, strWarmupStatus);
+
         std::string strReply;
         // singleton request
         if (valRequest.isObject()) {
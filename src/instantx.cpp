@@ -44,8 +44,11 @@ void ProcessInstantX(CNode* pfrom, const std::string& strCommand, CDataStream& v
         CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if(mapTxLockReq.count(tx.GetHash()) || mapTxLockReqRejected.count(tx.GetHash())){
-            return;
+        {
+            LOCK(cs_main);
+            if(mapTxLockReq.count(tx.GetHash()) || mapTxLockReqRejected.count(tx.GetHash())){
+                return;
+            }
         }
 
         if(!IsIXTXValid(tx)){
@@ -59,6 +62,7 @@ void ProcessInstantX(CNode* pfrom, const std::string& strCommand, CDataStream& v
             }
         }
 
+        LOCK(cs_main);
         int nBlockHeight = CreateNewLock(tx);
 
         bool fMissingInputs = false;
@@ -127,13 +131,17 @@ void ProcessInstantX(CNode* pfrom, const std::string& strCommand, CDataStream& v
         CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if(mapTxLockVote.count(ctx.GetHash())){
-            return;
-        }
+        {
+            LOCK(cs_main);
+            if(mapTxLockVote.count(ctx.GetHash())){
+                return;
+            }
 
-        mapTxLockVote.insert(make_pair(ctx.GetHash(), ctx));
+            mapTxLockVote.insert(make_pair(ctx.GetHash(), ctx));
+        }
 
         if(ProcessConsensusVote(ctx)){
+            LOCK(cs_main);
             //Spam/Dos protection
             /*
                 Masternodes will sometimes propagate votes before the transaction is known to the client.
@@ -158,10 +166,11 @@ void ProcessInstantX(CNode* pfrom, const std::string& strCommand, CDataStream& v
             }
             vector<CInv> vInv;
             vInv.push_back(inv);
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-                pnode->PushMessage("inv", vInv);
-
+            {
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes)
+                    pnode->PushMessage("inv", vInv);
+            }
         }
 
         return;
@@ -331,6 +340,7 @@ bool ProcessConsensusVote(CConsensusVote& ctx)
         return false;
     }
 
+    LOCK(cs_main);
     if (!mapTxLocks.count(ctx.txHash)){
         LogPrintf("InstantX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
 
@@ -478,6 +488,7 @@ bool CConsensusVote::SignatureValid()
     std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
     //LogPrintf("verify strMessage %s \n", strMessage.c_str());
 
+    LOCK(cs_masternodes);
     int n = GetMasternodeByVin(vinMasternode);
 
     if(n == -1)
@@ -25,6 +25,7 @@ class CConsensusVote;
 class CTransaction;
 class CTransactionLock;
 
+// the transaction lock maps are guarded by cs_main
 extern map<uint256, CTransaction> mapTxLockReq;
 extern map<uint256, CTransaction> mapTxLockReqRejected;
 extern map<uint256, CConsensusVote> mapTxLockVote;
@@ -1,116 +1,233 @@
-#include <sm/storageresults.h>
+#include <lux/storageresults.h>
+#include <clientversion.h>
+#include <streams.h>
+#include <util.h>
+#include <version.h>
 
-StorageResults::StorageResults(std::string const& _path){
-	path = _path + "/resultsDB";
-}
+/** Leading byte of the binary receipt encoding. Legacy RLP lists always start at 0xc0 or above. */
+static const unsigned char RESULTS_ENCODING_VERSION = 0x01;
 
-void StorageResults::addResult(dev::h256 hashTx, std::vector<TransactionReceiptInfo>& result){
-	m_cache_result.insert(std::make_pair(hashTx, result));
+template <typename Stream, typename Hash>
+static void writeHash(Stream& s, Hash const& h)
+{
+    s.write((const char*)h.data(), Hash::size);
 }
 
-void StorageResults::wipeResults(){
-	leveldb::Status result = leveldb::DestroyDB(path, leveldb::Options());
+template <typename Stream, typename Hash>
+static void readHash(Stream& s, Hash& h)
+{
+    s.read((char*)h.data(), Hash::size);
 }
 
-void StorageResults::deleteResults(std::vector<CTransactionRef> const& txs){
-    leveldb::DB* db;
-    leveldb::Options options;
+StorageResults::StorageResults(std::string const& _path, size_t _cacheSize) : db(NULL), nCacheUsage(0), nCacheSize(_cacheSize){
+    path = _path + "/resultsDB";
     options.create_if_missing = true;
+    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    openDB();
+}
+
+StorageResults::~StorageResults(){
+    closeDB();
+    delete options.filter_policy;
+    options.filter_policy = NULL;
+}
+
+void StorageResults::openDB(){
     leveldb::Status status = leveldb::DB::Open(options, path, &db);
     assert(status.ok());
+}
 
-    for(CTransactionRef tx : txs){
-        dev::h256 hashTx = uintToh256(tx->GetHash());
-        m_cache_result.erase(hashTx);
+void StorageResults::closeDB(){
+    delete db;
+    db = NULL;
+}
 
-        std::string keyTemp = hashTx.hex();
-	    leveldb::Slice key(keyTemp);
-        status = db->Delete(leveldb::WriteOptions(), key);
-        assert(status.ok());
+void StorageResults::addResult(dev::h256 hashTx, std::vector<TransactionReceiptInfo>& result){
+    LOCK(cs_results);
+    m_cache_result.insert(std::make_pair(hashTx, result));
+}
+
+void StorageResults::wipeResults(){
+    LOCK(cs_results);
+    closeDB();
+    leveldb::Status result = leveldb::DestroyDB(path, leveldb::Options());
+    if(!result.ok())
+        LogPrintf("%s: failed to destroy %s: %s\n", __func__, path, result.ToString());
+    openDB();
+    m_cache_result.clear();
+    m_lru_result.clear();
+    m_lru_index.clear();
+    nCacheUsage = 0;
+}
+
+void StorageResults::deleteResults(std::vector<CTransaction> const& txs){
+    LOCK(cs_results);
+    leveldb::WriteBatch batch;
+    for(CTransaction const& tx : txs){
+        dev::h256 hashTx = uintToh256(tx.GetHash());
+        m_cache_result.erase(hashTx);
+        uncacheResult(hashTx);
+        batch.Delete(hashTx.hex());
     }
-    delete db;
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+    assert(status.ok());
 }
 
 std::vector<TransactionReceiptInfo> StorageResults::getResult(dev::h256 const& hashTx){
+    LOCK(cs_results);
     std::vector<TransactionReceiptInfo> result;
-	auto it = m_cache_result.find(hashTx);
-	if (it == m_cache_result.end()){
-		if(readResult(hashTx, result))
-			m_cache_result.insert(std::make_pair(hashTx, result));
-    } else {
-		result = it->second;
+
+    auto pending = m_cache_result.find(hashTx);
+    if (pending != m_cache_result.end())
+        return pending->second;
+
+    auto it = m_lru_index.find(hashTx);
+    if (it != m_lru_index.end()){
+        // Move to the front of the LRU list
+        m_lru_result.splice(m_lru_result.begin(), m_lru_result, it->second);
+        return it->second->second;
     }
-	return result;
+
+    if (readResult(hashTx, result))
+        cacheResult(hashTx, result);
+    else
+        result.clear();
+    return result;
 }
 
 void StorageResults::commitResults(){
+    LOCK(cs_results);
     if(m_cache_result.size()){
-        leveldb::DB* db;
-        leveldb::Options options;
-        options.create_if_missing = true;
-        leveldb::Status status = leveldb::DB::Open(options, path, &db);
-        assert(status.ok());
-
+        // Receipts are keyed by transaction hash and written once per connected
+        // block, so there is no need to read the old value back before writing.
+        leveldb::WriteBatch batch;
         for (auto const& i: m_cache_result){
-            std::string valueTemp;
-            std::string keyTemp = i.first.hex();
-            leveldb::Slice key(keyTemp);
-            status = db->Get(leveldb::ReadOptions(), key, &valueTemp);
-
-            if(status.IsNotFound()){
-
-                TransactionReceiptInfoSerialized tris;
-
-                for(size_t j = 0; j < i.second.size(); j++){
-                    tris.blockHashes.push_back(uintToh256(i.second[j].blockHash));
-                    tris.blockNumbers.push_back(i.second[j].blockNumber);
-                    tris.transactionHashes.push_back(uintToh256(i.second[j].transactionHash));
-                    tris.transactionIndexes.push_back(i.second[j].transactionIndex);
-                    tris.senders.push_back(i.second[j].from);
-                    tris.receivers.push_back(i.second[j].to);
-                    tris.cumulativeGasUsed.push_back(dev::u256(i.second[j].cumulativeGasUsed));
-                    tris.gasUsed.push_back(dev::u256(i.second[j].gasUsed));
-                    tris.contractAddresses.push_back(i.second[j].contractAddress);
-                    tris.logs.push_back(logEntriesSerialization(i.second[j].logs));
-                }
-
-                dev::RLPStream streamRLP(10);
-                streamRLP << tris.blockHashes << tris.blockNumbers << tris.transactionHashes << tris.transactionIndexes << tris.senders;
-                streamRLP << tris.receivers << tris.cumulativeGasUsed << tris.gasUsed << tris.contractAddresses << tris.logs;
-
-                dev::bytes data = streamRLP.out();
-                std::string stringData(data.begin(), data.end());
-                leveldb::Slice value(stringData);
-                status = db->Put(leveldb::WriteOptions(), key, value);
-                assert(status.ok());
-            }
+            batch.Put(i.first.hex(), encodeResult(i.second));
+            uncacheResult(i.first);
         }
+        leveldb::Status status = db->Write(leveldb::WriteOptions(), &batch);
+        assert(status.ok());
         m_cache_result.clear();
-        delete db;
     }
 }
 
+size_t StorageResults::cacheUsage() const{
+    LOCK(cs_results);
+    return nCacheUsage;
+}
+
 bool StorageResults::readResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo>& _result){
-    leveldb::DB* db;
-	leveldb::Options options;
-	options.create_if_missing = true;
-	leveldb::Status status = leveldb::DB::Open(options, path, &db);
-	assert(status.ok());
-
-	std::string value;
-	std::string keyTemp = _key.hex();
-	leveldb::Slice key(keyTemp);
-	leveldb::Status s = db->Get(leveldb::ReadOptions(), key, &value);
-	delete db;
-
-	if(!s.IsNotFound() && s.ok()){
-        
-        TransactionReceiptInfoSerialized tris;
-
-		dev::RLP state(value);
+    std::string value;
+    leveldb::Status s = db->Get(leveldb::ReadOptions(), _key.hex(), &value);
+    if(!s.ok())
+        return false;
+
+    if(!value.empty() && (unsigned char)value[0] == RESULTS_ENCODING_VERSION)
+        return decodeResult(value, _result);
+    return decodeResultRLP(value, _result);
+}
+
+void StorageResults::cacheResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo> const& _result){
+    size_t usage = resultUsage(_result);
+    if(usage > nCacheSize)
+        return;
+
+    m_lru_result.push_front(std::make_pair(_key, _result));
+    m_lru_index[_key] = m_lru_result.begin();
+    nCacheUsage += usage;
+
+    while(nCacheUsage > nCacheSize){
+        cacheEntry const& last = m_lru_result.back();
+        nCacheUsage -= resultUsage(last.second);
+        m_lru_index.erase(last.first);
+        m_lru_result.pop_back();
+    }
+}
+
+void StorageResults::uncacheResult(dev::h256 const& _key){
+    auto it = m_lru_index.find(_key);
+    if(it == m_lru_index.end())
+        return;
+    nCacheUsage -= resultUsage(it->second->second);
+    m_lru_result.erase(it->second);
+    m_lru_index.erase(it);
+}
+
+size_t StorageResults::resultUsage(std::vector<TransactionReceiptInfo> const& _result){
+    // List node, index entry and the receipts themselves
+    size_t usage = sizeof(cacheEntry) + 4 * sizeof(void*) + sizeof(dev::h256) + sizeof(cacheIter);
+    usage += _result.capacity() * sizeof(TransactionReceiptInfo);
+    for(TransactionReceiptInfo const& tri : _result){
+        usage += tri.logs.capacity() * sizeof(dev::eth::LogEntry);
+        for(dev::eth::LogEntry const& log : tri.logs)
+            usage += log.topics.capacity() * sizeof(dev::h256) + log.data.capacity();
+    }
+    return usage;
+}
+
+std::string StorageResults::encodeResult(std::vector<TransactionReceiptInfo> const& _result){
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << RESULTS_ENCODING_VERSION;
+    WriteCompactSize(ss, _result.size());
+    for(TransactionReceiptInfo const& tri : _result){
+        ss << tri.blockHash << tri.blockNumber << tri.transactionHash << tri.transactionIndex;
+        writeHash(ss, tri.from);
+        writeHash(ss, tri.to);
+        ss << tri.cumulativeGasUsed << tri.gasUsed;
+        writeHash(ss, tri.contractAddress);
+        WriteCompactSize(ss, tri.logs.size());
+        for(dev::eth::LogEntry const& log : tri.logs){
+            writeHash(ss, log.address);
+            WriteCompactSize(ss, log.topics.size());
+            for(dev::h256 const& topic : log.topics)
+                writeHash(ss, topic);
+            ss << log.data;
+        }
+    }
+    return std::string(ss.begin(), ss.end());
+}
+
+bool StorageResults::decodeResult(std::string const& _value, std::vector<TransactionReceiptInfo>& _result){
+    CDataStream ss(_value.data(), _value.data() + _value.size(), SER_DISK, CLIENT_VERSION);
+    try {
+        unsigned char version;
+        ss >> version;
+        uint64_t nReceipts = ReadCompactSize(ss);
+        for(uint64_t j = 0; j < nReceipts; j++){
+            TransactionReceiptInfo tri;
+            ss >> tri.blockHash >> tri.blockNumber >> tri.transactionHash >> tri.transactionIndex;
+            readHash(ss, tri.from);
+            readHash(ss, tri.to);
+            ss >> tri.cumulativeGasUsed >> tri.gasUsed;
+            readHash(ss, tri.contractAddress);
+            uint64_t nLogs = ReadCompactSize(ss);
+            for(uint64_t k = 0; k < nLogs; k++){
+                dev::Address address;
+                readHash(ss, address);
+                dev::h256s topics(ReadCompactSize(ss));
+                for(dev::h256& topic : topics)
+                    readHash(ss, topic);
+                dev::bytes data;
+                ss >> data;
+                tri.logs.push_back(dev::eth::LogEntry(address, topics, std::move(data)));
+            }
+            _result.push_back(tri);
+        }
+    } catch (const std::exception& e) {
+        _result.clear();
+        return error("%s : deserialize receipts failed: %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool StorageResults::decodeResultRLP(std::string const& _value, std::vector<TransactionReceiptInfo>& _result){
+    TransactionReceiptInfoSerialized tris;
+
+    try {
+        dev::RLP state(_value);
         tris.blockHashes = state[0].toVector<dev::h256>();
-		tris.blockNumbers = state[1].toVector<uint32_t>();
-		tris.transactionHashes = state[2].toVector<dev::h256>();
+        tris.blockNumbers = state[1].toVector<uint32_t>();
+        tris.transactionHashes = state[2].toVector<dev::h256>();
         tris.transactionIndexes = state[3].toVector<uint32_t>();
         tris.senders = state[4].toVector<dev::h160>();
         tris.receivers = state[5].toVector<dev::h160>();
@@ -118,29 +235,28 @@ bool StorageResults::readResult(dev::h256 const& _key, std::vector<TransactionRe
         tris.gasUsed = state[7].toVector<dev::u256>();
         tris.contractAddresses = state[8].toVector<dev::h160>();
         tris.logs = state[9].toVector<logEntriesSerializ>();
+    } catch (const std::exception& e) {
+        return error("%s : deserialize receipts failed: %s", __func__, e.what());
+    }
 
-        for(size_t j = 0; j < tris.blockHashes.size(); j++){
-            TransactionReceiptInfo tri{h256Touint(tris.blockHashes[j]), tris.blockNumbers[j], h256Touint(tris.transactionHashes[j]), tris.transactionIndexes[j], tris.senders[j],
-                                       tris.receivers[j], uint64_t(tris.cumulativeGasUsed[j]), uint64_t(tris.gasUsed[j]), tris.contractAddresses[j], logEntriesDeserialize(tris.logs[j])};
-            _result.push_back(tri);
-        }
-		return true;
-	}
-	return false;
-}
+    size_t nReceipts = tris.blockHashes.size();
+    if(tris.blockNumbers.size() != nReceipts || tris.transactionHashes.size() != nReceipts || tris.transactionIndexes.size() != nReceipts ||
+       tris.senders.size() != nReceipts || tris.receivers.size() != nReceipts || tris.cumulativeGasUsed.size() != nReceipts ||
+       tris.gasUsed.size() != nReceipts || tris.contractAddresses.size() != nReceipts || tris.logs.size() != nReceipts)
+        return error("%s : inconsistent receipt fields", __func__);
 
-logEntriesSerializ StorageResults::logEntriesSerialization(dev::eth::LogEntries const& _logs){
-	logEntriesSerializ result;
-	for(dev::eth::LogEntry i : _logs){
-		result.push_back(std::make_pair(i.address, std::make_pair(i.topics, i.data)));
-	}
-	return result;
+    for(size_t j = 0; j < nReceipts; j++){
+        TransactionReceiptInfo tri{h256Touint(tris.blockHashes[j]), tris.blockNumbers[j], h256Touint(tris.transactionHashes[j]), tris.transactionIndexes[j], tris.senders[j],
+                                   tris.receivers[j], uint64_t(tris.cumulativeGasUsed[j]), uint64_t(tris.gasUsed[j]), tris.contractAddresses[j], logEntriesDeserialize(tris.logs[j])};
+        _result.push_back(tri);
+    }
+    return true;
 }
 
 dev::eth::LogEntries StorageResults::logEntriesDeserialize(logEntriesSerializ const& _logs){
-	dev::eth::LogEntries result;
-	for(std::pair<dev::Address, std::pair<dev::h256s, dev::bytes>> i : _logs){
-		result.push_back(dev::eth::LogEntry(i.first, i.second.first, dev::bytes(i.second.second)));
-	}
-	return result;
+    dev::eth::LogEntries result;
+    for(std::pair<dev::Address, std::pair<dev::h256s, dev::bytes>> i : _logs){
+        result.push_back(dev::eth::LogEntry(i.first, i.second.first, dev::bytes(i.second.second)));
+    }
+    return result;
 }
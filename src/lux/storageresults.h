@@ -1,6 +1,24 @@
 #include <uint256.h>
 #include <primitives/transaction.h>
 #include <libethereum/State.h>
+#include <sync.h>
+#include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/write_batch.h>
+
+#include <list>
+#include <unordered_map>
+
+/** Default byte budget of the receipt read cache */
+static const size_t DEFAULT_RESULTS_CACHE_SIZE = 32 << 20;
+
+inline dev::h256 uintToh256(const uint256& in){
+    return dev::h256(std::vector<unsigned char>(in.begin(), in.end()));
+}
+
+inline uint256 h256Touint(const dev::h256& in){
+    return uint256(in.asBytes());
+}
 
 using logEntriesSerializ = std::vector<std::pair<dev::Address, std::pair<dev::h256s, dev::bytes>>>;
 
@@ -34,27 +52,61 @@ class StorageResults{
 
 public:
 
-	StorageResults(std::string const& _path);
+    StorageResults(std::string const& _path, size_t _cacheSize = DEFAULT_RESULTS_CACHE_SIZE);
+
+    ~StorageResults();
 
-	void addResult(dev::h256 hashTx, std::vector<TransactionReceiptInfo>& result);
+    void addResult(dev::h256 hashTx, std::vector<TransactionReceiptInfo>& result);
 
-    void deleteResults(std::vector<CTransactionRef> const& txs);
+    void deleteResults(std::vector<CTransaction> const& txs);
 
     std::vector<TransactionReceiptInfo> getResult(dev::h256 const& hashTx);
 
-	void commitResults();
+    void commitResults();
 
     void wipeResults();
 
+    size_t cacheUsage() const;
+
 private:
 
-	bool readResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo>& _result);
+    typedef std::pair<dev::h256, std::vector<TransactionReceiptInfo>> cacheEntry;
+    typedef std::list<cacheEntry>::iterator cacheIter;
+
+    void openDB();
+
+    void closeDB();
+
+    bool readResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo>& _result);
+
+    void cacheResult(dev::h256 const& _key, std::vector<TransactionReceiptInfo> const& _result);
+
+    void uncacheResult(dev::h256 const& _key);
+
+    static size_t resultUsage(std::vector<TransactionReceiptInfo> const& _result);
+
+    static std::string encodeResult(std::vector<TransactionReceiptInfo> const& _result);
+
+    static bool decodeResult(std::string const& _value, std::vector<TransactionReceiptInfo>& _result);
+
+    static bool decodeResultRLP(std::string const& _value, std::vector<TransactionReceiptInfo>& _result);
+
+    static dev::eth::LogEntries logEntriesDeserialize(logEntriesSerializ const& _logs);
+
+    std::string path;
+
+    mutable CCriticalSection cs_results;
 
-	logEntriesSerializ logEntriesSerialization(dev::eth::LogEntries const& _logs);
+    leveldb::DB* db;
 
-	dev::eth::LogEntries logEntriesDeserialize(logEntriesSerializ const& _logs);
+    leveldb::Options options;
 
-	std::string path;
+    /** Results of connected blocks not yet written by commitResults */
+    std::unordered_map<dev::h256, std::vector<TransactionReceiptInfo>> m_cache_result;
 
-	std::unordered_map<dev::h256, std::vector<TransactionReceiptInfo>> m_cache_result;
+    /** Recently read results, most recently used first, bounded by nCacheSize bytes */
+    std::list<cacheEntry> m_lru_result;
+    std::unordered_map<dev::h256, cacheIter> m_lru_index;
+    size_t nCacheUsage;
+    size_t nCacheSize;
 };
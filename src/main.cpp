@@ -9,6 +9,8 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockencodings.h"
+#include "blockfilecache.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -26,12 +28,15 @@
 #include "util.h"
 #include "utilmoneystr.h"
 
+#include <deque>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #if defined(DEBUG_DUMP_STAKING_INFO)
 #  include "DEBUG_DUMP_STAKING_INFO.hpp"
@@ -68,9 +73,12 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
+bool fAddressIndex = DEFAULT_ADDRESSINDEX;
+bool fSpentIndex = DEFAULT_SPENTINDEX;
+bool fTimestampIndex = DEFAULT_TIMESTAMPINDEX;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 uint256 bnProofOfStakeLimit = (~uint256(0) >> 20);
@@ -167,9 +175,25 @@ map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 /** Number of blocks in flight with validated headers. */
 int nQueuedValidatedHeaders = 0;
 
+/** A block received before its parent, kept until the parent has been processed. */
+struct CBlockAwaitingParent {
+    boost::shared_ptr<CBlock> pblock;
+    NodeId nodeid;
+    unsigned int nSize;
+};
+/** Blocks received ahead of their parent during parallel download. Protected by cs_main. */
+map<uint256, CBlockAwaitingParent> mapBlocksAwaitingParent;
+/** The hashes of the blocks in mapBlocksAwaitingParent, by the hash of their parent. */
+multimap<uint256, uint256> mapBlocksAwaitingParentByPrev;
+/** Total serialized size of the blocks in mapBlocksAwaitingParent. */
+size_t nBlocksAwaitingParentSize = 0;
+
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
+/** Peers asked to announce new blocks with cmpctblock. */
+list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
 /** Dirty block index entries. */
 set<CBlockIndex*> setDirtyBlockIndex;
 
@@ -284,6 +308,19 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Block being reconstructed from a cmpctblock of this peer, waiting for its blocktxn.
+    boost::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+    //! Since when blocks have been in flight from this peer without interruption (in microseconds), or 0.
+    int64_t nDownloadingSince;
+    //! Time blocks were in flight from this peer before nDownloadingSince (in microseconds).
+    int64_t nDownloadTime;
+    //! Number and total size of the requested blocks received from this peer.
+    int64_t nBlocksDownloaded;
+    int64_t nBlockBytesDownloaded;
+    //! Proof-of-stake headers past the last checkpoint this peer sent whose blocks we don't have yet.
+    list<CBlockIndex*> lUnverifiedHeaders;
+    //! Header to continue the header sync from once more of those blocks arrived, or NULL.
+    CBlockIndex* pindexHeadersDeferred;
 
     CNodeState()
     {
@@ -297,6 +334,11 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        nDownloadingSince = 0;
+        nDownloadTime = 0;
+        nBlocksDownloaded = 0;
+        nBlockBytesDownloaded = 0;
+        pindexHeadersDeferred = NULL;
     }
 };
 
@@ -358,6 +400,7 @@ void FinalizeNode(NodeId nodeid)
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
     mapNodeState.erase(nodeid);
 }
@@ -372,6 +415,10 @@ void MarkBlockAsReceived(const uint256& hash)
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
         state->nStallingSince = 0;
+        if (state->nBlocksInFlight == 0) {
+            state->nDownloadTime += GetTimeMicros() - state->nDownloadingSince;
+            state->nDownloadingSince = 0;
+        }
         mapBlocksInFlight.erase(itInFlight);
     }
 }
@@ -388,10 +435,21 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex
     QueuedBlock newentry = {hash, pindex, GetTimeMicros(), nQueuedValidatedHeaders, pindex != NULL};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
+    if (state->nBlocksInFlight == 0)
+        state->nDownloadingSince = newentry.nTime;
     state->nBlocksInFlight++;
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
 }
 
+/** Average download speed of a peer in bytes per second, over the time it had blocks in flight. */
+int64_t GetDownloadRate(const CNodeState* state)
+{
+    int64_t nTime = state->nDownloadTime;
+    if (state->nDownloadingSince)
+        nTime += GetTimeMicros() - state->nDownloadingSince;
+    return nTime > 0 ? state->nBlockBytesDownloaded * 1000000 / nTime : 0;
+}
+
 /** Check whether the last unknown block a peer advertized is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid)
 {
@@ -427,6 +485,21 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256& hash)
     }
 }
 
+/** Forget the unverified headers of a peer whose blocks arrived, and return
+ *  whether it may be asked for another batch of headers. Requires cs_main. */
+static bool CanRequestHeaders(CNodeState* state)
+{
+    list<CBlockIndex*>::iterator it = state->lUnverifiedHeaders.begin();
+    while (it != state->lUnverifiedHeaders.end()) {
+        if ((*it)->nStatus & BLOCK_HAVE_DATA)
+            it = state->lUnverifiedHeaders.erase(it);
+        else
+            it++;
+    }
+    // Leave room for a batch already on its way
+    return state->lUnverifiedHeaders.size() + 2 * MAX_HEADERS_RESULTS <= MAX_UNVERIFIED_HEADERS;
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb)
@@ -509,7 +582,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             if (pindex->nStatus & BLOCK_HAVE_DATA) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
-            } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
+            } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0 && mapBlocksAwaitingParent.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
                     // We reached the end of the window.
@@ -546,6 +619,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats)
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlocksDownloaded = state->nBlocksDownloaded;
+    stats.nDownloadRate = GetDownloadRate(state);
     return true;
 }
 
@@ -1041,8 +1116,16 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
     return nMinFee;
 }
 
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees, bool fOverrideMempoolLimit)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1170,6 +1253,14 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                                         hash.ToString(), nFees, txMinFee),
                     REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            // Once the pool has been trimmed, require at least the fee rate
+            // of the packages evicted from it
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+                return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                        hash.ToString(), nFees, mempoolRejectFee),
+                    REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
                 return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1223,8 +1314,27 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+            return state.DoS(0, error("AcceptToMemoryPool : too long mempool chain %s: %s", hash.ToString(), errString),
+                REJECT_NONSTANDARD, "too-long-mempool-chain");
+
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, setAncestors);
+
+        // trim mempool and check if tx was trimmed
+        if (!fOverrideMempoolLimit) {
+            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            if (!pool.exists(hash))
+                return state.DoS(0, error("AcceptToMemoryPool : mempool full, %s not accepted", hash.ToString()),
+                    REJECT_INSUFFICIENTFEE, "mempool full");
+        }
     }
 
     SyncWithWallets(tx, NULL);
@@ -1438,16 +1548,27 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         if (fTxIndex) {
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (std::exception& e) {
-                    return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+                CBlockFileReader reader(SER_DISK, CLIENT_VERSION);
+                if (OpenBlockFileRecord(postx, "blk", 0, reader)) {
+                    try {
+                        reader >> header;
+                        reader.ignore(postx.nTxOffset);
+                        reader >> txOut;
+                    } catch (std::exception& e) {
+                        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+                    }
+                } else {
+                    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                    if (file.IsNull())
+                        return error("%s: OpenBlockFile failed", __func__);
+                    try {
+                        file >> header;
+                        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                        file >> txOut;
+                    } catch (std::exception& e) {
+                        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+                    }
                 }
                 hashBlock = header.GetHash();
                 if (txOut.GetHash() != hash)
@@ -1485,6 +1606,60 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
     return false;
 }
 
+bool GetAddressIndexKey(const CScript& script, unsigned int& type, uint160& hashBytes)
+{
+    txnouttype whichType;
+    std::vector<std::vector<unsigned char> > vSolutions;
+    if (!Solver(script, whichType, vSolutions))
+        return false;
+
+    switch (whichType) {
+    case TX_PUBKEYHASH:
+        type = ADDRESS_INDEX_PUBKEYHASH;
+        hashBytes = uint160(vSolutions[0]);
+        return true;
+    case TX_PUBKEY:
+        // stakes pay to the key itself, index them under its address
+        type = ADDRESS_INDEX_PUBKEYHASH;
+        hashBytes = CPubKey(vSolutions[0]).GetID();
+        return true;
+    case TX_SCRIPTHASH:
+        type = ADDRESS_INDEX_SCRIPTHASH;
+        hashBytes = uint160(vSolutions[0]);
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool GetSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value)
+{
+    if (!fSpentIndex)
+        return false;
+    return pblocktree->ReadSpentIndex(key, value);
+}
+
+bool GetAddressIndex(unsigned int type, const uint160& addressHash, std::vector<std::pair<CAddressIndexKey, CAmount> >& addressIndex, int nStart, int nEnd)
+{
+    if (!fAddressIndex)
+        return error("%s: address index not enabled", __func__);
+    return pblocktree->ReadAddressIndex(type, addressHash, addressIndex, nStart, nEnd);
+}
+
+bool GetAddressUnspent(unsigned int type, const uint160& addressHash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& unspentOutputs)
+{
+    if (!fAddressIndex)
+        return error("%s: address index not enabled", __func__);
+    return pblocktree->ReadAddressUnspentIndex(type, addressHash, unspentOutputs);
+}
+
+bool GetTimestampIndex(unsigned int nHigh, unsigned int nLow, std::vector<uint256>& hashes)
+{
+    if (!fTimestampIndex)
+        return error("%s: timestamp index not enabled", __func__);
+    return pblocktree->ReadTimestampIndex(nHigh, nLow, hashes);
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1517,16 +1692,25 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
-
     // Read block
-    try {
-        filein >> block;
-    } catch (std::exception& e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    CBlockFileReader reader(SER_DISK, CLIENT_VERSION);
+    if (OpenBlockFileRecord(pos, "blk", 0, reader)) {
+        try {
+            reader >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk : OpenBlockFile failed");
+
+        try {
+            filein >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Check the header
@@ -1540,6 +1724,43 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos)
+{
+    // The block is preceded by the message start and its serialized size
+    if (pos.nPos < 8)
+        return error("%s : invalid position %d:%u", __func__, pos.nFile, pos.nPos);
+
+    CBlockFileReader reader(SER_DISK, CLIENT_VERSION);
+    if (OpenBlockFileRecord(pos, "blk", 0, reader)) {
+        if (reader.empty())
+            return error("%s : invalid block size 0 at %d:%u", __func__, pos.nFile, pos.nPos);
+        vchBlock.assign(reader.data(), reader.data() + reader.size());
+        return true;
+    }
+
+    CDiskBlockPos hpos(pos.nFile, pos.nPos - 8);
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed for %d:%u", __func__, pos.nFile, pos.nPos);
+
+    try {
+        MessageStartChars pchMessageStart;
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+            return error("%s : block magic mismatch at %d:%u", __func__, pos.nFile, pos.nPos);
+        if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+            return error("%s : invalid block size %u at %d:%u", __func__, nSize, pos.nFile, pos.nPos);
+        vchBlock.resize(nSize);
+        filein.read((char*)&vchBlock[0], nSize);
+    } catch (std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
     if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
@@ -1934,11 +2155,29 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock() : block and undo data inconsistent");
 
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction& tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
+        if (fAddressIndex) {
+            for (unsigned int k = tx.vout.size(); k-- > 0;) {
+                const CTxOut& out = tx.vout[k];
+                unsigned int addressType;
+                uint160 addressHash;
+                if (!GetAddressIndexKey(out.scriptPubKey, addressType, addressHash))
+                    continue;
+
+                // undo receiving activity and the unspent output
+                addressIndex.push_back(make_pair(CAddressIndexKey(addressType, addressHash, pindex->nHeight, i, hash, k, false), out.nValue));
+                addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, addressHash, hash, k), CAddressUnspentValue()));
+            }
+        }
+
         // Check that all outputs are available and match the outputs in the block itself
         // exactly. Note that transactions with only provably unspendable outputs won't
         // have outputs available even in the block itself, so we handle that case
@@ -1987,10 +2226,37 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 if (coins->vout.size() < out.n + 1)
                     coins->vout.resize(out.n + 1);
                 coins->vout[out.n] = undo.txout;
+
+                if (fAddressIndex) {
+                    unsigned int addressType;
+                    uint160 addressHash;
+                    if (GetAddressIndexKey(undo.txout.scriptPubKey, addressType, addressHash)) {
+                        // undo spending activity and restore the unspent output
+                        addressIndex.push_back(make_pair(CAddressIndexKey(addressType, addressHash, pindex->nHeight, i, hash, j, true), -undo.txout.nValue));
+                        addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, addressHash, out.hash, out.n), CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, coins->nHeight)));
+                    }
+                }
+
+                if (fSpentIndex)
+                    spentIndex.push_back(make_pair(CSpentIndexKey(out.hash, out.n), CSpentIndexValue()));
             }
         }
     }
 
+    // only the active chain is indexed, not the views used by VerifyDB
+    if (pfClean == NULL) {
+        if (fAddressIndex) {
+            if (!pblocktree->EraseAddressIndex(addressIndex))
+                return state.Abort("Failed to delete address index");
+            if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex))
+                return state.Abort("Failed to write address unspent index");
+        }
+        if (fSpentIndex && !pblocktree->UpdateSpentIndex(spentIndex))
+            return state.Abort("Failed to write spent index");
+        if (fTimestampIndex && !pblocktree->EraseTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
+            return state.Abort("Failed to delete timestamp index");
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -2008,6 +2274,10 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    // Mappings may extend past the end of the truncated files
+    if (fFinalize)
+        InvalidateBlockFileCache(nLastBlockFile);
+
     FILE* fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -2035,6 +2305,115 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+/** Whether a header at nHeight meets its proof of work target; only headers up to LAST_POW_BLOCK can. */
+static bool HasProofOfWork(const CBlockHeader& header, const uint256& hash, int nHeight)
+{
+    return nHeight <= Params().LAST_POW_BLOCK() && CheckProofOfWork(hash, header.nBits);
+}
+
+/**
+ * Proof of work check of a bare header at nHeight. Up to LAST_POW_BLOCK every
+ * header is checked against its target. Proof-of-stake blocks are mixed in
+ * there and a header doesn't tell them apart, so a header that fails the
+ * check passes only without a nonce, as a proof-of-stake candidate whose
+ * stake AcceptBlock checks once its block arrives.
+ */
+static bool CheckHeaderProofOfWork(const CBlockHeader& header, const uint256& hash, int nHeight)
+{
+    return HasProofOfWork(header, hash, nHeight) || header.nNonce == 0 || nHeight > Params().LAST_POW_BLOCK();
+}
+
+/** Number of headers hashed by a single CHeaderCheck; a multiple of the widest PHI1612 engine. */
+static const unsigned int HEADER_CHECK_BATCH = 16;
+
+static CCheckQueue<CHeaderCheck> headercheckqueue(4);
+/** Held by the message handler thread that uses headercheckqueue; it takes one master at a time. */
+static CCriticalSection cs_headercheckqueue;
+
+void ThreadHeaderCheck()
+{
+    RenameThread("lux-headerch");
+    headercheckqueue.Thread();
+}
+
+bool CHeaderCheck::operator()()
+{
+    std::vector<const CBlockHeader*> vHeaders(nCount);
+    for (unsigned int i = 0; i < nCount; i++)
+        vHeaders[i] = &pheaders[i];
+    std::vector<uint256> vHashes;
+    CBlockHeader::GetHashes(vHeaders, vHashes);
+
+    for (unsigned int i = 0; i < nCount; i++) {
+        phashes[i] = vHashes[i];
+        if (!CheckHeaderProofOfWork(pheaders[i], vHashes[i], nHeight + i))
+            return false;
+    }
+    return true;
+}
+
+/** Number of transactions whose coins are loaded by a single CCoinsFetch. */
+static const unsigned int COINS_FETCH_BATCH = 8;
+
+static CCheckQueue<CCoinsFetch> coinsfetchqueue(4);
+
+void ThreadCoinsFetch()
+{
+    RenameThread("lux-coinsfetch");
+    coinsfetchqueue.Thread();
+}
+
+bool CCoinsFetch::operator()()
+{
+    for (unsigned int i = 0; i < nCount; i++) {
+        if (!pview->GetCoins(ptxids[i], pcoins[i]))
+            pcoins[i].Clear();
+    }
+    return true;
+}
+
+/**
+ * Load the coins spent by a block into pcoinsTip before connecting it. The
+ * coins database reads are spread over the coins fetching threads, instead of
+ * being done one at a time as ConnectBlock walks the transactions.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads)
+        return;
+
+    // Outputs created by the block itself are not in the database
+    std::set<uint256> setSkip;
+    std::vector<uint256> vTxids;
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+                if (setSkip.insert(txin.prevout.hash).second && !pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                    vTxids.push_back(txin.prevout.hash);
+            }
+        }
+        setSkip.insert(tx.GetHash());
+    }
+    if (vTxids.empty())
+        return;
+
+    std::vector<CCoins> vCoins(vTxids.size());
+    {
+        CCheckQueueControl<CCoinsFetch> control(&coinsfetchqueue);
+        std::vector<CCoinsFetch> vFetches;
+        for (unsigned int n = 0; n < vTxids.size(); n += COINS_FETCH_BATCH)
+            vFetches.push_back(CCoinsFetch(pcoinsTip->GetBackend(), &vTxids[n], &vCoins[n], std::min<unsigned int>(COINS_FETCH_BATCH, vTxids.size() - n)));
+        control.Add(vFetches);
+        control.Wait();
+    }
+
+    for (unsigned int i = 0; i < vTxids.size(); i++) {
+        if (!vCoins[i].IsPruned())
+            pcoinsTip->AddFetchedCoins(vTxids[i], vCoins[i]);
+    }
+}
+
 static bool IsBlockValueValid(const CBlock& block, int64_t nExpectedValue)
 {
     CBlockIndex* pindexPrev = chainActive.Tip();
@@ -2058,6 +2437,8 @@ static bool IsBlockValueValid(const CBlock& block, int64_t nExpectedValue)
 
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
+static int64_t nTimeScriptWait = 0;
+static int64_t nTimeUndo = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
@@ -2146,6 +2527,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     int64_t nValueOut = 0;
     int64_t nValueIn = 0;
@@ -2183,12 +2567,48 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 nFees += view.GetValueIn(tx) - tx.GetValueOut();
             }
 
+            if (fAddressIndex || fSpentIndex) {
+                const uint256 txhash = tx.GetHash();
+                for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                    const CTxIn& input = tx.vin[j];
+                    const CTxOut& prevout = view.GetOutputFor(input);
+                    unsigned int addressType = ADDRESS_INDEX_NONE;
+                    uint160 addressHash;
+                    if (!GetAddressIndexKey(prevout.scriptPubKey, addressType, addressHash))
+                        addressType = ADDRESS_INDEX_NONE;
+
+                    if (fAddressIndex && addressType != ADDRESS_INDEX_NONE) {
+                        // record spending activity and remove the unspent output
+                        addressIndex.push_back(make_pair(CAddressIndexKey(addressType, addressHash, pindex->nHeight, i, txhash, j, true), -prevout.nValue));
+                        addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, addressHash, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
+                    }
+
+                    if (fSpentIndex)
+                        spentIndex.push_back(make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(txhash, j, pindex->nHeight, prevout.nValue, addressType, addressHash)));
+                }
+            }
+
             std::vector<CScriptCheck> vChecks;
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
         }
 
+        if (fAddressIndex) {
+            const uint256 txhash = tx.GetHash();
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+                unsigned int addressType;
+                uint160 addressHash;
+                if (!GetAddressIndexKey(out.scriptPubKey, addressType, addressHash))
+                    continue;
+
+                // record receiving activity and the new unspent output
+                addressIndex.push_back(make_pair(CAddressIndexKey(addressType, addressHash, pindex->nHeight, i, txhash, k, false), out.nValue));
+                addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, addressHash, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
+            }
+        }
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2230,11 +2650,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             return error("%s: coinstake pays too much(actual=%d vs calculated=%d)", __func__, nStakeReward, nCalculatedStakeReward);
     }
 
+    // The script checks have been running on the script check threads while the
+    // transactions were walked; only what is left of them is waited for here
+    int64_t nTimeWaitStart = GetTimeMicros();
     if (!control.Wait())
         return state.DoS(100, false);
 
     int64_t nTime2 = GetTimeMicros();
+    nTimeScriptWait += nTime2 - nTimeWaitStart;
     nTimeVerify += nTime2 - nTimeStart;
+    LogPrint("bench", "      - Wait for script checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTimeWaitStart), nTimeScriptWait * 0.000001);
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs - 1), nTimeVerify * 0.000001);
 
     if (fJustCheck)
@@ -2258,16 +2683,35 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
+    int64_t nTimeUndoEnd = GetTimeMicros();
+    nTimeUndo += nTimeUndoEnd - nTime2;
+    LogPrint("bench", "    - Undo writing: %.2fms [%.2fs]\n", 0.001 * (nTimeUndoEnd - nTime2), nTimeUndo * 0.000001);
+
     if (fTxIndex)
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    if (fAddressIndex) {
+        if (!pblocktree->WriteAddressIndex(addressIndex))
+            return state.Abort("Failed to write address index");
+        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex))
+            return state.Abort("Failed to write address unspent index");
+    }
+
+    if (fSpentIndex)
+        if (!pblocktree->UpdateSpentIndex(spentIndex))
+            return state.Abort("Failed to write spent index");
+
+    if (fTimestampIndex)
+        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
+            return state.Abort("Failed to write timestamp index");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime3 = GetTimeMicros();
-    nTimeIndex += nTime3 - nTime2;
-    LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
+    nTimeIndex += nTime3 - nTimeUndoEnd;
+    LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTimeUndoEnd), nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
@@ -2304,7 +2748,7 @@ static bool FlushStateToDisk(CValidationState& state, FlushStateMode mode)
 		bool isExceptionOccured = false;
 		try {
 		    if ((mode == FLUSH_STATE_ALWAYS) ||
-		        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+		        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
 		        (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
 		        // Typical CCoins structures on disk are around 100 bytes in size.
 		        // Pushing a new one to the database can cause it to be written
@@ -2376,10 +2820,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2427,13 +2871,22 @@ bool static DisconnectTip(CValidationState& state)
     if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
         return false;
     // Resurrect mempool transactions from the disconnected block.
+    std::vector<uint256> vHashUpdate;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
         // ignore validation errors in resurrected transactions
         list<CTransaction> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, false, false, true))
             mempool.remove(tx, removed, true);
-    }
+        else if (mempool.exists(tx.GetHash()))
+            vHashUpdate.push_back(tx.GetHash());
+    }
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in this
+    // block that were added back and cleans up the mempool state.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
     mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
@@ -2447,6 +2900,7 @@ bool static DisconnectTip(CValidationState& state)
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimeFetchInputs = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2475,6 +2929,11 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchBlockInputs(*pblock);
+    int64_t nTimeFetched = GetTimeMicros();
+    nTimeFetchInputs += nTimeFetched - nTime2;
+    LogPrint("bench", "  - Fetch inputs: %.2fms [%.2fs]\n", (nTimeFetched - nTime2) * 0.001, nTimeFetchInputs * 0.000001);
+    nTime2 = nTimeFetched;
     {
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
         bool rv = ConnectBlock(*pblock, state, pindexNew, view);
@@ -2696,9 +3155,11 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
     const CBlockIndex* pindexFork = chainActive.FindFork(pindexMostWork);
 
     // Disconnect active blocks which are no longer in the best chain.
+    bool fBlocksDisconnected = false;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
         if (!DisconnectTip(state))
             return false;
+        fBlocksDisconnected = true;
     }
 
     // Build list of new blocks to connect.
@@ -2744,6 +3205,11 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
         }
     }
 
+    // Resurrected transactions were added without the size limit; trim now
+    // that the reorg is done.
+    if (fBlocksDisconnected)
+        LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+
     // Callbacks/notifications for a new best chain.
     if (fInvalidFound)
         CheckForkWarningConditionsOnNewFork(vpindexToConnect.back());
@@ -2792,13 +3258,44 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock)
         // Notifications/callbacks that can run without cs_main
         if (!fInitialDownload) {
             uint256 hashNewTip = pindexNewTip->GetBlockHash();
+            CInv inv(MSG_BLOCK, hashNewTip);
             // Relay inventory, but don't relay old inventory during initial block download.
             int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate(chainParams.Checkpoints());
+            // Peers in high-bandwidth compact block mode get the block right
+            // away instead of an inv they would have to answer with getdata.
+            // Build it before taking cs_vNodes, reading from disk only if one of them needs it.
+            boost::shared_ptr<CBlockHeaderAndShortTxIDs> pcmpctblock;
+            if (pblock && pblock->GetHash() == hashNewTip) {
+                pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(*pblock));
+            } else {
+                bool fPreferHeaderAndIDs = false;
+                {
+                    LOCK(cs_vNodes);
+                    BOOST_FOREACH (CNode* pnode, vNodes)
+                        fPreferHeaderAndIDs |= pnode->fPreferHeaderAndIDs;
+                }
+                CBlock block;
+                if (fPreferHeaderAndIDs && ReadBlockFromDisk(block, pindexNewTip))
+                    pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(block));
+            }
             {
                 LOCK(cs_vNodes);
-                BOOST_FOREACH (CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                BOOST_FOREACH (CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+
+                    bool fKnown = true;
+                    if (pnode->fPreferHeaderAndIDs && pcmpctblock) {
+                        LOCK(pnode->cs_inventory);
+                        fKnown = pnode->setInventoryKnown.count(inv);
+                    }
+                    if (!fKnown) {
+                        pnode->PushMessage("cmpctblock", *pcmpctblock);
+                        pnode->AddInventoryKnown(inv);
+                        continue;
+                    }
+                    pnode->PushInventory(inv);
+                }
             }
             // Notify external listeners about the new tip.
             uiInterface.NotifyBlockTip(hashNewTip);
@@ -2944,6 +3441,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         DEBUG_DUMP_STAKING_INFO_AddToBlockIndex();
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
+    pindexNew->nTimeMax = (pindexNew->pprev ? std::max(pindexNew->pprev->nTimeMax, pindexNew->nTime) : pindexNew->nTime);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
         pindexBestHeader = pindexNew;
@@ -3304,7 +3802,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3323,7 +3821,7 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
         return true;
     }
 
-    if (!CheckBlockHeader(block, state, block.IsProofOfWork())) {
+    if (!CheckBlockHeader(block, state, fCheckPOW && block.IsProofOfWork())) {
         LogPrintf("%s: CheckBlockHeader failed \n", __func__);
         return false;
     }
@@ -3547,6 +4045,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     } else {
         LogPrintf("%s: ACCEPTED %d %s (%s)\n", __func__, pindex->nHeight, hash.GetHex(), s);
     }
+    LogPrint("bench", "    - Header hashes: %u total\n", CBlockHeader::GetTotalHashComputations());
 
     return true;
 }
@@ -3678,6 +4177,7 @@ bool static LoadBlockIndexDB()
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
+    int64_t nStart = GetTimeMillis();
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     for (auto const &item : mapBlockIndex) {
@@ -3688,6 +4188,7 @@ bool static LoadBlockIndexDB()
     for (auto const &item : vSortedByHeight) {
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         if (pindex->nStatus & BLOCK_HAVE_DATA) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
@@ -3709,8 +4210,10 @@ bool static LoadBlockIndexDB()
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: computed chain work in %dms\n", __func__, GetTimeMillis() - nStart);
 
     // Load block file info
+    nStart = GetTimeMillis();
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
@@ -3742,6 +4245,7 @@ bool static LoadBlockIndexDB()
             return false;
         }
     }
+    LogPrintf("%s: loaded block file info in %dms\n", __func__, GetTimeMillis() - nStart);
 
     //Check if the shutdown procedure was followed on last client exit
     bool fLastShutdownWasPrepared = true;
@@ -3837,6 +4341,14 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have the address, spent and timestamp indexes
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("timestampindex", fTimestampIndex);
+    LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
+
     // If this is written true before the next client init, then we know the shutdown process failed
     pblocktree->WriteFlag("shutdown", false);
 
@@ -3906,7 +4418,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3970,6 +4482,12 @@ bool InitBlockIndex()
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", true);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+    pblocktree->WriteFlag("spentindex", fSpentIndex);
+    fTimestampIndex = GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+    pblocktree->WriteFlag("timestampindex", fTimestampIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4316,8 +4834,10 @@ bool static AlreadyHave(const CInv& inv)
                mapTxLockReqRejected.count(inv.hash);
     case MSG_TXLOCK_VOTE:
         return mapTxLockVote.count(inv.hash);
-    case MSG_SPORK:
+    case MSG_SPORK: {
+        LOCK(cs_sporks);
         return mapSporks.count(inv.hash);
+    }
     case MSG_MASTERNODE_WINNER:
         return mapSeenMasternodeVotes.count(inv.hash);
     }
@@ -4332,8 +4852,6 @@ void static ProcessGetData(CNode* pfrom)
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -4344,32 +4862,60 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
+                // Only the index lookup needs cs_main; block files are append-only
+                // so the block can be read from disk after releasing it.
                 bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end()) {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a max reorg depth than the best header
-                        // chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                               (chainActive.Height() - mi->second->nHeight < Params().MaxReorganizationDepth());
-                        if (!send) {
-                            LogPrintf("ProcessGetData(): ignoring request from peer=%i for old block that isn't in the main chain\n", pfrom->GetId());
+                bool fSendCompact = false;
+                CDiskBlockPos pos;
+                CBlockIndex* pindex = NULL;
+                uint256 hashTip;
+                {
+                    LOCK(cs_main);
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end()) {
+                        pindex = mi->second;
+                        if (chainActive.Contains(pindex)) {
+                            send = true;
+                        } else {
+                            // To prevent fingerprinting attacks, only send blocks outside of the active
+                            // chain if they are valid, and no more than a max reorg depth than the best header
+                            // chain we know about.
+                            send = pindex->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                                   (chainActive.Height() - pindex->nHeight < Params().MaxReorganizationDepth());
+                            if (!send) {
+                                LogPrintf("ProcessGetData(): ignoring request from peer=%i for old block that isn't in the main chain\n", pfrom->GetId());
+                            }
                         }
+                        if (send && !(pindex->nStatus & BLOCK_HAVE_DATA))
+                            send = false;
+                    }
+                    if (send) {
+                        pos = pindex->GetBlockPos();
+                        hashTip = chainActive.Tip()->GetBlockHash();
+                        // Older blocks are sent in full, the peer is unlikely to have their transactions
+                        fSendCompact = inv.type == MSG_CMPCT_BLOCK && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
                     }
                 }
                 if (send) {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    if (inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fSendCompact)) {
+                        // The disk and network encodings of a block are identical, so
+                        // the stored bytes are sent as they are
+                        std::vector<unsigned char> vchBlock;
+                        if (!ReadRawBlockFromDisk(vchBlock, pos))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", CFlatData(vchBlock));
+                    } else if (inv.type == MSG_CMPCT_BLOCK) {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, pos))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, pos))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -4395,12 +4941,13 @@ void static ProcessGetData(CNode* pfrom)
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        vInv.push_back(CInv(MSG_BLOCK, hashTip));
                         pfrom->PushMessage("inv", vInv);
                         pfrom->hashContinue = 0;
                     }
                 }
             } else if (inv.IsKnownType()) {
+                LOCK(cs_main);
                 // Send stream from relay memory
                 bool pushed = false;
                 {
@@ -4441,6 +4988,7 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_SPORK) {
+                    LOCK(cs_sporks);
                     if (mapSporks.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
@@ -4468,7 +5016,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             g_signals.Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -4487,6 +5035,100 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/** Process the blocks that were received before hashParent, now that it has been processed. Requires cs_main. */
+static void ProcessBlocksAwaitingParent(const uint256& hashParent)
+{
+    std::deque<uint256> vParents(1, hashParent);
+    while (!vParents.empty()) {
+        BlockMap::iterator mi = mapBlockIndex.find(vParents.front());
+        // Without its parent a block can't be accepted, so the descendants of a
+        // rejected block are dropped as well
+        bool fParentAccepted = mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA) && !(mi->second->nStatus & BLOCK_FAILED_MASK);
+
+        std::vector<uint256> vChildren;
+        std::pair<multimap<uint256, uint256>::iterator, multimap<uint256, uint256>::iterator> range = mapBlocksAwaitingParentByPrev.equal_range(vParents.front());
+        for (multimap<uint256, uint256>::iterator it = range.first; it != range.second; ++it)
+            vChildren.push_back(it->second);
+        mapBlocksAwaitingParentByPrev.erase(range.first, range.second);
+        vParents.pop_front();
+
+        BOOST_FOREACH (const uint256& hash, vChildren) {
+            map<uint256, CBlockAwaitingParent>::iterator it = mapBlocksAwaitingParent.find(hash);
+            CBlockAwaitingParent entry = it->second;
+            nBlocksAwaitingParentSize -= entry.nSize;
+            mapBlocksAwaitingParent.erase(it);
+            vParents.push_back(hash);
+            if (!fParentAccepted)
+                continue;
+
+            CValidationState state;
+            ProcessNewBlock(state, NULL, entry.pblock.get());
+            int nDoS;
+            if (state.IsInvalid(nDoS) && nDoS > 0)
+                Misbehaving(entry.nodeid, nDoS);
+        }
+    }
+}
+
+/** Process a block received from pfrom, either in full or reconstructed from a compact block */
+static void ProcessBlockFromPeer(CNode* pfrom, CBlock& block, const string& strCommand)
+{
+    uint256 hash = block.GetHash();
+    CInv inv(MSG_BLOCK, hash);
+    pfrom->AddInventoryKnown(inv);
+
+    LOCK(cs_main);
+    unsigned int nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId()) {
+        CNodeState* nodestate = State(pfrom->GetId());
+        nodestate->nBlocksDownloaded++;
+        nodestate->nBlockBytesDownloaded += nSize;
+        LogPrint("net", "received block %s (%u bytes) peer=%d, %d blocks at %d kB/s\n", hash.ToString(), nSize, pfrom->id,
+            nodestate->nBlocksDownloaded, GetDownloadRate(nodestate) / 1000);
+    }
+
+    // Blocks downloaded in parallel arrive out of order. A block can't be accepted
+    // before its parent (the stake of a proof-of-stake block is checked against the
+    // chain it builds on), so keep it until the parent is in, rather than drop it
+    // and download it again.
+    BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+    if (mi != mapBlockIndex.end() && !(mi->second->nStatus & BLOCK_HAVE_DATA) && !(mi->second->nStatus & BLOCK_FAILED_MASK) &&
+        !mapBlocksAwaitingParent.count(hash) && nBlocksAwaitingParentSize + nSize <= MAX_BLOCKS_AWAITING_PARENT_SIZE) {
+        MarkBlockAsReceived(hash);
+        CBlockAwaitingParent& entry = mapBlocksAwaitingParent[hash];
+        entry.pblock.reset(new CBlock(block));
+        entry.nodeid = pfrom->GetId();
+        entry.nSize = nSize;
+        mapBlocksAwaitingParentByPrev.insert(std::make_pair(block.hashPrevBlock, hash));
+        nBlocksAwaitingParentSize += nSize;
+        LogPrint("net", "block %s waits for its parent %s peer=%d\n", hash.ToString(), block.hashPrevBlock.ToString(), pfrom->id);
+        return;
+    }
+
+    CValidationState state;
+    ProcessNewBlock(state, pfrom, &block);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+            state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+    ProcessBlocksAwaitingParent(hash);
+}
+
+/** Messages of the Darksend, masternode, InstantX and spork subsystems, which take their own locks. */
+static bool IsMasternodeMessage(const string& strCommand)
+{
+    return strCommand == "dsf" || strCommand == "dsc" || strCommand == "dsa" || strCommand == "dsq" ||
+           strCommand == "dsi" || strCommand == "dssub" || strCommand == "dssu" || strCommand == "dss" ||
+           strCommand == "dsee" || strCommand == "dseep" || strCommand == "dseg" ||
+           strCommand == "mnget" || strCommand == "mnw" ||
+           strCommand == "txlreq" || strCommand == "txlvote" ||
+           strCommand == "spork" || strCommand == "getsporks";
+}
+
 static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -4610,6 +5252,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
 
     else if (pfrom->nVersion == 0) {
         // Must have a version message before anything else
+        LOCK(cs_main);
         Misbehaving(pfrom->GetId(), 1);
         return false;
     }
@@ -4623,6 +5266,17 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+            // Ask a few of the peers we connected to for new blocks as cmpctblock
+            // right away; from the others we fetch them as compact blocks after an inv
+            bool fAnnounceUsingCMPCTBLOCK = false;
+            if (!pfrom->fInbound && lNodesAnnouncingHeaderAndIDs.size() < MAX_CMPCTBLOCK_ANNOUNCING_PEERS) {
+                lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+                fAnnounceUsingCMPCTBLOCK = true;
+            }
+            pfrom->PushMessage("sendcmpct", fAnnounceUsingCMPCTBLOCK, CMPCTBLOCK_VERSION);
+        }
     }
 
 
@@ -4634,6 +5288,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
         if (pfrom->nVersion < CADDR_TIME_VERSION && addrman.size() > 1000)
             return true;
         if (vAddr.size() > 1000) {
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("message addr size() = %u", vAddr.size());
         }
@@ -4655,9 +5310,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
                     // at a time so the setAddrKnowns of the chosen nodes prevent repeats
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
+                    static const uint256 hashSalt = GetRandHash();
                     uint64_t hashAddr = addr.GetHash();
                     uint256 hashRand = hashSalt ^ (hashAddr << 32) ^ ((GetTime() + hashAddr) / (24 * 60 * 60));
                     hashRand = Hash(BEGIN(hashRand), END(hashRand));
@@ -4715,7 +5368,21 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
 
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
-                if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
+                if (!fAlreadyHave && !fImporting && !fReindex && pfrom->nVersion >= HEADERS_FIRST_VERSION && Params().HeadersFirstSyncingActive()) {
+                    // Request the headers up to the announced block; the block itself is
+                    // fetched by SendMessages once its header is known, unless we are
+                    // close to the tip and it is most likely the next block.
+                    CNodeState* nodestate = State(pfrom->GetId());
+                    if (CanRequestHeaders(nodestate))
+                        pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                    else
+                        nodestate->pindexHeadersDeferred = pindexBestHeader;
+                    if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20 && !mapBlocksInFlight.count(inv.hash)) {
+                        vToFetch.push_back(inv);
+                        MarkBlockAsInFlight(pfrom->GetId(), inv.hash);
+                    }
+                    LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                } else if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
                     // Add this to the list of blocks to request
                     vToFetch.push_back(inv);
                     LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
@@ -4731,8 +5398,13 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
             }
         }
 
-        if (!vToFetch.empty())
+        if (!vToFetch.empty()) {
+            // A single announced block is most likely the child of our tip, which
+            // can be rebuilt from the mempool
+            if (vToFetch.size() == 1 && pfrom->fProvidesHeaderAndIDs && !IsInitialBlockDownload())
+                vToFetch[0].type = MSG_CMPCT_BLOCK;
             pfrom->PushMessage("getdata", vToFetch);
+        }
     }
 
 
@@ -4740,6 +5412,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
         vector<CInv> vInv;
         vRecv >> vInv;
         if (vInv.size() > MAX_INV_SZ) {
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("message getdata size() = %u", vInv.size());
         }
@@ -4755,7 +5428,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
     }
 
 
-    else if (strCommand == "getblocks" || strCommand == "getheaders") {
+    else if (strCommand == "getblocks") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -4788,7 +5461,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive()) {
+    else if (strCommand == "getheaders") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -4941,6 +5614,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
         // Bypass the normal CBlock deserialization, as we don't want to risk deserializing 2000 full blocks.
         unsigned int nCount = ReadCompactSize(vRecv);
         if (nCount > MAX_HEADERS_RESULTS) {
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("headers message size = %u", nCount);
         }
@@ -4948,34 +5622,93 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
         for (unsigned int n = 0; n < nCount; n++) {
             vRecv >> headers[n];
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
+            ReadCompactSize(vRecv); // headers are sent as blocks, ignore the (empty) block signature too
         }
 
-        LOCK(cs_main);
-
         if (nCount == 0) {
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
         }
+
+        // The headers must continue a chain we know; the heights follow from it
+        int nHeightFirst;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator miPrev = mapBlockIndex.find(headers[0].hashPrevBlock);
+            if (miPrev == mapBlockIndex.end())
+                return error("headers from peer=%d don't connect to a known block", pfrom->id);
+            nHeightFirst = miPrev->second->nHeight + 1;
+        }
+
+        // Hashing and the proof of work of the headers don't depend on the chain,
+        // so they run without cs_main (see MessageNeedsMainLock), spread over the
+        // header check threads unless another peer's headers are using them.
+        std::vector<uint256> vHashes(nCount);
+        {
+            TRY_LOCK(cs_headercheckqueue, lockQueue);
+            bool fParallel = nScriptCheckThreads && lockQueue;
+            CCheckQueueControl<CHeaderCheck> control(fParallel ? &headercheckqueue : NULL);
+            std::vector<CHeaderCheck> vChecks;
+            bool fPoWOk = true;
+            for (unsigned int n = 0; n < nCount; n += HEADER_CHECK_BATCH) {
+                CHeaderCheck check(&headers[n], &vHashes[n], std::min(HEADER_CHECK_BATCH, nCount - n), nHeightFirst + n);
+                if (fParallel) {
+                    vChecks.push_back(CHeaderCheck());
+                    check.swap(vChecks.back());
+                } else if (!check())
+                    fPoWOk = false;
+            }
+            control.Add(vChecks);
+            if (!control.Wait() || !fPoWOk) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 50);
+                return error("headers from peer=%d fail proof of work", pfrom->id);
+            }
+        }
+
+        LOCK(cs_main);
+
+        // Forget the headers whose blocks arrived since the last batch
+        CNodeState* nodestate = State(pfrom->GetId());
+        CanRequestHeaders(nodestate);
+        int nLastCheckpointHeight = Checkpoints::GetTotalBlocksEstimate(Params().Checkpoints());
         CBlockIndex* pindexLast = NULL;
-        BOOST_FOREACH (const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
 
-            /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-             * before headers are reimplemented on mainnet
-             */
-            if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
+            // Already known headers need no further work
+            BlockMap::iterator mi = mapBlockIndex.find(vHashes[n]);
+            if (mi != mapBlockIndex.end()) {
+                pindexLast = mi->second;
+                continue;
+            }
+
+            // The proof of work was checked above; a bare header doesn't tell
+            // proof-of-stake blocks apart, so AcceptBlock checks the rest once the block is in.
+            if (!AcceptBlockHeader((CBlock)header, state, &pindexLast, false)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
                         Misbehaving(pfrom->GetId(), nDoS);
-                    std::string strError = "invalid header received " + header.GetHash().ToString();
+                    std::string strError = "invalid header received " + vHashes[n].ToString();
                     return error(strError.c_str());
                 }
             }
+
+            // Nothing backs a header without proof of work until its block
+            // arrives, so bound how many of those a peer can put into mapBlockIndex.
+            if (pindexLast && pindexLast->nHeight > nLastCheckpointHeight && !HasProofOfWork(header, vHashes[n], pindexLast->nHeight)) {
+                nodestate->lUnverifiedHeaders.push_back(pindexLast);
+                if (nodestate->lUnverifiedHeaders.size() > MAX_UNVERIFIED_HEADERS) {
+                    Misbehaving(pfrom->GetId(), 100);
+                    return error("peer=%d sent more than %u unverified headers", pfrom->id, MAX_UNVERIFIED_HEADERS);
+                }
+            }
         }
 
         if (pindexLast)
@@ -4983,10 +5716,14 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
 
         if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
             // Headers message had its maximum size; the peer may have more headers.
-            // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip(), continue
-            // from there instead.
-            LogPrintf("more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
-            pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256(0));
+            // The blocks of the headers received so far are downloaded from all
+            // peers having them meanwhile, see FindNextBlocksToDownload. Once too
+            // many of them are missing, SendMessages continues after they arrived.
+            if (CanRequestHeaders(nodestate)) {
+                LogPrint("net", "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256(0));
+            } else
+                nodestate->pindexHeadersDeferred = pindexLast;
         }
 
         CheckBlockIndex();
@@ -5002,7 +5739,10 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
 
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
         if (!mapBlockIndex.count(block.hashPrevBlock)) {
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+            if (pfrom->nVersion >= HEADERS_FIRST_VERSION && Params().HeadersFirstSyncingActive()) {
+                // Fetch the headers leading to it; the block is then downloaded like any other
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hashBlock);
+            } else if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
                 //we already asked for this block, so lets work backwards and ask for the previous block
                 pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
                 pfrom->vBlockRequested.push_back(block.hashPrevBlock);
@@ -5012,21 +5752,169 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
                 pfrom->vBlockRequested.push_back(hashBlock);
             }
         } else {
+            ProcessBlockFromPeer(pfrom, block, strCommand);
+        }
+
+    }
+
+
+    else if (strCommand == "sendcmpct") {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == CMPCTBLOCK_VERSION) {
+            pfrom->fProvidesHeaderAndIDs = true;
+            pfrom->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hashBlock = cmpctblock.header.GetHash();
+        CInv inv(MSG_BLOCK, hashBlock);
+        LogPrint("net", "received cmpctblock %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
             pfrom->AddInventoryKnown(inv);
+            return true;
+        }
 
-            CValidationState state;
-            ProcessNewBlock(state, pfrom, &block);
+        // A block not connecting to our chain is fetched in full; the block
+        // handler then asks for the missing parents
+        BlockMap::iterator miPrev = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+        if (miPrev == mapBlockIndex.end()) {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        // Check the header before spending any work on the block. It goes into
+        // mapBlockIndex only with the block itself, as with the other blocks
+        // we don't download headers-first.
+        CBlockIndex* pindexPrev = miPrev->second;
+        if (!CheckHeaderProofOfWork(cmpctblock.header, hashBlock, pindexPrev->nHeight + 1)) {
+            Misbehaving(pfrom->GetId(), 50);
+            return error("cmpctblock %s from peer=%d fails proof of work", hashBlock.ToString(), pfrom->id);
+        }
+        CValidationState state;
+        if (!ContextualCheckBlockHeader(cmpctblock.header, state, pindexPrev)) {
             int nDoS;
-            if (state.IsInvalid(nDoS)) {
-                pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                    state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-                if (nDoS > 0) {
-                    TRY_LOCK(cs_main, lockMain);
-                    if (lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                }
+            if (state.IsInvalid(nDoS) && nDoS > 0)
+                Misbehaving(pfrom->GetId(), nDoS);
+            return error("invalid cmpctblock header %s from peer=%d", hashBlock.ToString(), pfrom->id);
+        }
+
+        // Only reconstruct blocks we asked this peer for or that would make a better chain
+        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hashBlock);
+        bool fRequested = itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId();
+        CBlockIndex indexNew((CBlock)cmpctblock.header);
+        if (!fRequested && pindexPrev->nChainWork + GetBlockProof(indexNew) <= chainActive.Tip()->nChainWork) {
+            LogPrint("net", "ignoring cmpctblock %s from peer=%d without more work than our tip\n", hashBlock.ToString(), pfrom->id);
+            return true;
+        }
+
+        CNodeState* nodestate = State(pfrom->GetId());
+        nodestate->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+        ReadStatus status = nodestate->partialBlock->InitData(cmpctblock);
+        if (status == READ_STATUS_INVALID) {
+            nodestate->partialBlock.reset();
+            Misbehaving(pfrom->GetId(), 100);
+            return error("invalid cmpctblock %s from peer=%d", hashBlock.ToString(), pfrom->id);
+        } else if (status == READ_STATUS_FAILED) {
+            // Short id collision
+            nodestate->partialBlock.reset();
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        BlockTransactionsRequest req;
+        req.blockhash = hashBlock;
+        for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+            if (!nodestate->partialBlock->IsTxAvailable(i))
+                req.indexes.push_back(i);
+        }
+        if (!req.indexes.empty()) {
+            LogPrint("net", "requesting %u transactions of cmpctblock %s from peer=%d\n", req.indexes.size(), hashBlock.ToString(), pfrom->id);
+            pfrom->PushMessage("getblocktxn", req);
+            return true;
+        }
+
+        // Every transaction was prefilled or found in the mempool
+        CBlock block;
+        status = nodestate->partialBlock->FillBlock(block, vector<CTransaction>());
+        nodestate->partialBlock.reset();
+        if (status != READ_STATUS_OK) {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+        ProcessBlockFromPeer(pfrom, block, strCommand);
+    }
+
+
+    else if (strCommand == "getblocktxn") {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        CDiskBlockPos pos;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+            if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint("net", "peer=%d sent getblocktxn for a block we don't have\n", pfrom->id);
+                return true;
+            }
+            if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+                // Too deep for the peer to be reconstructing it; send the full block
+                LogPrint("net", "peer=%d sent getblocktxn for a block more than %d deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+                pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+                ProcessGetData(pfrom);
+                return true;
+            }
+            pos = mi->second->GetBlockPos();
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pos))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent getblocktxn with out-of-bounds transaction indexes", pfrom->id);
             }
+            resp.txn[i] = block.vtx[req.indexes[i]];
         }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) {
+        BlockTransactions resp;
+        vRecv >> resp;
 
+        LOCK(cs_main);
+        CNodeState* nodestate = State(pfrom->GetId());
+        if (!nodestate->partialBlock || nodestate->partialBlock->header.GetHash() != resp.blockhash) {
+            LogPrint("net", "peer=%d sent blocktxn for a block we weren't expecting\n", pfrom->id);
+            return true;
+        }
+
+        CBlock block;
+        ReadStatus status = nodestate->partialBlock->FillBlock(block, resp.txn);
+        nodestate->partialBlock.reset();
+        if (status == READ_STATUS_INVALID) {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("peer=%d sent blocktxn not matching its cmpctblock", pfrom->id);
+        } else if (status == READ_STATUS_FAILED) {
+            // Probably a short id collision with a mempool transaction
+            pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+            return true;
+        }
+        ProcessBlockFromPeer(pfrom, block, strCommand);
     }
 
 
@@ -5036,7 +5924,10 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
     // Making users (which are behind NAT and can only make outgoing connections) ignore
     // getaddr message mitigates the attack.
     else if ((strCommand == "getaddr") && (pfrom->fInbound)) {
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH (const CAddress& addr, vAddr)
             pfrom->PushAddress(addr);
@@ -5148,15 +6039,18 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
         vRecv >> alert;
 
         uint256 alertHash = alert.GetHash();
-        if (pfrom->setKnown.count(alertHash) == 0) {
+        bool fKnown;
+        {
+            LOCK(cs_mapAlerts);
+            fKnown = pfrom->setKnown.count(alertHash) != 0;
+        }
+        if (!fKnown) {
             if (alert.ProcessAlert()) {
                 // Relay
+                LOCK2(cs_vNodes, cs_mapAlerts);
                 pfrom->setKnown.insert(alertHash);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        alert.RelayTo(pnode);
-                }
+                BOOST_FOREACH (CNode* pnode, vNodes)
+                    alert.RelayTo(pnode);
             } else {
                 // Small DoS penalty so peers that send us lots of
                 // duplicate/expired/invalid-signature/whatever alerts
@@ -5164,6 +6058,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
                 // This isn't a Misbehaving(100) (immediate ban) because the
                 // peer might be an older or different implementation with
                 // a different signature key, etc.
+                LOCK(cs_main);
                 Misbehaving(pfrom->GetId(), 10);
             }
         }
@@ -5175,6 +6070,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
               strCommand == "filteradd" ||
               strCommand == "filterclear")) {
         LogPrintf("bloom message=%s\n", strCommand);
+        LOCK(cs_main);
         Misbehaving(pfrom->GetId(), 100);
     }
 
@@ -5183,10 +6079,11 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
         CBloomFilter filter;
         vRecv >> filter;
 
-        if (!filter.IsWithinSizeConstraints())
+        if (!filter.IsWithinSizeConstraints()) {
             // There is no excuse for sending a too-large filter
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
-        else {
+        } else {
             LOCK(pfrom->cs_filter);
             delete pfrom->pfilter;
             pfrom->pfilter = new CBloomFilter(filter);
@@ -5202,14 +6099,19 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
 
         // Nodes must NEVER send a data item > 520 bytes (the max size for a script data object,
         // and thus, the maximum size any matched object can have) in a filteradd message
+        bool fBadFilterAdd = false;
         if (vData.size() > MAX_SCRIPT_ELEMENT_SIZE) {
-            Misbehaving(pfrom->GetId(), 100);
+            fBadFilterAdd = true;
         } else {
             LOCK(pfrom->cs_filter);
             if (pfrom->pfilter)
                 pfrom->pfilter->insert(vData);
             else
-                Misbehaving(pfrom->GetId(), 100);
+                fBadFilterAdd = true;
+        }
+        if (fBadFilterAdd) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 100);
         }
     }
 
@@ -5247,7 +6149,7 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
     }
 
 
-    else {
+    else if (IsMasternodeMessage(strCommand)) {
         bool processed = false;
 #       if 0
         if (!processed) darksendPool.ProcessMessage(pfrom, strCommand, vRecv, processed);
@@ -5258,9 +6160,13 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
         if (!processed) ProcessSpork(pfrom, strCommand, vRecv, processed);
         if (!processed) masternodeSync.ProcessMessage(pfrom, strCommand, vRecv, processed);
 #       else
-        if (!processed) ProcessDarksend(pfrom, strCommand, vRecv, processed);
-        if (!processed) ProcessMasternode(pfrom, strCommand, vRecv, processed);
-        if (!processed) ProcessInstantX(pfrom, strCommand, vRecv, processed);
+        {
+            // Runs without cs_main, the handlers take it around chain and mempool access
+            LOCK(cs_process_message);
+            if (!processed) ProcessDarksend(pfrom, strCommand, vRecv, processed);
+            if (!processed) ProcessMasternode(pfrom, strCommand, vRecv, processed);
+            if (!processed) ProcessInstantX(pfrom, strCommand, vRecv, processed);
+        }
         if (!processed) ProcessSpork(pfrom, strCommand, vRecv, processed);
 #       endif
     }
@@ -5268,6 +6174,33 @@ static bool ProcessMessage(CNode* pfrom, const string &strCommand, CDataStream&
     return true;
 }
 
+/**
+ * Whether the handler of a message needs cs_main. Handlers of the messages below
+ * only touch the peer itself, the address manager or their own locked state, so
+ * they run on any message handler thread while another one validates a block.
+ * getdata and headers take cs_main just for the block index, alerts use
+ * cs_mapAlerts, sporks cs_sporks, and the Darksend, masternode and InstantX
+ * handlers are serialized by cs_process_message and take cs_main around chain
+ * and mempool access. Node state is guarded by cs_main, so they take it briefly
+ * to call Misbehaving(). Everything else is processed with cs_main held.
+ */
+static bool MessageNeedsMainLock(const string& strCommand)
+{
+    return !(strCommand == "ping" ||
+             strCommand == "pong" ||
+             strCommand == "addr" ||
+             strCommand == "getaddr" ||
+             strCommand == "getdata" ||
+             strCommand == "headers" ||
+             strCommand == "alert" ||
+             strCommand == "filterload" ||
+             strCommand == "filteradd" ||
+             strCommand == "filterclear" ||
+             strCommand == "sendcmpct" ||
+             strCommand == "reject" ||
+             IsMasternodeMessage(strCommand));
+}
+
 int ActiveProtocol()
 {
     return MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT;
@@ -5313,6 +6246,17 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        // While another thread holds cs_main, leave messages that need it queued
+        // and let this handler thread serve other peers meanwhile
+        boost::scoped_ptr<CCriticalBlock> lockMain;
+        if (MessageNeedsMainLock(msg.hdr.GetCommand())) {
+            lockMain.reset(new CCriticalBlock(cs_main, "cs_main", __FILE__, __LINE__, true));
+            if (!*lockMain) {
+                pfrom->fMessageDeferred = true;
+                break;
+            }
+        }
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -5429,8 +6373,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LOCK(cs_vNodes);
             BOOST_FOREACH (CNode* pnode, vNodes) {
                 // Periodically clear setAddrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->setAddrKnown.clear();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -5444,21 +6390,22 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         if (fSendTrickle) {
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH (const CAddress& addr, pto->vAddrToSend) {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second) {
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000) {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
-                    }
+            {
+                // Other handler threads relay addresses to this node meanwhile
+                LOCK(pto->cs_vAddrToSend);
+                vAddr.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH (const CAddress& addr, pto->vAddrToSend) {
+                    // returns true if wasn't already contained in the set
+                    if (pto->setAddrKnown.insert(addr).second)
+                        vAddr.push_back(addr);
                 }
+                pto->vAddrToSend.clear();
+            }
+            // receiver rejects addr messages larger than 1000
+            for (size_t i = 0; i < vAddr.size(); i += 1000) {
+                vector<CAddress> vAddrMsg(vAddr.begin() + i, vAddr.begin() + min(i + 1000, vAddr.size()));
+                pto->PushMessage("addr", vAddrMsg);
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                pto->PushMessage("addr", vAddr);
         }
 
         CNodeState& state = *State(pto->GetId());
@@ -5489,13 +6436,24 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = chainActive.Tip()->pprev ? chainActive.Tip()->pprev : chainActive.Tip();
-                //LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
-                pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                if (pto->nVersion >= HEADERS_FIRST_VERSION && Params().HeadersFirstSyncingActive()) {
+                    // Sync the header chain first; its blocks are then downloaded in
+                    // parallel from all peers having them
+                    CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
+                } else
+                    pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
             }
         }
 
+        // Continue a header sync held back until the blocks of earlier headers arrived
+        if (state.pindexHeadersDeferred && CanRequestHeaders(&state)) {
+            LogPrint("net", "resume getheaders (%d) to peer=%d\n", state.pindexHeadersDeferred->nHeight, pto->id);
+            pto->PushMessage("getheaders", chainActive.GetLocator(state.pindexHeadersDeferred), uint256(0));
+            state.pindexHeadersDeferred = NULL;
+        }
+
         // Resend wallet transactions that haven't gotten in a block yet
         // Except during reindex, importing and IBD, when old wallet
         // transactions become unconfirmed and spams other nodes.
@@ -5552,7 +6510,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
             // should only happen during initial block download.
-            LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
+            LogPrintf("Peer=%d is stalling block download (%d kB/s), disconnecting\n", pto->id, GetDownloadRate(&state) / 1000);
             pto->fDisconnect = true;
         }
         // In case there is a block that has been in flight from this peer for (2 + 0.5 * N) times the block interval
@@ -5564,6 +6522,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LogPrintf("Timeout downloading block %s from peer=%d, disconnecting\n", state.vBlocksInFlight.front().hash.ToString(), pto->id);
             pto->fDisconnect = true;
         }
+        if (pto->fDisconnect) {
+            // Hand the blocks requested from this peer to the others right away,
+            // instead of once the socket thread has dropped it
+            while (!state.vBlocksInFlight.empty())
+                MarkBlockAsReceived(state.vBlocksInFlight.front().hash);
+        }
 
         //
         // Message: getdata (blocks)
@@ -5639,18 +6603,28 @@ bool CBlockUndo::WriteToDisk(CDiskBlockPos& pos, const uint256& hashBlock)
 
 bool CBlockUndo::ReadFromDisk(const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
-
-    // Read block
+    // Read block, followed by its checksum
     uint256 hashChecksum;
-    try {
-        filein >> *this;
-        filein >> hashChecksum;
-    } catch (std::exception& e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    CBlockFileReader reader(SER_DISK, CLIENT_VERSION);
+    if (OpenBlockFileRecord(pos, "rev", sizeof(hashChecksum), reader)) {
+        try {
+            reader >> *this;
+            reader >> hashChecksum;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
+
+        try {
+            filein >> *this;
+            filein >> hashChecksum;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Verify checksum
@@ -12,6 +12,7 @@
 #include "config/lux-config.h"
 #endif
 
+#include "addressindex.h"
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
@@ -23,6 +24,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "spentindex.h"
 #include "sync.h"
 #include "tinyformat.h"
 #include "txmempool.h"
@@ -67,6 +69,18 @@ static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 static const unsigned int MAX_BLOCK_SIZE_GEN = MAX_BLOCK_SIZE/2;
 /** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
 /** The maximum size for transactions we're willing to relay/mine */
@@ -100,17 +114,32 @@ static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached their tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Maximum number of proof-of-stake headers past the last checkpoint we accept from a peer before
+ *  having their blocks. Their stake can only be checked with the block, so they are free to make. */
+static const unsigned int MAX_UNVERIFIED_HEADERS = 4 * MAX_HEADERS_RESULTS;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Maximum depth of blocks served as compact blocks when requested */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of blocks whose transactions are served by getblocktxn; deeper ones are sent in full */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Maximum number of peers asked to announce new blocks with cmpctblock (high-bandwidth mode, BIP 152) */
+static const unsigned int MAX_CMPCTBLOCK_ANNOUNCING_PEERS = 3;
+/** Maximum total size of the blocks kept in memory until their parent has been downloaded */
+static const unsigned int MAX_BLOCKS_AWAITING_PARENT_SIZE = 64 * 1000 * 1000;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Bloomfilter setting. */
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
+/** Optional indexes for explorers and exchanges, off by default. */
+static const bool DEFAULT_ADDRESSINDEX = false;
+static const bool DEFAULT_SPENTINDEX = false;
+static const bool DEFAULT_TIMESTAMPINDEX = false;
 /** "reject" message codes */
 static const unsigned char REJECT_MALFORMED = 0x01;
 static const unsigned char REJECT_INVALID = 0x10;
@@ -145,9 +174,12 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
+extern bool fTimestampIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 
@@ -214,6 +246,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header checking thread */
+void ThreadHeaderCheck();
+/** Run an instance of the coins fetching thread */
+void ThreadCoinsFetch();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -225,6 +261,13 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransaction& tx, uint256& hashBlock, bool fAllowSlow = false);
+/** Address type and hash paid to by a script, if it is one the address index covers */
+bool GetAddressIndexKey(const CScript& script, unsigned int& type, uint160& hashBytes);
+/** Lookups in the optional indexes, false if the index is disabled */
+bool GetSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value);
+bool GetAddressIndex(unsigned int type, const uint160& addressHash, std::vector<std::pair<CAddressIndexKey, CAmount> >& addressIndex, int nStart = 0, int nEnd = 0);
+bool GetAddressUnspent(unsigned int type, const uint160& addressHash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& unspentOutputs);
+bool GetTimestampIndex(unsigned int nHigh, unsigned int nLow, std::vector<uint256>& hashes);
 /** Find the best known block, and make it the tip of the block chain */
 
 bool DisconnectBlocksAndReprocess(int blocks);
@@ -257,7 +300,7 @@ void FlushStateToDisk();
 
 
 /** (try to) add transaction to memory pool **/
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false, bool fOverrideMempoolLimit = false);
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
@@ -271,6 +314,8 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int64_t nBlocksDownloaded;
+    int64_t nDownloadRate;
 };
 
 struct CDiskTxPos : public CDiskBlockPos {
@@ -489,11 +534,72 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure hashing a run of consecutive block headers with PHI1612, the first
+ * of which is at height nHeight. The hashes are written back so the caller
+ * does not need to recompute them. Headers of the proof-of-work phase with a
+ * nonce get their proof of work checked, as when loading the block index;
+ * proof of stake can only be checked once the block itself arrives.
+ */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader* pheaders;
+    uint256* phashes;
+    unsigned int nCount;
+    int nHeight;
+
+public:
+    CHeaderCheck() : pheaders(0), phashes(0), nCount(0), nHeight(0) {}
+    CHeaderCheck(const CBlockHeader* pheadersIn, uint256* phashesIn, unsigned int nCountIn, int nHeightIn) : pheaders(pheadersIn), phashes(phashesIn), nCount(nCountIn), nHeight(nHeightIn) {}
+
+    bool operator()();
+
+    void swap(CHeaderCheck& check)
+    {
+        std::swap(pheaders, check.pheaders);
+        std::swap(phashes, check.phashes);
+        std::swap(nCount, check.nCount);
+        std::swap(nHeight, check.nHeight);
+    }
+};
+
+
+/**
+ * Closure loading the coins of a run of transactions from a coins view, to
+ * warm up the coins cache before a block is connected. Transactions without
+ * coins in the view get pruned (empty) coins.
+ */
+class CCoinsFetch
+{
+private:
+    const CCoinsView* pview;
+    const uint256* ptxids;
+    CCoins* pcoins;
+    unsigned int nCount;
+
+public:
+    CCoinsFetch() : pview(0), ptxids(0), pcoins(0), nCount(0) {}
+    CCoinsFetch(const CCoinsView* pviewIn, const uint256* ptxidsIn, CCoins* pcoinsIn, unsigned int nCountIn) : pview(pviewIn), ptxids(ptxidsIn), pcoins(pcoinsIn), nCount(nCountIn) {}
+
+    bool operator()();
+
+    void swap(CCoinsFetch& check)
+    {
+        std::swap(pview, check.pview);
+        std::swap(ptxids, check.ptxids);
+        std::swap(pcoins, check.pcoins);
+        std::swap(nCount, check.nCount);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the serialized block at pos without deserializing it */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -524,7 +630,7 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is provided, the file is known to already reside on disk */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** pindex, CDiskBlockPos* dbp = NULL);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex = NULL);
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex = NULL, bool fCheckPOW = true);
 
 
 class CBlockFileInfo
@@ -14,6 +14,10 @@ CCriticalSection cs_masternodes;
 
 /** The list of active masternodes */
 std::vector<CMasterNode> vecMasternodes;
+/** Bumped whenever an entry of vecMasternodes is added, removed or updated */
+unsigned int nMasternodeListGeneration = 0;
+/** Cached rankings of the masternode list */
+CMasternodeRanks masternodeRanks;
 /** Object for who's going to get paid on which blocks */
 CMasternodePayments masternodePayments;
 // keep track of masternode votes I've seen
@@ -24,8 +28,6 @@ map<uint256, int> mapSeenMasternodeScanningErrors;
 std::map<CNetAddr, int64_t> askedForMasternodeList;
 // which masternodes we've asked for
 std::map<COutPoint, int64_t> askedForMasternodeListEntry;
-// cache block hashes as we calculate them
-std::map<int64_t, uint256> mapCacheBlockHashes;
 
 // manage the masternode connections
 void ProcessMasternodeConnections(){
@@ -91,6 +93,7 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
 
         if(pubkeyScript.size() != 25) {
             LogPrintf("dsee - pubkey the wrong size\n");
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             return;
         }
@@ -100,6 +103,7 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
 
         if(pubkeyScript2.size() != 25) {
             LogPrintf("dsee - pubkey2 the wrong size\n");
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             return;
         }
@@ -107,6 +111,7 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
         std::string errorMessage = "";
         if(!darkSendSigner.VerifyMessage(pubkey, vchSig, strMessage, errorMessage)){
             LogPrintf("dsee - Got bad masternode address signature\n");
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             return;
         }
@@ -114,8 +119,9 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
 
 
         //search existing masternode list, this is where we update existing masternodes with new dsee broadcasts
-        LOCK(cs_masternodes);
-        BOOST_FOREACH(CMasterNode& mn, vecMasternodes) {
+        {
+            LOCK(cs_masternodes);
+            BOOST_FOREACH(CMasterNode& mn, vecMasternodes) {
                         if(mn.vin.prevout == vin.prevout) {
                             // count == -1 when it's a new entry
                             //   e.g. We don't want the entry relayed/time updated when we're syncing the list
@@ -131,6 +137,7 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
                                     mn.sig = vchSig;
                                     mn.protocolVersion = protocolVersion;
                                     mn.addr = addr;
+                                    nMasternodeListGeneration++;
 
                                     RelayDarkSendElectionEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion);
                                 }
@@ -139,11 +146,13 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
                             return;
                         }
                     }
+        }
 
         // make sure the vout that was signed is related to the transaction that spawned the masternode
         //  - this is expensive, so it's only done once per masternode
         if(!darkSendSigner.IsVinAssociatedWithPubkey(vin, pubkey)) {
             LogPrintf("dsee - Got mismatched pubkey and vin\n");
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             return;
         }
@@ -153,6 +162,7 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
         // make sure it's still unspent
         //  - this is checked later by .check() in many places and by ThreadCheckDarkSendPool()
 
+        LOCK2(cs_main, cs_masternodes);
         CValidationState state;
         CTransaction tx = CTransaction();
         CTxOut vout = CTxOut((GetMNCollateral(chainActive.Tip()->nHeight)-1)*COIN, darkSendPool.collateralPubKey);
@@ -176,6 +186,7 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
             CMasterNode mn(addr, vin, pubkey, vchSig, sigTime, pubkey2, protocolVersion);
             mn.UpdateLastSeen(lastUpdated);
             vecMasternodes.push_back(mn);
+            nMasternodeListGeneration++;
 
             // if it matches our masternodeprivkey, then we've been remotely activated
             if(pubkey2 == activeMasternode.pubKeyMasternode && protocolVersion == PROTOCOL_VERSION){
@@ -243,8 +254,10 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
                                 if(!mn.UpdatedWithin(MASTERNODE_MIN_DSEEP_SECONDS)){
                                     mn.UpdateLastSeen();
                                     if(stop) {
+                                        // a disabled entry expires in Check() before its input is looked up
                                         mn.Disable();
                                         mn.Check();
+                                        nMasternodeListGeneration++;
                                     }
                                     RelayDarkSendElectionEntryPing(vin, vchSig, sigTime, stop);
                                 }
@@ -299,7 +312,7 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
             //}
         } //else, asking for a specific node which is ok
 
-        LOCK(cs_masternodes);
+        LOCK2(cs_main, cs_masternodes);
         int count = vecMasternodes.size();
         int i = 0;
 
@@ -335,6 +348,7 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
         }*/
 
         pfrom->FulfilledRequest("mnget");
+        LOCK2(cs_main, cs_masternodes);
         masternodePayments.Sync(pfrom);
         LogPrintf("mnget - Sent masternode winners to %s\n", pfrom->addr.ToString().c_str());
     }
@@ -347,33 +361,41 @@ void ProcessMasternode(CNode* pfrom, const std::string& strCommand, CDataStream&
         int a = 0;
         vRecv >> winner >> a;
 
-        if(chainActive.Tip() == NULL) return;
-
         uint256 hash = winner.GetHash();
-        if(mapSeenMasternodeVotes.count(hash)) {
-            if(fDebug) LogPrintf("mnw - seen vote %s Height %d bestHeight %d\n", hash.ToString().c_str(), winner.nBlockHeight, chainActive.Tip()->nHeight);
-            return;
+        int nHeight;
+        {
+            LOCK(cs_main);
+            if(chainActive.Tip() == NULL) return;
+            nHeight = chainActive.Tip()->nHeight;
+
+            if(mapSeenMasternodeVotes.count(hash)) {
+                if(fDebug) LogPrintf("mnw - seen vote %s Height %d bestHeight %d\n", hash.ToString().c_str(), winner.nBlockHeight, nHeight);
+                return;
+            }
         }
 
-        if(winner.nBlockHeight < chainActive.Tip()->nHeight - 10 || winner.nBlockHeight > chainActive.Tip()->nHeight+20){
-            LogPrintf("mnw - winner out of range %s Height %d bestHeight %d\n", winner.vin.ToString().c_str(), winner.nBlockHeight, chainActive.Tip()->nHeight);
+        if(winner.nBlockHeight < nHeight - 10 || winner.nBlockHeight > nHeight+20){
+            LogPrintf("mnw - winner out of range %s Height %d bestHeight %d\n", winner.vin.ToString().c_str(), winner.nBlockHeight, nHeight);
             return;
         }
 
         if(winner.vin.nSequence != std::numeric_limits<unsigned int>::max()){
             LogPrintf("mnw - invalid nSequence\n");
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             return;
         }
 
-        LogPrintf("mnw - winning vote  %s Height %d bestHeight %d\n", winner.vin.ToString().c_str(), winner.nBlockHeight, chainActive.Tip()->nHeight);
+        LogPrintf("mnw - winning vote  %s Height %d bestHeight %d\n", winner.vin.ToString().c_str(), winner.nBlockHeight, nHeight);
 
         if(!masternodePayments.CheckSignature(winner)){
             LogPrintf("mnw - invalid signature\n");
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             return;
         }
 
+        LOCK2(cs_main, cs_masternodes);
         mapSeenMasternodeVotes.insert(make_pair(hash, winner));
 
         if(masternodePayments.AddWinningMasternode(winner)){
@@ -428,11 +450,15 @@ int GetMasternodeByVin(CTxIn& vin)
 
 int GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
+    // the winner is the highest scored enabled masternode
+    LOCK2(cs_main, cs_masternodes);
+    if (mod == 1)
+        return masternodeRanks.GetIndexByRank(1, nBlockHeight, minProtocol);
+
+    // the ranking cache only holds mod 1 scores, scan for any other modulus
     int i = 0;
     unsigned int score = 0;
     int winner = -1;
-    LOCK(cs_masternodes);
-    // scan for winner
     BOOST_FOREACH(CMasterNode mn, vecMasternodes) {
         mn.Check();
         if (mn.protocolVersion < minProtocol) continue;
@@ -458,108 +484,266 @@ int GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
 
 int GetMasternodeByRank(int findRank, int64_t nBlockHeight, int minProtocol)
 {
-    LOCK(cs_masternodes);
-    int i = 0;
+    LOCK2(cs_main, cs_masternodes);
+    return masternodeRanks.GetIndexByRank(findRank, nBlockHeight, minProtocol);
+}
 
-    std::vector<pair<unsigned int, int> > vecMasternodeScores;
+int GetMasternodeRank(CTxIn& vin, int64_t nBlockHeight, int minProtocol)
+{
+    LOCK2(cs_main, cs_masternodes);
+    return masternodeRanks.GetRank(vin, nBlockHeight, minProtocol);
+}
 
-    i = 0;
-    BOOST_FOREACH(CMasterNode mn, vecMasternodes) {
-                    mn.Check();
-                    if(mn.protocolVersion < minProtocol) continue;
-                    if(!mn.IsEnabled()) {
-                        i++;
-                        continue;
-                    }
+struct CompareRankScore
+{
+    bool operator()(const std::pair<unsigned int, COutPoint>& a, const std::pair<unsigned int, COutPoint>& b) const
+    {
+        if (a.first != b.first)
+            return a.first > b.first;
+        return a.second < b.second;
+    }
+};
 
-                    uint256 n = mn.CalculateScore(1, nBlockHeight);
-                    unsigned int n2 = 0;
-                    memcpy(&n2, &n, sizeof(n2));
+static unsigned int GetRankScore(CMasterNode& mn, int64_t nBlockHeight)
+{
+    uint256 n = mn.CalculateScore(1, nBlockHeight);
+    unsigned int n2 = 0;
+    memcpy(&n2, &n, sizeof(n2));
+    return n2;
+}
 
-                    vecMasternodeScores.push_back(make_pair(n2, i));
-                    i++;
-                }
+void CMasternodeRanks::Sync()
+{
+    // drop the tables of blocks that are no longer on the active chain
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexTip != NULL && pindexTip->GetBlockHash() != hashLastTip) {
+        hashLastTip = pindexTip->GetBlockHash();
+        std::list<uint256>::iterator it = listTables.begin();
+        while (it != listTables.end()) {
+            uint256 hash;
+            if (!GetBlockHash(hash, mapTables[*it].nBlockHeight) || hash != *it) {
+                mapTables.erase(*it);
+                it = listTables.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // new entries are checked as they show up, the whole list every CHECK_SECONDS
+    bool fFull = GetTime() - nLastCheck >= CHECK_SECONDS;
+    if (!fFull && nMasternodeListGeneration == nLastGeneration)
+        return;
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareValueOnly2());
+    std::map<COutPoint, int> mapIndexNew;
+    for (unsigned int i = 0; i < vecMasternodes.size(); i++) {
+        CMasterNode& mn = vecMasternodes[i];
+        const COutPoint& prevout = mn.vin.prevout;
+        mapIndexNew[prevout] = i;
+        // known entries only need their state compared, Check() is the expensive part
+        if (fFull || !mapIndex.count(prevout))
+            mn.Check();
+
+        std::map<COutPoint, int>::iterator it = mapEnabled.find(prevout);
+        if (it != mapEnabled.end() && (!mn.IsEnabled() || it->second != mn.protocolVersion)) {
+            Remove(prevout);
+            it = mapEnabled.end();
+        }
+        if (mn.IsEnabled() && it == mapEnabled.end())
+            Add(mn);
+    }
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(unsigned int, int)& s, vecMasternodeScores){
-                    rank++;
-                    if(rank == findRank) return s.second;
-                }
+    // drop masternodes that left the list
+    std::vector<COutPoint> vRemoved;
+    for (std::map<COutPoint, int>::iterator it = mapEnabled.begin(); it != mapEnabled.end(); ++it)
+        if (!mapIndexNew.count(it->first))
+            vRemoved.push_back(it->first);
+    BOOST_FOREACH(const COutPoint& prevout, vRemoved)
+        Remove(prevout);
+
+    mapIndex.swap(mapIndexNew);
+    mapLegacyIndex.clear();
+    nLastGeneration = nMasternodeListGeneration;
+    if (fFull)
+        nLastCheck = GetTime();
+}
 
-    return -1;
+void CMasternodeRanks::Add(CMasterNode& mn)
+{
+    const COutPoint& prevout = mn.vin.prevout;
+    mapEnabled[prevout] = mn.protocolVersion;
+
+    for (std::map<uint256, CRankTable>::iterator it = mapTables.begin(); it != mapTables.end(); ++it) {
+        CRankTable& table = it->second;
+        std::pair<unsigned int, COutPoint> entry(GetRankScore(mn, table.nBlockHeight), prevout);
+        table.mapScores[prevout] = entry.first;
+
+        for (std::map<int, std::vector<std::pair<unsigned int, COutPoint> > >::iterator mi = table.mapRanked.begin(); mi != table.mapRanked.end(); ++mi) {
+            if (mn.protocolVersion < mi->first)
+                continue;
+            std::vector<std::pair<unsigned int, COutPoint> >& vRanked = mi->second;
+            vRanked.insert(std::upper_bound(vRanked.begin(), vRanked.end(), entry, CompareRankScore()), entry);
+        }
+    }
 }
 
-int GetMasternodeRank(CTxIn& vin, int64_t nBlockHeight, int minProtocol)
+void CMasternodeRanks::Remove(const COutPoint& prevout)
 {
-    LOCK(cs_masternodes);
-    std::vector<pair<unsigned int, CTxIn> > vecMasternodeScores;
+    mapEnabled.erase(prevout);
 
+    for (std::map<uint256, CRankTable>::iterator it = mapTables.begin(); it != mapTables.end(); ++it) {
+        CRankTable& table = it->second;
+        std::map<COutPoint, unsigned int>::iterator si = table.mapScores.find(prevout);
+        if (si == table.mapScores.end())
+            continue;
+        std::pair<unsigned int, COutPoint> entry(si->second, prevout);
+        table.mapScores.erase(si);
+
+        for (std::map<int, std::vector<std::pair<unsigned int, COutPoint> > >::iterator mi = table.mapRanked.begin(); mi != table.mapRanked.end(); ++mi) {
+            std::vector<std::pair<unsigned int, COutPoint> >& vRanked = mi->second;
+            std::vector<std::pair<unsigned int, COutPoint> >::iterator ri = std::lower_bound(vRanked.begin(), vRanked.end(), entry, CompareRankScore());
+            if (ri != vRanked.end() && ri->second == prevout)
+                vRanked.erase(ri);
+        }
+    }
+}
+
+CMasternodeRanks::CRankTable* CMasternodeRanks::GetTable(int64_t nBlockHeight)
+{
+    if (chainActive.Tip() == NULL)
+        return NULL;
+    if (nBlockHeight == 0)
+        nBlockHeight = chainActive.Tip()->nHeight;
+
+    uint256 hash;
+    if (!GetBlockHash(hash, nBlockHeight))
+        return NULL;
+
+    std::map<uint256, CRankTable>::iterator it = mapTables.find(hash);
+    if (it != mapTables.end()) {
+        nHits++;
+        return &it->second;
+    }
+    nMisses++;
+
+    while (listTables.size() >= MAX_TABLES) {
+        mapTables.erase(listTables.front());
+        listTables.pop_front();
+    }
+
+    CRankTable& table = mapTables[hash];
+    listTables.push_back(hash);
+    table.nBlockHeight = nBlockHeight;
     BOOST_FOREACH(CMasterNode& mn, vecMasternodes) {
-                    mn.Check();
+        if (mapEnabled.count(mn.vin.prevout))
+            table.mapScores[mn.vin.prevout] = GetRankScore(mn, nBlockHeight);
+    }
+    return &table;
+}
 
-                    if(mn.protocolVersion < minProtocol) continue;
-                    if(!mn.IsEnabled()) {
-                        continue;
-                    }
+const std::vector<std::pair<unsigned int, COutPoint> >& CMasternodeRanks::GetRanked(CRankTable& table, int minProtocol)
+{
+    std::map<int, std::vector<std::pair<unsigned int, COutPoint> > >::iterator it = table.mapRanked.find(minProtocol);
+    if (it != table.mapRanked.end())
+        return it->second;
+
+    // sort the cached scores, nothing is rehashed here
+    std::vector<std::pair<unsigned int, COutPoint> >& vRanked = table.mapRanked[minProtocol];
+    vRanked.reserve(table.mapScores.size());
+    for (std::map<COutPoint, unsigned int>::const_iterator si = table.mapScores.begin(); si != table.mapScores.end(); ++si) {
+        std::map<COutPoint, int>::const_iterator ei = mapEnabled.find(si->first);
+        if (ei != mapEnabled.end() && ei->second >= minProtocol)
+            vRanked.push_back(std::make_pair(si->second, si->first));
+    }
+    std::sort(vRanked.begin(), vRanked.end(), CompareRankScore());
+    return vRanked;
+}
 
-                    uint256 n = mn.CalculateScore(1, nBlockHeight);
-                    unsigned int n2 = 0;
-                    memcpy(&n2, &n, sizeof(n2));
+int CMasternodeRanks::GetIndex(const COutPoint& prevout, int minProtocol)
+{
+    // Numbered the way the original scan loops did it: masternodes below minProtocol
+    // don't advance the index. Callers index vecMasternodes with it as is.
+    std::map<COutPoint, int>& mapPositions = mapLegacyIndex[minProtocol];
+    if (mapPositions.empty()) {
+        int i = 0;
+        BOOST_FOREACH(const CMasterNode& mn, vecMasternodes) {
+            if (mn.protocolVersion < minProtocol) continue;
+            mapPositions[mn.vin.prevout] = i++;
+        }
+    }
 
-                    vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-                }
+    std::map<COutPoint, int>::iterator it = mapPositions.find(prevout);
+    return it != mapPositions.end() ? it->second : -1;
+}
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareValueOnly());
+int CMasternodeRanks::GetRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol)
+{
+    Sync();
 
-    unsigned int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(unsigned int, CTxIn)& s, vecMasternodeScores){
-                    rank++;
-                    if(s.second == vin) {
-                        return rank;
-                    }
-                }
+    std::map<COutPoint, int>::const_iterator ei = mapEnabled.find(vin.prevout);
+    if (ei == mapEnabled.end() || ei->second < minProtocol)
+        return -1;
 
-    return -1;
+    CRankTable* table = GetTable(nBlockHeight);
+    if (table == NULL)
+        return -1;
+
+    std::map<COutPoint, unsigned int>::const_iterator si = table->mapScores.find(vin.prevout);
+    if (si == table->mapScores.end())
+        return -1;
+
+    const std::vector<std::pair<unsigned int, COutPoint> >& vRanked = GetRanked(*table, minProtocol);
+    std::vector<std::pair<unsigned int, COutPoint> >::const_iterator it = std::lower_bound(vRanked.begin(), vRanked.end(), std::make_pair(si->second, vin.prevout), CompareRankScore());
+    if (it == vRanked.end() || it->second != vin.prevout)
+        return -1;
+    return it - vRanked.begin() + 1;
 }
 
-//Get the last hash that matches the modulus given. Processed in reverse order
-bool GetBlockHash(uint256& hash, int nBlockHeight)
+int CMasternodeRanks::GetIndexByRank(int nRank, int64_t nBlockHeight, int minProtocol)
 {
-    if (chainActive.Tip() == NULL) return false;
+    Sync();
 
-    if(nBlockHeight == 0)
-        nBlockHeight = chainActive.Tip()->nHeight;
+    CRankTable* table = GetTable(nBlockHeight);
+    if (table == NULL)
+        return -1;
 
-    if(mapCacheBlockHashes.count(nBlockHeight)){
-        hash = mapCacheBlockHashes[nBlockHeight];
-        return true;
-    }
+    const std::vector<std::pair<unsigned int, COutPoint> >& vRanked = GetRanked(*table, minProtocol);
+    if (nRank < 1 || nRank > (int)vRanked.size())
+        return -1;
+    return GetIndex(vRanked[nRank - 1].second, minProtocol);
+}
 
-    const CBlockIndex *BlockLastSolved = chainActive.Tip();
-    const CBlockIndex *BlockReading = chainActive.Tip();
+void CMasternodeRanks::Clear()
+{
+    mapTables.clear();
+    listTables.clear();
+    mapEnabled.clear();
+    mapIndex.clear();
+    mapLegacyIndex.clear();
+    nLastGeneration = nMasternodeListGeneration;
+    nLastCheck = 0;
+    hashLastTip = 0;
+}
 
-    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || chainActive.Tip()->nHeight+1 < nBlockHeight) return false;
+//Get the hash of the block preceding nBlockHeight on the active chain
+bool GetBlockHash(uint256& hash, int nBlockHeight)
+{
+    // resolved through the skip list of the current tip, so the result follows reorgs
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexTip == NULL || pindexTip->nHeight == 0) return false;
+    if (nBlockHeight < 0) return false;
 
-    int nBlocksAgo = 0;
-    if(nBlockHeight > 0) nBlocksAgo = (chainActive.Tip()->nHeight+1)-nBlockHeight;
-    assert(nBlocksAgo >= 0);
+    // a height of 0 means the block preceding the current tip
+    if (nBlockHeight == 0)
+        nBlockHeight = pindexTip->nHeight;
 
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if(n >= nBlocksAgo){
-            hash = BlockReading->GetBlockHash();
-            mapCacheBlockHashes[nBlockHeight] = hash;
-            return true;
-        }
-        n++;
+    if (pindexTip->nHeight+1 < nBlockHeight) return false;
 
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
-    }
+    int nHeight = nBlockHeight - 1;
+    if (nHeight <= 0) return false; // never the genesis block
 
-    return false;
+    hash = pindexTip->GetAncestor(nHeight)->GetBlockHash();
+    return true;
 }
 
 //
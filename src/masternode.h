@@ -42,12 +42,12 @@ using namespace std;
 
 class CMasternodePaymentWinner;
 
-extern CCriticalSection cs_masternodes;
+extern CCriticalSection cs_masternodes; // taken after cs_main
 extern std::vector<CMasterNode> vecMasternodes;
+extern unsigned int nMasternodeListGeneration;
 extern CMasternodePayments masternodePayments;
 extern std::vector<CTxIn> vecMasternodeAskedFor;
 extern map<uint256, CMasternodePaymentWinner> mapSeenMasternodeVotes;
-extern map<int64_t, uint256> mapCacheBlockHashes;
 
 
 // manage the masternode connections
@@ -159,6 +159,62 @@ int GetMasternodeByVin(CTxIn& vin);
 int GetMasternodeRank(CTxIn& vin, int64_t nBlockHeight=0, int minProtocol=CMasterNode::minProtoVersion);
 int GetMasternodeByRank(int findRank, int64_t nBlockHeight=0, int minProtocol=CMasterNode::minProtoVersion);
 
+bool GetBlockHash(uint256& hash, int nBlockHeight);
+
+//
+// Masternode ranking cache. Keeps one table of scores per election block hash so each
+// masternode is scored once per block; masternodes joining or expiring are merged into
+// the existing tables instead of rescoring the whole list. Guarded by cs_masternodes.
+//
+class CMasternodeRanks
+{
+private:
+    struct CRankTable
+    {
+        int64_t nBlockHeight;
+        std::map<COutPoint, unsigned int> mapScores;
+        // enabled masternodes by descending score, per minimum protocol version
+        std::map<int, std::vector<std::pair<unsigned int, COutPoint> > > mapRanked;
+    };
+
+    std::map<uint256, CRankTable> mapTables;
+    std::list<uint256> listTables;
+    // enabled masternodes and their protocol version
+    std::map<COutPoint, int> mapEnabled;
+    // position of each masternode in vecMasternodes
+    std::map<COutPoint, int> mapIndex;
+    // index returned to callers for each masternode, per minimum protocol version
+    std::map<int, std::map<COutPoint, int> > mapLegacyIndex;
+    uint256 hashLastTip;
+    unsigned int nLastGeneration;
+    int64_t nLastCheck;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Sync();
+    void Add(CMasterNode& mn);
+    void Remove(const COutPoint& prevout);
+    CRankTable* GetTable(int64_t nBlockHeight);
+    const std::vector<std::pair<unsigned int, COutPoint> >& GetRanked(CRankTable& table, int minProtocol);
+    int GetIndex(const COutPoint& prevout, int minProtocol);
+
+public:
+    static const unsigned int MAX_TABLES = 24;
+    static const int64_t CHECK_SECONDS = 10;
+
+    CMasternodeRanks() : nLastGeneration(0), nLastCheck(0), nHits(0), nMisses(0) {}
+
+    int GetRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol);
+    int GetIndexByRank(int nRank, int64_t nBlockHeight, int minProtocol);
+    void Clear();
+
+    size_t GetTableCount() const { return mapTables.size(); }
+    uint64_t GetHits() const { return nHits; }
+    uint64_t GetMisses() const { return nMisses; }
+};
+
+extern CMasternodeRanks masternodeRanks;
+
 
 // for storing the winning payments
 class CMasternodePaymentWinner
@@ -8,6 +8,7 @@
 #include "miner.h"
 
 #include "amount.h"
+#include "crypto/phi1612.h"
 #include "hash.h"
 #include "main.h"
 #include "stake.h"
@@ -16,6 +17,7 @@
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "timedata.h"
+#include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "masternode.h"
@@ -24,7 +26,6 @@
 #endif
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 
@@ -43,23 +44,111 @@ extern unsigned int nMinerSleep;
 //
 
 //
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// Transactions are selected from the memory pool as packages: a transaction
+// together with its not yet included in-mempool ancestors, in order of the
+// fee rate of the whole package (the mempool keeps that order in its
+// ancestor_score index). When a package is added to the block, the ancestor
+// state of its in-mempool descendants no longer matches what the mempool
+// index has cached; the corrected values are kept in a CTxMemPoolModifiedEntry
+// set for the rest of the block assembly.
 //
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+};
+
+/** Comparator for CTxMemPool::txiter objects.
+ *  It simply compares the internal memory address of the CTxMemPoolEntry object
+ *  pointed to. This means it has no meaning, and is only useful for using them
+ *  as key in other indexes.
+ */
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator()(const CTxMemPoolModifiedEntry& entry) const
+    {
+        return entry.iter;
+    }
+};
+
+// This matches the calculation in CompareTxMemPoolEntryByAncestorFee,
+// except operating on CTxMemPoolModifiedEntry.
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        }
+        return f1 > f2;
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            // Reuse same tag from CTxMemPool's similar index
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion {
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator()(CTxMemPoolModifiedEntry& e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+    }
+
+    CTxMemPool::txiter iter;
+};
+
+// Orders in-block candidates so that parents always come before children
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+
+struct TxCoinAgePriorityCompare {
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b)
     {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByScore()(*(b.second), *(a.second)); //Reverse order to make sort less than
+        return a.first < b.first;
     }
 };
 
@@ -67,29 +156,153 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+/**
+ * Check a transaction against the consensus and fee rules of the block being
+ * assembled and apply it to view. The caller checks the block size and sigops.
+ */
+static bool TestForBlock(const CTransaction& tx, CCoinsViewCache& view, int nHeight, CAmount nMinTxFee, CAmount nMaxTxFee, CAmount& nTxFees, unsigned int& nTxSigOps)
 {
-    bool byFee;
+    if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+        return false;
 
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    if (!view.HaveInputs(tx))
+        return false;
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+    if (nTxFees < nMinTxFee || nMaxTxFee <= nTxFees) {
+        LogPrint("debug", "%s: bad tx fee (%d, [%d, %d])\n", __func__, nTxFees, nMinTxFee, nMaxTxFee);
+        return false;
+    }
+
+    nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, view);
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        return false;
+
+    CTxUndo txundo;
+    UpdateCoins(tx, state, view, txundo, nHeight);
+    if (!state.IsValid()) {
+        LogPrint("debug", "%s: update coins failed (nHeight=%d, reason: %s)", __func__, nHeight, state.GetRejectReason());
+        return false;
+    } else if (!CheckTransaction(tx, state)) {
+        LogPrint("debug", "%s: invalid coins (nHeight=%d, reason: %s)", __func__, nHeight, state.GetRejectReason());
+        return false;
+    }
+    return true;
+}
+
+/** State of the block being filled by CreateNewBlock */
+struct CBlockAssembly {
+    CBlockAssembly(CBlockTemplate* pblocktemplateIn, CCoinsViewCache& viewIn, int nHeightIn, unsigned int nBlockMaxSizeIn, CAmount nMinTxFeeIn, CAmount nMaxTxFeeIn)
+        : pblocktemplate(pblocktemplateIn), view(viewIn), nHeight(nHeightIn), nBlockMaxSize(nBlockMaxSizeIn),
+          nMinTxFee(nMinTxFeeIn), nMaxTxFee(nMaxTxFeeIn), nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0), fPrintPriority(false)
     {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
     }
+
+    CBlockTemplate* pblocktemplate;
+    CCoinsViewCache& view;
+    int nHeight;
+    unsigned int nBlockMaxSize;
+    CAmount nMinTxFee;
+    CAmount nMaxTxFee;
+
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    CAmount nFees;
+    CTxMemPool::setEntries inBlock;
+    bool fPrintPriority;
 };
 
+/**
+ * Test a package, ordered parents first, against a scratch view and add it
+ * to the block if every transaction passes. nPackageFees is the modified fee
+ * total of the package, the fees of the block may not exceed MAX_BK_FEE.
+ */
+static bool AddPackageToBlock(CBlockAssembly& assembly, const std::vector<CTxMemPool::txiter>& package, CAmount nPackageFees)
+{
+    if (MAX_BK_FEE < assembly.nFees + nPackageFees) {
+        LogPrint("debug", "%s: bad package fee (%d, %d)\n", __func__, assembly.nFees, nPackageFees);
+        return false;
+    }
+
+    CCoinsViewCache viewPackage(&assembly.view);
+    std::vector<CAmount> vTxFees;
+    std::vector<unsigned int> vTxSigOps;
+    uint64_t nPackageSize = 0;
+    int nPackageSigOps = 0;
+    CAmount nPaidFees = 0;
+    BOOST_FOREACH (CTxMemPool::txiter it, package) {
+        CAmount nTxFees;
+        unsigned int nTxSigOps;
+        if (!TestForBlock(it->GetTx(), viewPackage, assembly.nHeight, assembly.nMinTxFee, assembly.nMaxTxFee, nTxFees, nTxSigOps))
+            return false;
+        // the modified total differs from the paid fees by prioritisetransaction deltas
+        nPaidFees += nTxFees;
+        if (MAX_BK_FEE < assembly.nFees + nPaidFees)
+            return false;
+        nPackageSize += it->GetTxSize();
+        nPackageSigOps += nTxSigOps;
+        if (assembly.nBlockSize + nPackageSize >= assembly.nBlockMaxSize || assembly.nBlockSigOps + nPackageSigOps >= (int)MAX_BLOCK_SIGOPS)
+            return false;
+        vTxFees.push_back(nTxFees);
+        vTxSigOps.push_back(nTxSigOps);
+    }
+    viewPackage.Flush();
+
+    CBlock* pblock = &assembly.pblocktemplate->block;
+    for (size_t i = 0; i < package.size(); i++) {
+        const CTransaction& tx = package[i]->GetTx();
+        pblock->vtx.push_back(tx);
+        assembly.pblocktemplate->vTxFees.push_back(vTxFees[i]);
+        assembly.pblocktemplate->vTxSigOps.push_back(vTxSigOps[i]);
+        assembly.nBlockSize += package[i]->GetTxSize();
+        ++assembly.nBlockTx;
+        assembly.nBlockSigOps += vTxSigOps[i];
+        assembly.nFees += vTxFees[i];
+        assembly.inBlock.insert(package[i]);
+
+        if (assembly.fPrintPriority) {
+            double dPriority = package[i]->GetPriority(assembly.nHeight);
+            CAmount dummy;
+            mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
+            LogPrintf("priority %.1f fee %s txid %s\n", dPriority,
+                CFeeRate(package[i]->GetModifiedFee(), package[i]->GetTxSize()).ToString(), tx.GetHash().ToString());
+        }
+    }
+    return true;
+}
+
+/**
+ * Add descendants of the given transactions to mapModifiedTx with the
+ * ancestor state reflecting the transactions already in the block.
+ */
+static void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx)
+{
+    BOOST_FOREACH (const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH (CTxMemPool::txiter desc, descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+}
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
 #if 0
@@ -188,178 +401,165 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         const int nHeight = pindexPrev->nHeight + 1;
         CCoinsViewCache view(pcoinsTip);
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
+        // Collect transactions into block
+        CBlockAssembly assembly(pblocktemplate.get(), view, nHeight, nBlockMaxSize, nMinTxFee, nMaxTxFee);
+        assembly.fPrintPriority = GetBoolArg("-printpriority", false);
+        CTxMemPool::setEntries failedTx;
+
+        // Fill the first nBlockPrioritySize bytes with the highest priority
+        // (coin age) transactions, included regardless of the fees they pay.
+        // Priorities are cached by the mempool entries, so no coins are looked
+        // up to build the queue.
+        if (nBlockPrioritySize > 0) {
+            std::vector<TxCoinAgePriority> vecPriority;
+            TxCoinAgePriorityCompare pricomparer;
+            std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+            vecPriority.reserve(mempool.mapTx.size());
+            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi) {
+                double dPriority = mi->GetPriority(nHeight);
+                CAmount dummy;
+                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+                vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+            }
+            std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+            while (!vecPriority.empty()) {
+                CTxMemPool::txiter iter = vecPriority.front().second;
+                double dPriority = vecPriority.front().first;
+                std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                vecPriority.pop_back();
+
+                // Wait for the in-mempool parents to be included first
+                bool fStillDependent = false;
+                BOOST_FOREACH (CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter)) {
+                    if (!assembly.inBlock.count(parent)) {
+                        fStillDependent = true;
                         break;
                     }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
+                }
+                if (fStillDependent) {
+                    waitPriMap.insert(std::make_pair(iter, dPriority));
                     continue;
                 }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
 
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
+                if (AddPackageToBlock(assembly, std::vector<CTxMemPool::txiter>(1, iter), iter->GetModifiedFee())) {
+                    // Done once past the priority size or out of high-priority transactions
+                    if (assembly.nBlockSize >= nBlockPrioritySize || !AllowFree(dPriority))
+                        break;
 
-                dPriority += (double)nValueIn * nConf;
+                    // Retry the transactions that were waiting on this one
+                    BOOST_FOREACH (CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter)) {
+                        std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator wpiter = waitPriMap.find(child);
+                        if (wpiter != waitPriMap.end()) {
+                            vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                            std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                            waitPriMap.erase(wpiter);
+                        }
+                    }
+                }
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
         }
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+        // Fill the rest of the block by package fee rate. mapModifiedTx holds
+        // the in-mempool descendants of included transactions with their
+        // ancestor state corrected for what is already in the block.
+        indexed_modified_transaction_set mapModifiedTx;
+        CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+
+        // Start from the descendants of the priority transactions
+        UpdatePackagesForAdded(assembly.inBlock, mapModifiedTx);
+
+        while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty()) {
+            // Skip entries in mapTx that are already in a block or are present
+            // in mapModifiedTx (which implies that the mapTx ancestor state is
+            // stale due to ancestor inclusion in the block). Also skip
+            // transactions that we've already failed to add.
+            if (mi != mempool.mapTx.get<ancestor_score>().end()) {
+                CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+                if (mapModifiedTx.count(it) || assembly.inBlock.count(it) || failedTx.count(it)) {
+                    ++mi;
+                    continue;
+                }
+            }
 
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee && ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+            // Now that mi is not stale, determine which transaction to evaluate:
+            // the next entry from mapTx, or the best from mapModifiedTx?
+            bool fUsingModified = false;
+            modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+            CTxMemPool::txiter iter;
+            if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+                // We're out of entries in mapTx; use the entry from mapModifiedTx
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Try to compare the mapTx entry to the mapModifiedTx entry
+                iter = mempool.mapTx.project<0>(mi);
+                if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                    // The best entry in mapModifiedTx has higher score
+                    // than the one from mapTx.
+                    // Switch which transaction (package) to consider
+                    iter = modit->iter;
+                    fUsingModified = true;
+                } else {
+                    // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                    // Increment mi for the next loop iteration.
+                    ++mi;
+                }
             }
 
-            if (!view.HaveInputs(tx))
-                continue;
+            // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+            // contain anything that is inBlock.
+            assert(!assembly.inBlock.count(iter));
 
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-            if (nTxFees < nMinTxFee || nMaxTxFee <= nTxFees || MAX_BK_FEE < (nFees+nTxFees)) {
-                LogPrint("debug", "%s: bad tx fee (%d, %d, [%d, %d])\n", __func__, nFees, nTxFees, nMinTxFee, nMaxTxFee);
-                continue;
+            uint64_t packageSize = iter->GetSizeWithAncestors();
+            CAmount packageFees = iter->GetModFeesWithAncestors();
+            if (fUsingModified) {
+                packageSize = modit->nSizeWithAncestors;
+                packageFees = modit->nModFeesWithAncestors;
             }
-            
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
+            // Skip free transactions if we're past the minimum block size;
+            // everything else we might consider has a lower fee rate.
+            if (packageFees < ::minRelayTxFee.GetFee(packageSize) && assembly.nBlockSize >= nBlockMinSize)
+                break;
 
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-            if (!state.IsValid()) {
-                LogPrint("debug", "%s: update coins failed (nHeight=%d, reason: %s)", __func__, nHeight, state.GetRejectReason());
-                continue;
-            } else if (!CheckTransaction(tx, state)) {
-                LogPrint("debug", "%s: invalid coins (nHeight=%d, reason: %s)", __func__, nHeight, state.GetRejectReason());
-                continue;
-            }
+            CTxMemPool::setEntries ancestors;
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n", dPriority, feeRate.ToString(), tx.GetHash().ToString());
+            std::vector<CTxMemPool::txiter> package;
+            package.push_back(iter);
+            BOOST_FOREACH (CTxMemPool::txiter ancestor, ancestors) {
+                if (!assembly.inBlock.count(ancestor))
+                    package.push_back(ancestor);
             }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
+            std::sort(package.begin(), package.end(), CompareTxIterByAncestorCount());
+
+            if (assembly.nBlockSize + packageSize >= nBlockMaxSize || !AddPackageToBlock(assembly, package, packageFees)) {
+                if (fUsingModified) {
+                    // Since we always look at the best entry in mapModifiedTx,
+                    // we must erase failed entries so that we can consider the
+                    // next best entry on the next loop iteration
+                    mapModifiedTx.get<ancestor_score>().erase(modit);
                 }
+                failedTx.insert(iter);
+                continue;
             }
+
+            // Update the ancestor state of the descendants of the package
+            CTxMemPool::setEntries added(package.begin(), package.end());
+            BOOST_FOREACH (CTxMemPool::txiter it, added) {
+                mapModifiedTx.erase(it);
+            }
+            UpdatePackagesForAdded(added, mapModifiedTx);
         }
 
+        nFees = assembly.nFees;
+        uint64_t nBlockSize = assembly.nBlockSize;
+        uint64_t nBlockTx = assembly.nBlockTx;
+
         if (nBlockSize < nBlockMinSize || nBlockMaxSize < nBlockSize) {
             LogPrintf("%s: bad block size (nBlockSize=%d, [%d, %d])", __func__, nBlockSize, nBlockMinSize, nBlockMaxSize);
             return nullptr;
@@ -569,14 +769,28 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
         //
         int64_t nStart = GetTime();
         uint256 hashTarget = uint256().SetCompact(pblock->nBits);
+        // Hash one nonce per PHI1612 lane at a time
+        const unsigned int nLanes = Phi1612Lanes();
+        std::vector<CBlockHeader> vLanes(nLanes);
+        std::vector<const CBlockHeader*> vpLanes(nLanes);
+        std::vector<uint256> vHashes;
+        for (unsigned int i = 0; i < nLanes; i++)
+            vpLanes[i] = &vLanes[i];
         while (true) {
             unsigned int nHashesDone = 0;
 
-            uint256 hash;
+            std::fill(vLanes.begin(), vLanes.end(), pblock->GetBlockHeader());
             while (true) {
-                hash = pblock->GetHash();
-                if (hash <= hashTarget) {
+                for (unsigned int i = 0; i < nLanes; i++)
+                    vLanes[i].nNonce = pblock->nNonce + i;
+                CBlockHeader::GetHashes(vpLanes, vHashes);
+                unsigned int nFound = 0;
+                while (nFound < nLanes && vHashes[nFound] > hashTarget)
+                    nFound++;
+                if (nFound < nLanes) {
                     // Found a solution
+                    pblock->nNonce += nFound;
+                    uint256 hash = vHashes[nFound];
                     SetThreadPriority(THREAD_PRIORITY_NORMAL);
                     LogPrintf("BitcoinMiner:\n");
                     LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex(), hashTarget.GetHex());
@@ -590,9 +804,9 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
 
                     break;
                 }
-                pblock->nNonce += 1;
-                nHashesDone += 1;
-                if ((pblock->nNonce & 0xFF) == 0)
+                pblock->nNonce += nLanes;
+                nHashesDone += nLanes;
+                if ((pblock->nNonce & 0xFF) < nLanes)
                     break;
             }
 
@@ -38,6 +38,9 @@
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
+#include <event2/event.h>
+#include <event2/thread.h>
+
 // Dump addresses to peers.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
 
@@ -108,6 +111,9 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
+
+static void RegisterNodeSocket(CNode* pnode);
+static void UnregisterNodeSocket(CNode* pnode);
 boost::condition_variable messageHandlerCondition;
 
 // Signals for message handling
@@ -429,6 +435,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool darkSendMaste
         {
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
+            RegisterNodeSocket(pnode);
         }
 
         pnode->nTimeConnected = GetTime();
@@ -449,6 +456,7 @@ void CNode::CloseSocketDisconnect()
     fDisconnect = true;
     if (hSocket != INVALID_SOCKET) {
         LogPrint("net", "disconnecting peer=%d\n", id);
+        UnregisterNodeSocket(this);
         CloseSocket(hSocket);
     }
 
@@ -698,74 +706,400 @@ void SocketSendData(CNode* pnode)
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+/**
+ * Network event loop. Where libevent offers an edge-triggered backend (epoll,
+ * kqueue) each socket is registered once and the loop only services sockets
+ * that became ready; otherwise ThreadSocketHandler polls with select().
+ */
+static struct event_base* baseNet = NULL;
+static struct event* evNetWakeup = NULL;
+static struct event* evNetTimer = NULL;
+static struct event* evNetRetry = NULL;
+static std::vector<struct event*> vListenEvents;
+
+/** Nodes whose socket became readable or writable, or that asked to be serviced again */
+static std::set<CNode*> setNodesReady;
+static CCriticalSection cs_setNodesReady;
+
+/** How often the event loop looks for nodes to disconnect, in milliseconds */
+static const int NET_HOUSEKEEPING_INTERVAL = 100;
+/** How long to wait before servicing a node whose send lock was busy, in milliseconds */
+static const int NET_RETRY_INTERVAL = 10;
+
+static void MarkNodeReady(CNode* pnode)
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true) {
-        //
-        // Disconnect nodes
-        //
-        {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+    LOCK(cs_setNodesReady);
+    setNodesReady.insert(pnode);
+}
 
-                    //LogPrintf("ThreadSocketHandler -- removing node: peer=%d addr=%s nRefCount=%d fNetworkNode=%d fInbound=%d fMasternode=%d\n",
-                      //        pnode->id, pnode->addr.ToString(), pnode->GetRefCount(), pnode->fNetworkNode, pnode->fInbound, pnode->fMasternode);
+/** Have the socket thread service pnode again, from any thread */
+static void WakeSocketHandler(CNode* pnode)
+{
+    if (!baseNet)
+        return;
+    MarkNodeReady(pnode);
+    event_active(evNetWakeup, 0, 0);
+}
 
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+static void SocketEventCallback(evutil_socket_t fd, short what, void* arg)
+{
+    CNode* pnode = (CNode*)arg;
+    if (what & EV_READ)
+        pnode->fSocketReadable = true;
+    if (what & EV_WRITE)
+        pnode->fSocketWritable = true;
+    MarkNodeReady(pnode);
+}
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+// requires LOCK(cs_vNodes)
+static void RegisterNodeSocket(CNode* pnode)
+{
+    if (!baseNet || pnode->pevSocket || pnode->hSocket == INVALID_SOCKET)
+        return;
+    pnode->pevSocket = event_new(baseNet, pnode->hSocket, EV_READ | EV_WRITE | EV_PERSIST | EV_ET, SocketEventCallback, pnode);
+    if (!pnode->pevSocket || event_add(pnode->pevSocket, NULL) != 0) {
+        LogPrintf("%s: unable to watch socket of peer=%d\n", __func__, pnode->id);
+        pnode->fDisconnect = true;
+    }
+}
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+static void UnregisterNodeSocket(CNode* pnode)
+{
+    if (pnode->pevSocket) {
+        event_free(pnode->pevSocket);
+        pnode->pevSocket = NULL;
+    }
+}
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+// requires LOCK(cs_vRecvMsg)
+static bool IsReceiveFlooded(CNode* pnode)
+{
+    return !pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+           pnode->GetTotalRecvSize() > ReceiveFloodSize();
+}
+
+static void DisconnectNodes()
+{
+    static unsigned int nPrevNodeCount = 0;
+
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+
+                //LogPrintf("ThreadSocketHandler -- removing node: peer=%d addr=%s nRefCount=%d fNetworkNode=%d fInbound=%d fMasternode=%d\n",
+                  //        pnode->id, pnode->addr.ToString(), pnode->GetRefCount(), pnode->fNetworkNode, pnode->fInbound, pnode->fMasternode);
+
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
+
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
-        {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend) {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv) {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend) {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv) {
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    {
+                        LOCK(cs_setNodesReady);
+                        setNodesReady.erase(pnode);
                     }
+                    delete pnode;
                 }
             }
         }
-        size_t vNodesSize;
+    }
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (!baseNet && !IsSelectableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+
         {
             LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+            vNodes.push_back(pnode);
+            RegisterNodeSocket(pnode);
         }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+/**
+ * Read once from the socket of pnode. Returns the number of bytes received,
+ * 0 if the connection was closed and -1 if no data was available.
+ */
+// requires LOCK(cs_vRecvMsg)
+static int ReceiveFromSocket(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0) {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return nBytes;
+    } else if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+        return 0;
+    }
+
+    // error
+    int nErr = WSAGetLastError();
+    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+        //if (!pnode->fDisconnect)
+          //  LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+        pnode->CloseSocketDisconnect();
+        return 0;
+    }
+    return -1;
+}
+
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
         }
+    }
+}
+
+/**
+ * Send and receive on a ready socket until the kernel reports it would block.
+ * Returns false if the send lock was busy and the node has to be serviced again.
+ * A busy receive lock means the message handler is working on this node; it
+ * wakes us when done if the socket is still readable, so that is not retried.
+ */
+static bool ServiceNodeSocket(CNode* pnode)
+{
+    if (pnode->hSocket == INVALID_SOCKET)
+        return true;
+
+    // As with select(), drain the send queue before receiving more, so a peer
+    // that doesn't read what we send is throttled by TCP flow control.
+    bool fSendPending;
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (!lockSend)
+            return false;
+        if (pnode->fSocketWritable && !pnode->vSendMsg.empty()) {
+            SocketSendData(pnode);
+            // A partial write means the socket buffer is full; wait for the next edge
+            if (!pnode->vSendMsg.empty())
+                pnode->fSocketWritable = false;
+        }
+        fSendPending = !pnode->vSendMsg.empty();
+    }
+
+    if (fSendPending || !pnode->fSocketReadable || pnode->hSocket == INVALID_SOCKET)
+        return true;
+
+    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+    if (!lockRecv)
+        return true;
+    // Edge-triggered: read until the socket is empty, unless the receive buffer
+    // is full, in which case the message handler wakes us once it caught up.
+    while (!IsReceiveFlooded(pnode)) {
+        boost::this_thread::interruption_point();
+        int nBytes = ReceiveFromSocket(pnode);
+        if (nBytes <= 0) {
+            pnode->fSocketReadable = false;
+            break;
+        }
+    }
+    return true;
+}
+
+static void NetWakeupCallback(evutil_socket_t fd, short what, void* arg)
+{
+}
+
+static void NetRetryCallback(evutil_socket_t fd, short what, void* arg)
+{
+}
+
+static void NetTimerCallback(evutil_socket_t fd, short what, void* arg)
+{
+    static int64_t nLastInactivityCheck = 0;
+
+    DisconnectNodes();
+
+    int64_t nNow = GetTime();
+    if (nNow == nLastInactivityCheck)
+        return;
+    nLastInactivityCheck = nNow;
+
+    vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+    }
+    // Only this thread deletes nodes, so they stay valid without taking a reference
+    BOOST_FOREACH (CNode* pnode, vNodesCopy)
+        InactivityCheck(pnode);
+}
+
+static void ListenEventCallback(evutil_socket_t fd, short what, void* arg)
+{
+    size_t i = (size_t)arg;
+    if (i < vhListenSocket.size())
+        AcceptConnection(vhListenSocket[i]);
+}
+
+static bool InitNetEventLoop()
+{
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+
+    struct event_config* cfg = event_config_new();
+    if (!cfg)
+        return false;
+    event_config_require_features(cfg, EV_FEATURE_ET);
+    baseNet = event_base_new_with_config(cfg);
+    event_config_free(cfg);
+    if (!baseNet) {
+        LogPrintf("No edge-triggered network event backend available, using select()\n");
+        return false;
+    }
+
+    evNetWakeup = event_new(baseNet, -1, 0, NetWakeupCallback, NULL);
+    evNetTimer = event_new(baseNet, -1, EV_PERSIST, NetTimerCallback, NULL);
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = NET_HOUSEKEEPING_INTERVAL * 1000;
+    event_add(evNetTimer, &tv);
+    evNetRetry = event_new(baseNet, -1, 0, NetRetryCallback, NULL);
+
+    for (size_t i = 0; i < vhListenSocket.size(); i++) {
+        struct event* ev = event_new(baseNet, vhListenSocket[i].socket, EV_READ | EV_PERSIST, ListenEventCallback, (void*)i);
+        event_add(ev, NULL);
+        vListenEvents.push_back(ev);
+    }
+
+    // Sockets of nodes connected before the loop existed
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            RegisterNodeSocket(pnode);
+    }
+
+    LogPrintf("Using %s for network events\n", event_base_get_method(baseNet));
+    return true;
+}
+
+static void ShutdownNetEventLoop()
+{
+    BOOST_FOREACH (struct event* ev, vListenEvents)
+        event_free(ev);
+    vListenEvents.clear();
+    if (evNetTimer)
+        event_free(evNetTimer);
+    evNetTimer = NULL;
+    if (evNetRetry)
+        event_free(evNetRetry);
+    evNetRetry = NULL;
+    if (evNetWakeup)
+        event_free(evNetWakeup);
+    evNetWakeup = NULL;
+    if (baseNet)
+        event_base_free(baseNet);
+    baseNet = NULL;
+}
+
+static void ThreadSocketHandlerSelect()
+{
+    while (true) {
+        DisconnectNodes();
 
         //
         // Find which sockets have data to receive
@@ -822,8 +1156,7 @@ void ThreadSocketHandler()
                 }
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    if (lockRecv && !IsReceiveFlooded(pnode))
                         FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
@@ -849,49 +1182,8 @@ void ThreadSocketHandler()
         // Accept new connections
         //
         BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
+            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+                AcceptConnection(hListenSocket);
         }
 
         //
@@ -914,33 +1206,8 @@ void ThreadSocketHandler()
                 continue;
             if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                //if (!pnode->fDisconnect)
-                                  //  LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                if (lockRecv)
+                    ReceiveFromSocket(pnode);
             }
 
             //
@@ -957,22 +1224,7 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -982,6 +1234,45 @@ void ThreadSocketHandler()
     }
 }
 
+void ThreadSocketHandler()
+{
+    if (!InitNetEventLoop()) {
+        ThreadSocketHandlerSelect();
+        return;
+    }
+
+    while (true) {
+        // Wait for socket readiness, a wakeup or the housekeeping timer
+        event_base_loop(baseNet, EVLOOP_ONCE);
+        boost::this_thread::interruption_point();
+
+        std::vector<CNode*> vReady;
+        {
+            LOCK(cs_setNodesReady);
+            vReady.assign(setNodesReady.begin(), setNodesReady.end());
+            setNodesReady.clear();
+        }
+
+        // Nodes are only deleted by this thread (DisconnectNodes), so the
+        // pointers taken from the ready set stay valid here.
+        bool fRetry = false;
+        BOOST_FOREACH (CNode* pnode, vReady) {
+            boost::this_thread::interruption_point();
+            if (!ServiceNodeSocket(pnode)) {
+                MarkNodeReady(pnode);
+                fRetry = true;
+            }
+        }
+        // Don't spin on a busy lock, look at these nodes again shortly
+        if (fRetry && !event_pending(evNetRetry, EV_TIMEOUT, NULL)) {
+            struct timeval tv;
+            tv.tv_sec = 0;
+            tv.tv_usec = NET_RETRY_INTERVAL * 1000;
+            event_add(evNetRetry, &tv);
+        }
+    }
+}
+
 
 #ifdef USE_UPNP
 void ThreadMapPort()
@@ -1380,20 +1671,32 @@ void ThreadMessageHandler()
             if (pnode->fDisconnect)
                 continue;
 
+            // Another handler thread is serving this node
+            if (pnode->fMessageHandlerBusy.exchange(true))
+                continue;
+
             // Receive messages
+            bool fResumeReceive = false;
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv) {
+                    pnode->fMessageDeferred = false;
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
-                    if (pnode->nSendSize < SendBufferSize()) {
+                    // Reading stopped while the receive buffer was full, or
+                    // while we held the lock; resume it once the lock is free
+                    fResumeReceive = pnode->fSocketReadable && !IsReceiveFlooded(pnode);
+
+                    if (pnode->nSendSize < SendBufferSize() && !pnode->fMessageDeferred) {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
                             fSleep = false;
                         }
                     }
                 }
             }
+            if (fResumeReceive)
+                WakeSocketHandler(pnode);
             boost::this_thread::interruption_point();
 
             // Send messages
@@ -1402,6 +1705,7 @@ void ThreadMessageHandler()
                 if (lockSend)
                     g_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
             }
+            pnode->fMessageHandlerBusy = false;
             boost::this_thread::interruption_point();
         }
 
@@ -1614,7 +1918,11 @@ void StartNode(boost::thread_group& threadGroup)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    int nMessageHandlerThreads = GetArg("-msghandthreads", DEFAULT_MSGHAND_THREADS);
+    nMessageHandlerThreads = std::max(std::min(nMessageHandlerThreads, MAX_MSGHAND_THREADS), 1);
+    LogPrintf("Using %d threads for peer message processing\n", nMessageHandlerThreads);
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
     // Dump network addresses
     threadGroup.create_thread(boost::bind(&LoopForever<void (*)()>, "dumpaddr", &DumpAddresses, DUMP_ADDRESSES_INTERVAL * 1000));
@@ -1653,6 +1961,11 @@ public:
 
     ~CNetCleanup()
     {
+        // Stop watching sockets before they are closed
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            UnregisterNodeSocket(pnode);
+        ShutdownNetEventLoop();
+
         // Close sockets
         BOOST_FOREACH (CNode* pnode, vNodes)
             if (pnode->hSocket != INVALID_SOCKET)
@@ -1982,6 +2295,11 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nServices = 0;
     hSocket = hSocketIn;
     nRecvVersion = INIT_PROTO_VERSION;
+    pevSocket = NULL;
+    fSocketReadable = false;
+    fSocketWritable = false;
+    fMessageHandlerBusy = false;
+    fMessageDeferred = false;
     nLastSend = 0;
     nLastRecv = 0;
     nSendBytes = 0;
@@ -2005,6 +2323,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
+    fProvidesHeaderAndIDs = false;
+    fPreferHeaderAndIDs = false;
     setInventoryKnown.max_size(SendBufferSize() / 1000);
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
@@ -2032,6 +2352,7 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
 
 CNode::~CNode()
 {
+    UnregisterNodeSocket(this);
     CloseSocket(hSocket);
 
     if (pfilter)
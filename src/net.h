@@ -31,6 +31,7 @@
 #include <boost/foreach.hpp>
 #include <boost/signals2/signal.hpp>
 
+struct event;
 class CAddrMan;
 class CBlockIndex;
 class CNode;
@@ -63,6 +64,10 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** -msghandthreads default: threads processing peer messages */
+static const int DEFAULT_MSGHAND_THREADS = 2;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHAND_THREADS = 16;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -235,6 +240,17 @@ public:
     uint64_t nRecvBytes;
     int nRecvVersion;
 
+    // edge-triggered readiness of the socket, set by the network event loop
+    struct event* pevSocket;
+    std::atomic<bool> fSocketReadable;
+    std::atomic<bool> fSocketWritable;
+
+    // claimed by the message handler thread serving this node, so its messages
+    // are processed in order and SendMessages never runs concurrently for it
+    std::atomic<bool> fMessageHandlerBusy;
+    // the next message waits for cs_main, which another thread holds
+    bool fMessageDeferred;
+
     int64_t nLastSend;
     int64_t nLastRecv;
     int64_t nTimeConnected;
@@ -259,6 +275,10 @@ public:
     // b) the peer may tell us in their version message that we should not relay tx invs
     //    until they have initialized their bloom filter.
     bool fRelayTxes;
+    // Set by the sendcmpct message: the peer understands compact blocks, and
+    // whether it wants new blocks pushed as cmpctblock rather than announced by inv
+    bool fProvidesHeaderAndIDs;
+    bool fPreferHeaderAndIDs;
     // Should be 'true' only if we connected to this node to actually mix funds.
     // In this case node will be released automatically via CMasternodeMan::ProcessMasternodeConnections().
     // Connecting to verify connectability/status or connecting for sending/relaying single message
@@ -295,8 +315,9 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     mruset<CAddress> setAddrKnown;
+    CCriticalSection cs_vAddrToSend; // also guards setAddrKnown
     bool fGetAddr;
-    std::set<uint256> setKnown;
+    std::set<uint256> setKnown; // alerts, guarded by cs_mapAlerts
 
     // inventory based relay
     mruset<CInv> setInventoryKnown;
@@ -380,6 +401,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         setAddrKnown.insert(addr);
     }
 
@@ -388,6 +410,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !setAddrKnown.count(addr)) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
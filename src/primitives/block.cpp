@@ -5,6 +5,7 @@
 
 #include "primitives/block.h"
 
+#include "crypto/phi1612.h"
 #include "hash.h"
 #include "script/standard.h"
 #include "script/sign.h"
@@ -12,8 +13,90 @@
 #include "utilstrencodings.h"
 #include "util.h"
 
+#include <atomic>
+#include <mutex>
+
+static std::atomic<uint64_t> nTotalHeaderHashes(0);
+
+/**
+ * Locks guarding the hash caches of all headers, picked by address. A lock
+ * per header would make headers non-copyable, and hashing stays outside
+ * of them.
+ */
+static std::mutex csHashCache[64];
+
+static std::mutex& HashCacheLock(const CBlockHeader* pheader)
+{
+    return csHashCache[((uintptr_t)pheader / sizeof(CBlockHeader)) % 64];
+}
+
+bool CBlockHeader::GetCachedHash(uint256& hash) const
+{
+    std::lock_guard<std::mutex> lock(HashCacheLock(this));
+    if (!fHashCached || memcmp(vchHashedHeader, BEGIN(nVersion), HEADER_SIZE) != 0)
+        return false;
+    hash = hashCached;
+    return true;
+}
+
+void CBlockHeader::SetCachedHash(const uint256& hash) const
+{
+    std::lock_guard<std::mutex> lock(HashCacheLock(this));
+    memcpy(vchHashedHeader, BEGIN(nVersion), HEADER_SIZE);
+    hashCached = hash;
+    fHashCached = true;
+}
+
+CBlockHeader& CBlockHeader::operator=(const CBlockHeader& other)
+{
+    if (this == &other)
+        return *this;
+    nVersion = other.nVersion;
+    hashPrevBlock = other.hashPrevBlock;
+    hashMerkleRoot = other.hashMerkleRoot;
+    nTime = other.nTime;
+    nBits = other.nBits;
+    nNonce = other.nNonce;
+
+    // Only one cache lock is held at a time
+    uint256 hash;
+    if (other.GetCachedHash(hash)) {
+        SetCachedHash(hash);
+    } else {
+        std::lock_guard<std::mutex> lock(HashCacheLock(this));
+        fHashCached = false;
+    }
+    return *this;
+}
+
 uint256 CBlockHeader::GetHash() const{
-    return Phi1612(BEGIN(nVersion), END(nNonce));
+    assert(END(nNonce) - BEGIN(nVersion) == HEADER_SIZE);
+    uint256 hash;
+    if (GetCachedHash(hash))
+        return hash;
+    hash = Phi1612(BEGIN(nVersion), END(nNonce));
+    nTotalHeaderHashes++;
+    SetCachedHash(hash);
+    return hash;
+}
+
+void CBlockHeader::GetHashes(const std::vector<const CBlockHeader*>& vHeaders, std::vector<uint256>& vHashes)
+{
+    std::vector<const unsigned char*> vIn;
+    vIn.reserve(vHeaders.size());
+    for (std::vector<const CBlockHeader*>::const_iterator it = vHeaders.begin(); it != vHeaders.end(); ++it)
+        vIn.push_back((const unsigned char*)BEGIN((*it)->nVersion));
+    vHashes.resize(vHeaders.size());
+    if (!vIn.empty())
+        Phi1612xN(vHashes[0].begin(), &vIn[0], HEADER_SIZE, vIn.size());
+    nTotalHeaderHashes += vHeaders.size();
+    for (size_t i = 0; i < vHeaders.size(); i++)
+        vHeaders[i]->SetCachedHash(vHashes[i]);
+}
+
+uint64_t CBlockHeader::GetTotalHashComputations()
+{
+    return nTotalHeaderHashes;
 }
 
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
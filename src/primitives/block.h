@@ -39,6 +39,15 @@ public:
         SetNull();
     }
 
+    CBlockHeader(const CBlockHeader& other)
+    {
+        fHashCached = false;
+        *this = other;
+    }
+
+    //! Copies the header fields and, if still valid, the cached hash
+    CBlockHeader& operator=(const CBlockHeader& other);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -60,6 +69,7 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -67,12 +77,35 @@ public:
         return (nBits == 0);
     }
 
+    /**
+     * PHI1612 hash of the header. The result is cached together with the
+     * header fields it was computed from, so it is only recomputed after
+     * the header has been modified. The cache is guarded by a lock, so
+     * several threads can hash the same unmodified header.
+     */
     uint256 GetHash() const;
 
+    /** Hash several headers in one go using the multi-lane PHI1612 engine. */
+    static void GetHashes(const std::vector<const CBlockHeader*>& vHeaders, std::vector<uint256>& vHashes);
+
+    /** Number of header hashes computed by this process */
+    static uint64_t GetTotalHashComputations();
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
     }
+
+private:
+    static const size_t HEADER_SIZE = 80;
+
+    // memory only
+    mutable unsigned char vchHashedHeader[HEADER_SIZE];
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
+
+    bool GetCachedHash(uint256& hash) const;
+    void SetCachedHash(const uint256& hash) const;
 };
 
 
@@ -131,14 +164,8 @@ public:
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        return block;
+        // Copies the cached hash along with the header
+        return *(const CBlockHeader*)this;
     }
 
     // ppcoin: two types of block: proof-of-work or proof-of-stake
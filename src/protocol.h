@@ -156,6 +156,9 @@ enum {
     MSG_TXLOCK_VOTE,
     MSG_SPORK,
     MSG_MASTERNODE_WINNER,
+    // Types 8 to 16 are used by the masternode and budget messages.
+    // A compact block (BIP 152); only requested in getdata, never announced in an inv.
+    MSG_CMPCT_BLOCK = 17,
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -6,26 +6,74 @@
 
 #include "eccryptoverify.h"
 
-#ifdef USE_SECP256K1
 #include <secp256k1.h>
-#else
+#ifndef USE_SECP256K1
 #include "ecwrapper.h"
 #endif
 
+//! anonymous namespace
+namespace
+{
+/**
+ * Set up the libsecp256k1 verification tables once. They are read-only
+ * afterwards, so all script check threads share them without any per
+ * call context setup.
+ */
+class CSecp256k1VerifyInit
+{
+public:
+    CSecp256k1VerifyInit()
+    {
+        secp256k1_start(SECP256K1_START_VERIFY);
+    }
+};
+static CSecp256k1VerifyInit instance_of_csecp256k1verify;
+
+} // anon namespace
+
+#ifndef USE_SECP256K1
+/**
+ * Strict DER encoding as required by BIP66, without the hash type byte.
+ * libsecp256k1 and OpenSSL agree on every signature encoded like this.
+ */
+static bool IsStrictDERSignature(const std::vector<unsigned char>& sig)
+{
+    if (sig.size() < 8 || sig.size() > 72) return false;
+    if (sig[0] != 0x30 || sig[1] != sig.size() - 2) return false;
+    unsigned int lenR = sig[3];
+    if (5 + lenR >= sig.size()) return false;
+    unsigned int lenS = sig[5 + lenR];
+    if (lenR + lenS + 6 != sig.size()) return false;
+
+    if (sig[2] != 0x02 || lenR == 0 || (sig[4] & 0x80)) return false;
+    if (lenR > 1 && sig[4] == 0x00 && !(sig[5] & 0x80)) return false;
+
+    if (sig[lenR + 4] != 0x02 || lenS == 0 || (sig[lenR + 6] & 0x80)) return false;
+    if (lenS > 1 && sig[lenR + 6] == 0x00 && !(sig[lenR + 7] & 0x80)) return false;
+
+    return true;
+}
+#endif
+
 bool CPubKey::Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const
 {
     if (!IsValid())
         return false;
-#ifdef USE_SECP256K1
-    if (secp256k1_ecdsa_verify((const unsigned char*)&hash, 32, &vchSig[0], vchSig.size(), begin(), size()) != 1)
-        return false;
-#else
-    CECKey key;
-    if (!key.SetPubKey(begin(), size()))
+#ifndef USE_SECP256K1
+    if (!IsStrictDERSignature(vchSig)) {
+        // lax encodings from before BIP66 are still decided by OpenSSL, as they always were
+        CECKey key;
+        if (!key.SetPubKey(begin(), size()))
+            return false;
+        if (!key.Verify(hash, vchSig))
+            return false;
+        return true;
+    }
+#endif
+    if (vchSig.empty())
         return false;
-    if (!key.Verify(hash, vchSig))
+    if (secp256k1_ecdsa_verify((const unsigned char*)&hash, 32, &vchSig[0], vchSig.size(), begin(), size()) != 1)
         return false;
-#endif
     return true;
 }
 
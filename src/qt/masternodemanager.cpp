@@ -151,6 +151,9 @@ static QString seconds_to_DHMS(quint32 duration)
 
 void MasternodeManager::updateNodeList()
 {
+    TRY_LOCK(cs_main, lockMain);
+    if(!lockMain)
+        return;
     TRY_LOCK(cs_masternodes, lockMasternodes);
     if(!lockMasternodes)
         return;
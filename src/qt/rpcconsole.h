@@ -13,6 +13,7 @@
 #include <QDialog>
 class QMenu;
 class ClientModel;
+class RPCTimerInterface;
 
 namespace Ui
 {
@@ -134,6 +135,7 @@ private:
     int historyPtr;
     NodeId cachedNodeid;
     QMenu *contextMenu;
+    RPCTimerInterface* rpcTimerInterface;
 };
 
 #endif // BITCOIN_QT_RPCCONSOLE_H
@@ -5,6 +5,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockfilecache.h"
 #include "checkpoints.h"
 #include "main.h"
 #include "primitives/transaction.h"
@@ -20,7 +21,6 @@ using namespace std;
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
-int getBlockTimeByHeight(int nHeight);
 
 double GetPoWDifficulty(const CBlockIndex* blockindex)
 {
@@ -149,48 +149,13 @@ UniValue getpowdifficulty(const UniValue& params, bool fHelp)
 }
 
 
-UniValue getrawmempool(const UniValue& params, bool fHelp)
+UniValue mempoolToJSON(bool fVerbose = false)
 {
-    if (fHelp || params.size() > 1)
-        throw runtime_error(
-            "getrawmempool ( verbose )\n"
-            "\nReturns all transaction ids in memory pool as a json array of string transaction ids.\n"
-            "\nArguments:\n"
-            "1. verbose           (boolean, optional, default=false) true for a json object, false for array of transaction ids\n"
-            "\nResult: (for verbose = false):\n"
-            "[                     (json array of string)\n"
-            "  \"transactionid\"     (string) The transaction id\n"
-            "  ,...\n"
-            "]\n"
-            "\nResult: (for verbose = true):\n"
-            "{                           (json object)\n"
-            "  \"transactionid\" : {       (json object)\n"
-            "    \"size\" : n,             (numeric) transaction size in bytes\n"
-            "    \"fee\" : n,              (numeric) transaction fee in lux\n"
-            "    \"time\" : n,             (numeric) local time transaction entered pool in seconds since 1 Jan 1970 GMT\n"
-            "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
-            "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
-            "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
-            "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
-            "        \"transactionid\",    (string) parent transaction id\n"
-            "       ... ]\n"
-            "  }, ...\n"
-            "]\n"
-            "\nExamples\n" +
-            HelpExampleCli("getrawmempool", "true") + HelpExampleRpc("getrawmempool", "true"));
-
-    LOCK(cs_main);
-
-    bool fVerbose = false;
-    if (params.size() > 0)
-        fVerbose = params[0].get_bool();
-
     if (fVerbose) {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry, mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+        BOOST_FOREACH (const CTxMemPoolEntry& e, mempool.mapTx) {
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -198,6 +163,12 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH (const CTxIn& txin, tx.vin) {
@@ -227,19 +198,64 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     }
 }
 
+UniValue getrawmempool(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getrawmempool ( verbose )\n"
+            "\nReturns all transaction ids in memory pool as a json array of string transaction ids.\n"
+            "\nArguments:\n"
+            "1. verbose           (boolean, optional, default=false) true for a json object, false for array of transaction ids\n"
+            "\nResult: (for verbose = false):\n"
+            "[                     (json array of string)\n"
+            "  \"transactionid\"     (string) The transaction id\n"
+            "  ,...\n"
+            "]\n"
+            "\nResult: (for verbose = true):\n"
+            "{                           (json object)\n"
+            "  \"transactionid\" : {       (json object)\n"
+            "    \"size\" : n,             (numeric) transaction size in bytes\n"
+            "    \"fee\" : n,              (numeric) transaction fee in lux\n"
+            "    \"time\" : n,             (numeric) local time transaction entered pool in seconds since 1 Jan 1970 GMT\n"
+            "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
+            "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
+            "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) modified fees (see above) of in-mempool descendants (including this one)\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees (see above) of in-mempool ancestors (including this one)\n"
+            "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
+            "        \"transactionid\",    (string) parent transaction id\n"
+            "       ... ]\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples\n" +
+            HelpExampleCli("getrawmempool", "true") + HelpExampleRpc("getrawmempool", "true"));
+
+    LOCK(cs_main);
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    return mempoolToJSON(fVerbose);
+}
+
 UniValue getblockhashes(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() < 2)
+    if (fHelp || params.size() < 2 || params.size() > 3)
         throw runtime_error(
-                "getblockhashes timestamp\n"
+                "getblockhashes high low ( options )\n"
                         "\nReturns array of hashes of blocks within the timestamp range provided.\n"
                         "\nArguments:\n"
                         "1. high         (numeric, required) The newer block timestamp\n"
                         "2. low          (numeric, required) The older block timestamp\n"
-                        "3. options      (string, required) A json object\n"
+                        "3. options      (string, optional) A json object\n"
                         "    {\n"
-                        "      \"noOrphans\":true   (boolean) will only include blocks on the main chain\n"
-                        "      \"logicalTimes\":true   (boolean) will include logical timestamps with hashes\n"
+                        "      \"noOrphans\":true   (boolean) accepted for compatibility, has no effect: only blocks on the main chain are returned\n"
+                        "      \"logicalTimes\":true   (boolean) will include logical timestamps with hashes (default: false)\n"
                         "    }\n"
                         "\nResult:\n"
                         "[\n"
@@ -248,7 +264,7 @@ UniValue getblockhashes(const UniValue& params, bool fHelp)
                         "[\n"
                         "  {\n"
                         "    \"blockhash\": (string) The block hash\n"
-                        "    \"logicalts\": (numeric) The logical timestamp\n"
+                        "    \"logicalts\": (numeric) The logical timestamp, the highest block time up to and including this block\n"
                         "  }\n"
                         "]\n"
                         "\nExamples:\n"
@@ -257,31 +273,66 @@ UniValue getblockhashes(const UniValue& params, bool fHelp)
                 + HelpExampleCli("getblockhashes", "1522073246 1521473246 '{\"noOrphans\":false, \"logicalTimes\":true}'")
         );
 
-    LOCK(cs_main);
+    int nHigh = params[0].get_int();
+    int nLow = params[1].get_int();
+    if (nHigh < 0 || nLow < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Timestamps must not be negative");
+    unsigned int high = nHigh;
+    unsigned int low = nLow;
+    bool fLogicalTS = false;
+    if (params.size() > 2) {
+        const UniValue& logicalTimes = find_value(params[2].get_obj(), "logicalTimes");
+        if (!logicalTimes.isNull())
+            fLogicalTS = logicalTimes.get_bool();
+    }
 
-    unsigned int high = params[0].get_int();
-    unsigned int low = params[1].get_int();
     UniValue a(UniValue::VARR);
-    int nHeight = chainActive.Height();
+    // Nothing lies strictly between low and high otherwise; this also keeps low + 1 from wrapping
+    if (low >= high)
+        return a;
 
-    for (int i = 0; i <= nHeight; i++) {
-        unsigned int blockTime = getBlockTimeByHeight(i);
-        if (blockTime > low && blockTime < high) {
-            CBlockIndex* pblockindex =chainActive[i];
-            a.push_back(pblockindex->GetBlockHash().GetHex());
+    std::vector<CBlockIndex*> vBlocks;
+    if (fTimestampIndex) {
+        // The index covers [low, high); the range of this call excludes low.
+        // The index is read without holding cs_main. Disconnected blocks are
+        // erased from it, the check only drops those disconnected meanwhile.
+        std::vector<uint256> blockHashes;
+        if (!GetTimestampIndex(high, low + 1, blockHashes))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information for block hashes");
+
+        LOCK(cs_main);
+        BOOST_FOREACH (const uint256& hash, blockHashes) {
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
+            if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+                vBlocks.push_back(mi->second);
+        }
+    } else {
+        // Only the blocks between the first one that could be after low and
+        // the last one that could be before high are looked at
+        LOCK(cs_main);
+        CBlockIndex* pindexFirst = chainActive.FindEarliestAtLeast((int64_t)low + 1);
+        CBlockIndex* pindexLast = chainActive.FindLatestBefore(high);
+        if (pindexFirst && pindexLast) {
+            for (int nHeight = pindexFirst->nHeight; nHeight <= pindexLast->nHeight; nHeight++) {
+                CBlockIndex* pindex = chainActive[nHeight];
+                if (pindex->nTime > low && pindex->nTime < high)
+                    vBlocks.push_back(pindex);
+            }
         }
     }
-    return a;
-}
 
-int getBlockTimeByHeight(int nHeight){
-    CBlock block;
-    CBlockIndex* pblockindex =chainActive[nHeight];
-    std::string strHash = pblockindex->GetBlockHash().GetHex();
-    uint256 hash(strHash);
-    CBlockIndex* pblockindex2 = mapBlockIndex[hash];
-        return pblockindex2->GetBlockTime();
+    BOOST_FOREACH (const CBlockIndex* pindex, vBlocks) {
+        if (fLogicalTS) {
+            UniValue item(UniValue::VOBJ);
+            item.push_back(Pair("blockhash", pindex->GetBlockHash().GetHex()));
+            item.push_back(Pair("logicalts", (int64_t)pindex->nTimeMax));
+            a.push_back(item);
+        } else {
+            a.push_back(pindex->GetBlockHash().GetHex());
+        }
     }
+    return a;
+}
 
 UniValue getblockhash(const UniValue& params, bool fHelp)
 {
@@ -575,7 +626,9 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"peak\": \"...\",          (string) the hash of the main chain top block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
-            "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"chainwork\": \"xxxx\",    (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"coinscacheusage\": xxxxx,   (numeric) memory used by the in-memory UTXO cache, in bytes\n"
+            "  \"maxcoinscache\": xxxxx      (numeric) memory usage at which the UTXO cache is flushed to disk, in bytes\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getblockchaininfo", "") + HelpExampleRpc("getblockchaininfo", ""));
@@ -590,6 +643,8 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("difficulty", (double)GetPoWDifficulty()));
     obj.push_back(Pair("verificationprogress", Checkpoints::GuessVerificationProgress(Params().Checkpoints(), chainActive.Tip())));
     obj.push_back(Pair("chainwork", chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("coinscacheusage", (int64_t)pcoinsTip->DynamicMemoryUsage()));
+    obj.push_back(Pair("maxcoinscache", (int64_t)nCoinCacheUsage));
     return obj;
 }
 
@@ -703,6 +758,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getmempoolinfo", "") + HelpExampleRpc("getmempoolinfo", ""));
@@ -712,6 +770,76 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("size", (int64_t)mempool.size()));
     ret.push_back(Pair("bytes", (int64_t)mempool.GetTotalTxSize()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("usage", (int64_t)mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("maxmempool", (int64_t)maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+
+    return ret;
+}
+
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns details on the state of the signature cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx             (numeric) Number of cached signatures\n"
+            "  \"capacity\": xxxxx            (numeric) Maximum number of cached signatures\n"
+            "  \"bytes\": xxxxx               (numeric) Memory used by the cache tables\n"
+            "  \"hits\": xxxxx                (numeric) Lookups that found a cached signature\n"
+            "  \"misses\": xxxxx              (numeric) Lookups that had to verify the signature\n"
+            "  \"inserts\": xxxxx             (numeric) Signatures added to the cache\n"
+            "  \"evictions\": xxxxx           (numeric) Signatures evicted to make room\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getsigcacheinfo", "") + HelpExampleRpc("getsigcacheinfo", ""));
+
+    CSignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", stats.nEntries));
+    ret.push_back(Pair("capacity", stats.nCapacity));
+    ret.push_back(Pair("bytes", stats.nBytes));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nMisses));
+    ret.push_back(Pair("inserts", stats.nInserts));
+    ret.push_back(Pair("evictions", stats.nEvictions));
+
+    return ret;
+}
+
+UniValue getblockfilecacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockfilecacheinfo\n"
+            "\nReturns details on the memory mapped block and undo files used to read blocks.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"files\": xxxxx               (numeric) Number of mapped files\n"
+            "  \"capacity\": xxxxx            (numeric) Maximum number of mapped files\n"
+            "  \"bytes\": xxxxx               (numeric) Total size of the mapped files\n"
+            "  \"hits\": xxxxx                (numeric) Reads served from an existing mapping\n"
+            "  \"misses\": xxxxx              (numeric) Reads that had to map a file\n"
+            "  \"evictions\": xxxxx           (numeric) Files unmapped to make room\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockfilecacheinfo", "") + HelpExampleRpc("getblockfilecacheinfo", ""));
+
+    CBlockFileCacheStats stats;
+    GetBlockFileCacheStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("files", stats.nFiles));
+    ret.push_back(Pair("capacity", stats.nCapacity));
+    ret.push_back(Pair("bytes", stats.nMappedBytes));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nMisses));
+    ret.push_back(Pair("evictions", stats.nEvictions));
 
     return ret;
 }
@@ -77,6 +77,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
         { "getblockhashes", 0 },
         { "getblockhashes", 1 },
         { "getblockhashes", 2 },
+        {"getaddressbalance", 0},
+        {"getaddresstxids", 0},
+        {"getaddressutxos", 0},
+        {"getspentinfo", 0},
         {"gettransaction", 1},
         {"getrawtransaction", 1},
         {"createrawtransaction", 0},
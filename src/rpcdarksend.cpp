@@ -126,9 +126,9 @@ UniValue masternode(const UniValue& params, bool fHelp)
 
     if (fHelp  ||
         (strCommand != "start" && strCommand != "start-alias" && strCommand != "start-many" && strCommand != "stop" && strCommand != "stop-alias" && strCommand != "stop-many" && strCommand != "list" && strCommand != "list-conf" && strCommand != "count"  && strCommand != "enforce"
-            && strCommand != "debug" && strCommand != "current" && strCommand != "winners" && strCommand != "genkey" && strCommand != "connect" && strCommand != "outputs"))
+            && strCommand != "debug" && strCommand != "current" && strCommand != "winners" && strCommand != "genkey" && strCommand != "connect" && strCommand != "outputs" && strCommand != "rankcache"))
         throw runtime_error(
-            "masternode <start|start-alias|start-many|stop|stop-alias|stop-many|list|list-conf|count|debug|current|winners|genkey|enforce|outputs> [passphrase]\n");
+            "masternode <start|start-alias|start-many|stop|stop-alias|stop-many|list|list-conf|count|debug|current|winners|genkey|enforce|outputs|rankcache> [passphrase]\n");
 
     if (strCommand == "stop")
     {
@@ -496,6 +496,16 @@ UniValue masternode(const UniValue& params, bool fHelp)
         return "unknown";
     }
 
+    if (strCommand == "rankcache")
+    {
+        LOCK(cs_masternodes);
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("tables", (uint64_t)masternodeRanks.GetTableCount()));
+        obj.push_back(Pair("hits", masternodeRanks.GetHits()));
+        obj.push_back(Pair("misses", masternodeRanks.GetMisses()));
+        return obj;
+    }
+
     if (strCommand == "genkey")
     {
         CKey secret;
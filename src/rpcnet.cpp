@@ -100,7 +100,9 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"blocksdownloaded\": n,     (numeric) The number of requested blocks received from this peer\n"
+            "    \"downloadrate\": n,         (numeric) The speed in bytes per second at which this peer sent us blocks\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -147,6 +149,8 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("blocksdownloaded", statestats.nBlocksDownloaded));
+            obj.push_back(Pair("downloadrate", statestats.nDownloadRate));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -5,86 +5,171 @@
 
 #include "sigcache.h"
 
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
+#include "serialize.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <atomic>
+
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 namespace {
 
-/**
- * Valid signature cache, to avoid doing expensive ECDSA signature checking
- * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
- */
-class CSignatureCache
+uint32_t ReadSlot(const uint256& entry, int n)
 {
-private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
-
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+    uint32_t x;
+    memcpy(&x, entry.begin() + 4 * n, 4);
+    return x;
+}
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+}
+
+const unsigned int CSignatureCache::SHARDS;
+const unsigned int CSignatureCache::PROBE;
+
+int64_t GetSignatureCacheBytes()
+{
+    // clamp before scaling, shifting a negative or huge value is undefined
+    int64_t nMaxCacheBytes;
+    if (mapArgs.count("-sigcachemaxmb") || !mapArgs.count("-maxsigcachesize")) {
+        int64_t nMaxCacheMiB = GetArg("-sigcachemaxmb", DEFAULT_MAX_SIG_CACHE_SIZE);
+        nMaxCacheBytes = std::min(std::max(nMaxCacheMiB, (int64_t)0), MAX_MAX_SIG_CACHE_SIZE) << 20;
+    } else {
+        // -maxsigcachesize used to be a number of entries, keep that meaning
+        int64_t nMaxEntries = GetArg("-maxsigcachesize", 0);
+        nMaxCacheBytes = std::min(std::max(nMaxEntries, (int64_t)0), (MAX_MAX_SIG_CACHE_SIZE << 20) / (int64_t)sizeof(uint256)) * (int64_t)sizeof(uint256);
+        LogPrintf("-maxsigcachesize is deprecated, use -sigcachemaxmb instead\n");
     }
+    return nMaxCacheBytes;
+}
+
+CSignatureCache::CSignatureCache(int64_t nMaxCacheBytes) : nHits(0), nMisses(0), nInserts(0), nEvictions(0)
+{
+    GetRandBytes(nonce, sizeof(nonce));
+
+    nMaxCacheBytes = std::min(std::max(nMaxCacheBytes, (int64_t)0), MAX_MAX_SIG_CACHE_SIZE << 20);
+    nSlotsPerShard = nMaxCacheBytes / (SHARDS * sizeof(uint256));
+    for (unsigned int i = 0; i < SHARDS; i++)
+        shards[i].vSlots.resize(nSlotsPerShard);
+}
+
+CSignatureCache::CShard& CSignatureCache::GetShard(const uint256& entry)
+{
+    return shards[ReadSlot(entry, 0) % SHARDS];
+}
+
+void CSignatureCache::ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+{
+    CSHA256().Write(nonce, sizeof(nonce)).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(begin_ptr(vchSig), vchSig.size()).Finalize(entry.begin());
+}
+
+bool CSignatureCache::Get(const uint256& entry)
+{
+    if (nSlotsPerShard == 0)
+        return false;
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CShard& shard = GetShard(entry);
+    size_t nSlot = ReadSlot(entry, 1) % nSlotsPerShard;
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+        boost::shared_lock<boost::shared_mutex> lock(shard.cs);
+        for (unsigned int i = 0; i < PROBE; i++) {
+            const uint256& slot = shard.vSlots[(nSlot + i) % nSlotsPerShard];
+            if (slot == entry) {
+                nHits++;
+                return true;
+            }
+            if (slot == 0)
+                break;
         }
+    }
+    nMisses++;
+    return false;
+}
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+void CSignatureCache::Set(const uint256& entry)
+{
+    if (nSlotsPerShard == 0)
+        return;
+
+    CShard& shard = GetShard(entry);
+    size_t nSlot = ReadSlot(entry, 1) % nSlotsPerShard;
+
+    boost::unique_lock<boost::shared_mutex> lock(shard.cs);
+    for (unsigned int i = 0; i < PROBE; i++) {
+        uint256& slot = shard.vSlots[(nSlot + i) % nSlotsPerShard];
+        if (slot == entry)
+            return;
+        if (slot == 0) {
+            slot = entry;
+            shard.nUsed++;
+            nInserts++;
+            return;
+        }
     }
-};
+
+    // Evict a random entry of the probed run. Random because that helps
+    // foil would-be DoS attackers who might try to pre-generate
+    // and re-use a set of valid signatures just-slightly-greater
+    // than our cache size.
+    shard.vSlots[(nSlot + ReadSlot(entry, 2) % PROBE) % nSlotsPerShard] = entry;
+    nInserts++;
+    nEvictions++;
+}
+
+void CSignatureCache::GetStats(CSignatureCacheStats& stats)
+{
+    stats.nEntries = 0;
+    for (unsigned int i = 0; i < SHARDS; i++) {
+        boost::shared_lock<boost::shared_mutex> lock(shards[i].cs);
+        stats.nEntries += shards[i].nUsed;
+    }
+    stats.nCapacity = nSlotsPerShard * SHARDS;
+    stats.nBytes = stats.nCapacity * sizeof(uint256);
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nInserts = nInserts;
+    stats.nEvictions = nEvictions;
+}
+
+namespace {
+
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache(GetSignatureCacheBytes());
+    return signatureCache;
+}
 
 }
 
+void InitSignatureCache()
+{
+    CSignatureCacheStats stats;
+    GetSignatureCache().GetStats(stats);
+    LogPrintf("Using %.1fMiB for the signature cache, %u entries\n", stats.nBytes * (1.0 / 1024 / 1024), stats.nCapacity);
+}
+
+void GetSignatureCacheStats(CSignatureCacheStats& stats)
+{
+    GetSignatureCache().GetStats(stats);
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
+
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    if (signatureCache.Get(entry))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
     return true;
 }
@@ -7,11 +7,81 @@
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <atomic>
 #include <vector>
 
+#include <boost/thread/shared_mutex.hpp>
+
+// DoS prevention: limit cache size to 10MB, about 330,000 entries of 32 bytes.
+// Since there are a maximum of 20,000 signature operations per block
+// this is plenty for a few blocks worth of mempool transactions.
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 10;
+// Maximum sig cache size allowed, in MiB
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 1024;
+
 class CPubKey;
 
+struct CSignatureCacheStats
+{
+    uint64_t nEntries;
+    uint64_t nCapacity;
+    uint64_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+};
+
+/**
+ * Valid signature cache, to avoid doing expensive ECDSA signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain)
+ *
+ * Entries are 32 byte salted digests of (signature hash, signature, public key),
+ * stored in open-addressed tables. The tables are split in shards with their own
+ * lock, so parallel script check threads rarely contend with each other.
+ */
+class CSignatureCache
+{
+public:
+    //! number of shards, each with its own lock
+    static const unsigned int SHARDS = 16;
+    //! slots probed for a digest before an entry gets evicted
+    static const unsigned int PROBE = 8;
+
+private:
+    struct CShard
+    {
+        boost::shared_mutex cs;
+        std::vector<uint256> vSlots;
+        size_t nUsed;
+
+        CShard() : nUsed(0) {}
+    };
+
+    //! per cache nonce, so the slot of an entry can't be predicted by an attacker
+    unsigned char nonce[32];
+    CShard shards[SHARDS];
+    size_t nSlotsPerShard;
+
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+    std::atomic<uint64_t> nInserts;
+    std::atomic<uint64_t> nEvictions;
+
+    CShard& GetShard(const uint256& entry);
+
+public:
+    explicit CSignatureCache(int64_t nMaxCacheBytes);
+
+    void ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+    bool Get(const uint256& entry);
+    void Set(const uint256& entry);
+    void GetStats(CSignatureCacheStats& stats);
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -23,4 +93,9 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Signature cache size in bytes from -sigcachemaxmb (or the deprecated -maxsigcachesize) */
+int64_t GetSignatureCacheBytes();
+void InitSignatureCache();
+void GetSignatureCacheStats(CSignatureCacheStats& stats);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
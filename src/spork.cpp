@@ -24,6 +24,7 @@ class CSporkManager;
 
 std::map<uint256, CSporkMessage> mapSporks;
 std::map<int, CSporkMessage> mapSporksActive;
+CCriticalSection cs_sporks;
 CSporkManager sporkManager;
 
 void ProcessSpork(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, bool &isSporkCommand)
@@ -36,28 +37,40 @@ void ProcessSpork(CNode* pfrom, const std::string& strCommand, CDataStream& vRec
         CSporkMessage spork;
         vRecv >> spork;
 
-        if (chainActive.Tip() == nullptr) return;
+        int nHeight;
+        {
+            LOCK(cs_main);
+            if (chainActive.Tip() == nullptr) return;
+            nHeight = chainActive.Tip()->nHeight;
+        }
 
         uint256 hash = spork.GetHash();
-        if(mapSporks.count(hash) && mapSporksActive.count(spork.nSporkID)) {
-            if(mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned){
-                if(fDebug) LogPrintf("spork - seen %s block %d \n", hash.ToString().c_str(), chainActive.Tip()->nHeight);
-                return;
-            } else {
-                if(fDebug) LogPrintf("spork - got updated spork %s block %d \n", hash.ToString().c_str(), chainActive.Tip()->nHeight);
+        {
+            LOCK(cs_sporks);
+            if(mapSporks.count(hash) && mapSporksActive.count(spork.nSporkID)) {
+                if(mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned){
+                    if(fDebug) LogPrintf("spork - seen %s block %d \n", hash.ToString().c_str(), nHeight);
+                    return;
+                } else {
+                    if(fDebug) LogPrintf("spork - got updated spork %s block %d \n", hash.ToString().c_str(), nHeight);
+                }
             }
         }
 
-        LogPrintf("spork - new %s ID %d Time %d bestHeight %d\n", hash.ToString().c_str(), spork.nSporkID, spork.nValue, chainActive.Tip()->nHeight);
+        LogPrintf("spork - new %s ID %d Time %d bestHeight %d\n", hash.ToString().c_str(), spork.nSporkID, spork.nValue, nHeight);
 
         if(!sporkManager.CheckSignature(spork)){
             LogPrintf("spork - invalid signature\n");
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             return;
         }
 
-        mapSporks[hash] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
+        {
+            LOCK(cs_sporks);
+            mapSporks[hash] = spork;
+            mapSporksActive[spork.nSporkID] = spork;
+        }
         sporkManager.Relay(spork);
 
         //does a task if needed
@@ -67,6 +80,7 @@ void ProcessSpork(CNode* pfrom, const std::string& strCommand, CDataStream& vRec
     else if (strCommand == "getsporks") {
         isSporkCommand = true;
 
+        LOCK(cs_sporks);
         std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin();
         while (it != mapSporksActive.end()) {
             pfrom->PushMessage("spork", it->second);
@@ -80,6 +94,7 @@ bool IsSporkActive(int nSporkID)
 {
     int64_t r = 0;
 
+    LOCK(cs_sporks);
     if(mapSporksActive.count(nSporkID)){
         r = mapSporksActive[nSporkID].nValue;
     } else {
@@ -99,6 +114,7 @@ int GetSporkValue(int nSporkID)
 {
     int r = 0;
 
+    LOCK(cs_sporks);
     if(mapSporksActive.count(nSporkID)){
         r = mapSporksActive[nSporkID].nValue;
     } else {
@@ -173,6 +189,7 @@ bool CSporkManager::UpdateSpork(int nSporkID, int64_t nValue)
 
     if(Sign(msg)){
         Relay(msg);
+        LOCK(cs_sporks);
         mapSporks[msg.GetHash()] = msg;
         mapSporksActive[nSporkID] = msg;
         return true;
@@ -46,6 +46,7 @@ using namespace boost;
 
 extern std::map<uint256, CSporkMessage> mapSporks;
 extern std::map<int, CSporkMessage> mapSporksActive;
+extern CCriticalSection cs_sporks; // guards mapSporks and mapSporksActive
 extern CSporkManager sporkManager;
 
 void ProcessSpork(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, bool &isSporkCommand);
@@ -16,6 +16,8 @@
 #include "script/sign.h"
 #include "script/interpreter.h"
 #include "timedata.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include <boost/thread.hpp>
 #include <atomic>
 #if defined(DEBUG_DUMP_STAKING_INFO)
@@ -47,6 +49,9 @@ static const bool ENABLE_ADVANCED_STAKING = true;
 
 static const int ADVANCED_STAKING_HEIGHT = 225000;
 
+// MAX_KERNEL_SEARCH_INTERVAL: how far back CreateCoinStake tries timestamps
+static const unsigned int MAX_KERNEL_SEARCH_INTERVAL = 60;
+
 static std::atomic<bool> nStakingInterrupped;
 
 Stake * const stake = Stake::Pointer();
@@ -56,6 +61,148 @@ StakeKernel::StakeKernel()
     //!<DuzyDoc>TODO: kernel initialization
 }
 
+bool MultiplyStakeTarget(uint256 &bnTarget, int nModifierHeight, int64_t nModifierTime, int64_t nWeight);
+
+void KernelSearch::Clear()
+{
+    nBits = 0;
+    mapIndex.clear();
+    vPrevout.clear();
+    vBlockFrom.clear();
+    vData.clear();
+    vSize.clear();
+    vValue.clear();
+    vTarget.clear();
+    vTargetTop.clear();
+    vMinTime.clear();
+}
+
+void KernelSearch::Add(const COutPoint& prevout, const CBlockIndex* pindexFrom, const std::vector<unsigned char>& vKernel, int64_t nValue, unsigned int nMinTime)
+{
+    assert(vKernel.size() > TIME_OFFSET + 4 && vKernel.size() <= STRIDE);
+    assert(!Has(prevout));
+    mapIndex[prevout] = vPrevout.size();
+    vPrevout.push_back(prevout);
+    vBlockFrom.push_back(pindexFrom);
+    vData.resize(vData.size() + STRIDE);
+    std::copy(vKernel.begin(), vKernel.end(), vData.end() - STRIDE);
+    vSize.push_back(vKernel.size());
+    vValue.push_back(nValue);
+    vTarget.push_back(0);
+    vTargetTop.push_back(0);
+    vMinTime.push_back(nMinTime);
+    UpdateTarget(vPrevout.size() - 1);
+}
+
+void KernelSearch::Remove(const COutPoint& prevout)
+{
+    std::map<COutPoint, size_t>::iterator it = mapIndex.find(prevout);
+    if (it == mapIndex.end())
+        return;
+
+    // Move the last slot into the hole
+    const size_t i = it->second, last = vPrevout.size() - 1;
+    mapIndex.erase(it);
+    if (i != last) {
+        mapIndex[vPrevout[last]] = i;
+        vPrevout[i] = vPrevout[last];
+        vBlockFrom[i] = vBlockFrom[last];
+        std::copy(vData.begin() + last * STRIDE, vData.end(), vData.begin() + i * STRIDE);
+        vSize[i] = vSize[last];
+        vValue[i] = vValue[last];
+        vTarget[i] = vTarget[last];
+        vTargetTop[i] = vTargetTop[last];
+        vMinTime[i] = vMinTime[last];
+    }
+    vPrevout.pop_back();
+    vBlockFrom.pop_back();
+    vData.resize(last * STRIDE);
+    vSize.pop_back();
+    vValue.pop_back();
+    vTarget.pop_back();
+    vTargetTop.pop_back();
+    vMinTime.pop_back();
+}
+
+void KernelSearch::SetBits(unsigned int nBitsIn)
+{
+    nBits = nBitsIn;
+    for (size_t i = 0; i < vPrevout.size(); i++)
+        UpdateTarget(i);
+}
+
+void KernelSearch::UpdateTarget(size_t i)
+{
+    // Weighted target
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits);
+    bnTarget *= uint256(vValue[i]);
+
+    const CBlockIndex* pindexPrev = vBlockFrom[i]->pprev;
+    if (Params().NetworkID() == CBaseChainParams::MAIN && pindexPrev->nHeight < 174453 && pindexPrev->nHeight <= LAST_MULTIPLIED_BLOCK) {
+        // CheckHash also accepts a hash below the multiplied target
+        uint256 bnMultiplied = bnTarget;
+        if (MultiplyStakeTarget(bnMultiplied, pindexPrev->nHeight, pindexPrev->nTime, vValue[i]) && bnMultiplied > bnTarget)
+            bnTarget = bnMultiplied;
+    }
+    vTarget[i] = bnTarget;
+    vTargetTop[i] = (bnTarget >> 192).GetLow64();
+}
+
+int KernelSearch::Find(unsigned int nTimeFrom, unsigned int nTimeTo, unsigned int& nTimeTx, uint256& hashProofOfStake, uint64_t& nHashed)
+{
+    // Kernels are only hashed together with kernels of the same length
+    std::map<unsigned int, std::vector<size_t> > mapBySize;
+    for (size_t i = 0; i < vSize.size(); i++)
+        mapBySize[vSize[i]].push_back(i);
+
+    std::vector<size_t> vIndex;
+    std::vector<const unsigned char*> vIn;
+    std::vector<unsigned char> vOut;
+    for (int64_t nTime = nTimeTo; nTime >= (int64_t)nTimeFrom; nTime--) {
+        int nFound = -1;
+        for (std::map<unsigned int, std::vector<size_t> >::const_iterator it = mapBySize.begin(); it != mapBySize.end(); ++it) {
+            vIndex.clear();
+            vIn.clear();
+            BOOST_FOREACH (size_t i, it->second) {
+                if (vMinTime[i] > nTime)
+                    continue;
+                unsigned char* pkernel = &vData[i * STRIDE];
+                WriteLE32(pkernel + TIME_OFFSET, nTime);
+                vIndex.push_back(i);
+                vIn.push_back(pkernel);
+            }
+            if (vIn.empty())
+                continue;
+            vOut.resize(vIn.size() * CSHA256::OUTPUT_SIZE);
+            SHA256DxN(&vOut[0], &vIn[0], it->first, vIn.size());
+            nHashed += vIn.size();
+
+            for (size_t n = 0; n < vIndex.size(); n++) {
+                const size_t i = vIndex[n];
+                if (nFound >= 0 && (size_t)nFound < i)
+                    break;
+                const unsigned char* phash = &vOut[n * CSHA256::OUTPUT_SIZE];
+                // Most kernels already miss on the top 64 bits
+                if (ReadLE64(phash + 24) > vTargetTop[i])
+                    continue;
+                uint256 hash;
+                memcpy(hash.begin(), phash, CSHA256::OUTPUT_SIZE);
+                if (hash > vTarget[i])
+                    continue;
+                nFound = i;
+                hashProofOfStake = hash;
+                break;
+            }
+        }
+        if (nFound >= 0) {
+            nTimeTx = nTime;
+            return nFound;
+        }
+    }
+    return -1;
+}
+
 Stake::Stake()
     : StakeKernel()
     , nStakeInterval(0)
@@ -66,6 +213,7 @@ Stake::Stake()
     , nStakeMinAge(0)
     , nHashInterval(0)
     , nReserveBalance(0)
+    , dKernelsPerSec(0)
     , mapStakes()
     , mapHashedBlocks()
     , mapProofOfStake()
@@ -359,6 +507,30 @@ bool MultiplyStakeTarget(uint256 &bnTarget, int nModifierHeight, int64_t nModifi
     return false;
 }
 
+void Stake::CheckParams()
+{
+    if (nHashInterval < Params().StakingInterval()) {
+        nHashInterval = Params().StakingInterval();
+    }
+    if (nSelectionPeriod < Params().StakingRoundPeriod()) {
+        nSelectionPeriod = Params().StakingRoundPeriod();
+    }
+    if (nStakeMinAge < Params().StakingMinAge()) {
+        nStakeMinAge = Params().StakingMinAge();
+    }
+}
+
+std::vector<unsigned char> Stake::KernelData(uint64_t nStakeModifier, int nStakeModifierHeight, int64_t nStakeModifierTime, unsigned int nTimeBlockFrom, unsigned int nTimeTxPrev, const COutPoint &prevout, unsigned int nTimeTx, const uint256 &bnWeight) const
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nStakeModifier << nTimeBlockFrom << nTimeTxPrev << prevout.hash << prevout.n << nTimeTx ;
+    if (ENABLE_ADVANCED_STAKING && (mapArgs.count("-regtest") || nStakeModifierHeight >= ADVANCED_STAKING_HEIGHT)) {
+        ss << nHashInterval << nSelectionPeriod << nStakeMinAge << nStakeSplitThreshold
+           << bnWeight << nStakeModifierTime ;
+    }
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
 //instead of looping outside and reinitializing variables many times, we will give a nTimeTx and also search interval so that we can do all the hashing here
 bool Stake::CheckHash(const CBlockIndex* pindexPrev, unsigned int nBits, const CBlock &blockFrom, const CTransaction &txPrev, const COutPoint &prevout, unsigned int& nTimeTx, uint256& hashProofOfStake)
 {
@@ -371,15 +543,7 @@ bool Stake::CheckHash(const CBlockIndex* pindexPrev, unsigned int nBits, const C
     if (GetStakeAge(nTimeBlockFrom) > nTimeTx) // Min age requirement
         return false; //error("%s: min age violation (nBlockTime=%d, nTimeTx=%d)", __func__, nTimeBlockFrom, nTimeTx);
 
-    if (nHashInterval < Params().StakingInterval()) {
-        nHashInterval = Params().StakingInterval();
-    }
-    if (nSelectionPeriod < Params().StakingRoundPeriod()) {
-        nSelectionPeriod = Params().StakingRoundPeriod();
-    }
-    if (nStakeMinAge < Params().StakingMinAge()) {
-        nStakeMinAge = Params().StakingMinAge();
-    }
+    CheckParams();
 
     // Base target
     uint256 bnTarget;
@@ -395,13 +559,8 @@ bool Stake::CheckHash(const CBlockIndex* pindexPrev, unsigned int nBits, const C
     int64_t nStakeModifierTime = pindexPrev->nTime;
 
     // Calculate hash
-    CDataStream ss(SER_GETHASH, 0);
-    ss << nStakeModifier << nTimeBlockFrom << txPrev.nTime << prevout.hash << prevout.n << nTimeTx ;
-    if (ENABLE_ADVANCED_STAKING && (mapArgs.count("-regtest") || nStakeModifierHeight >= ADVANCED_STAKING_HEIGHT)) {
-        ss << nHashInterval << nSelectionPeriod << nStakeMinAge << nStakeSplitThreshold
-           << bnWeight << nStakeModifierTime ;
-    }
-    hashProofOfStake = Hash(ss.begin(), ss.end());
+    std::vector<unsigned char> vKernel = KernelData(nStakeModifier, nStakeModifierHeight, nStakeModifierTime, nTimeBlockFrom, txPrev.nTime, prevout, nTimeTx, bnWeight);
+    hashProofOfStake = Hash(vKernel.begin(), vKernel.end());
 
     if (fDebug) {
 #       if 0
@@ -518,6 +677,24 @@ bool Stake::CheckModifierCheckpoints(int nHeight, unsigned int nStakeModifierChe
     return true;
 }
 
+void Stake::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    LOCK(cs_kernels);
+    if (kernels.size() == 0)
+        return;
+    BOOST_FOREACH (const CTxIn& txin, tx.vin)
+        kernels.Remove(txin.prevout);
+    // A transaction synced again moved to another block (or out of one)
+    const uint256 hash = tx.GetHash();
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+        kernels.Remove(COutPoint(hash, i));
+}
+
+double Stake::GetKernelSearchRate() const
+{
+    return dKernelsPerSec;
+}
+
 unsigned int Stake::GetStakeAge(unsigned int nTime) const
 {
     if (nStakeMinAge < Params().StakingMinAge()) {
@@ -713,83 +890,118 @@ bool Stake::CreateCoinStake(CWallet *wallet, const CKeyStore& keystore, unsigned
         MilliSleep(10000);
 
     const CBlockIndex* pIndex0 = chainActive.Tip();
-    BOOST_FOREACH (PAIRTYPE(const CWalletTx*, unsigned int) pcoin, stakeCoins) {
-        //make sure that enough time has elapsed between
-        CBlockIndex* pindex = NULL;
-        BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
-        if (it != mapBlockIndex.end()) {
-            pindex = it->second;
-        } else {
-            if (fDebug)
-                LogPrintf("%s: failed to find block index \n", __func__);
-            continue;
-        }
 
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
-
-        bool fKernelFound = false;
-        uint256 hashProofOfStake = 0;
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
+    uint256 hashProofOfStake = 0;
+    uint64_t nHashed = 0;
+    int64_t nSearchStart = GetTimeMicros();
+    const CWalletTx* pkernelTx = NULL;
+    unsigned int nKernelOut = 0;
+    {
+        LOCK(cs_kernels);
+        CheckParams();
+
+        // A new tip may have disconnected the blocks some kernels were staked from
+        if (hashKernelTip != pIndex0->GetBlockHash()) {
+            for (size_t i = kernels.size(); i-- > 0;)
+                if (!chainActive.Contains(kernels.GetBlockFrom(i)))
+                    kernels.Remove(kernels.GetPrevout(i));
+            hashKernelTip = pIndex0->GetBlockHash();
+        }
 
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (CheckHash(pindex->pprev, nBits, block, *pcoin.first, prevoutStake, nTxNewTime, hashProofOfStake)) {
-            //Double check that this will pass time requirements
-            if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
-                LogPrintf("%s: stake found, but it is too far in the past \n", __func__);
+        // Follow the selected coins: drop the ones that left the selection and
+        // serialize the kernels of new ones. Only nTimeTx changes between the
+        // timestamps and rounds tried below.
+        map<COutPoint, pair<const CWalletTx*, unsigned int> > mapSelected;
+        BOOST_FOREACH (PAIRTYPE(const CWalletTx*, unsigned int) pcoin, stakeCoins)
+            mapSelected[COutPoint(pcoin.first->GetHash(), pcoin.second)] = pcoin;
+        for (size_t i = kernels.size(); i-- > 0;)
+            if (!mapSelected.count(kernels.GetPrevout(i)))
+                kernels.Remove(kernels.GetPrevout(i));
+        if (kernels.GetBits() != nBits)
+            kernels.SetBits(nBits);
+
+        for (map<COutPoint, pair<const CWalletTx*, unsigned int> >::const_iterator mi = mapSelected.begin(); mi != mapSelected.end(); ++mi) {
+            if (kernels.Has(mi->first))
+                continue;
+            const CWalletTx* pcoin = mi->second.first;
+            //make sure that enough time has elapsed between
+            BlockMap::iterator it = mapBlockIndex.find(pcoin->hashBlock);
+            if (it == mapBlockIndex.end() || !chainActive.Contains(it->second)) {
+                if (fDebug)
+                    LogPrintf("%s: failed to find block index \n", __func__);
                 continue;
             }
 
-            vector<valtype> vSolutions;
-            txnouttype whichType;
-            CScript scriptPubKeyOut;
-            scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-            if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
-                LogPrintf("%s: failed to parse kernel\n", __func__);
-                break;
-            }
+            const CBlockIndex* pindex = it->second;
+            const CBlockIndex* pindexPrev = pindex->pprev;
+            unsigned int nTimeBlockFrom = pindex->GetBlockTime();
+            int64_t nValueIn = pcoin->vout[mi->first.n].nValue;
+            kernels.Add(mi->first, pindex, KernelData(pindexPrev->nStakeModifier, pindexPrev->nHeight, pindexPrev->nTime, nTimeBlockFrom, pcoin->nTime, mi->first, 0, uint256(nValueIn)),
+                        nValueIn, std::max((unsigned int)pcoin->nTime, GetStakeAge(nTimeBlockFrom)));
+        }
 
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("%s: parsed kernel type=%d\n", __func__, whichType);
+        // Try every second since the last search, newest first, but never a time
+        // that would not be accepted after the current tip.
+        unsigned int nTimeTo = GetAdjustedTime();
+        int64_t nTimeFrom = std::max(pIndex0->GetMedianTimePast(), pIndex0->GetBlockTime()) + 1;
+        nTimeFrom = std::max(nTimeFrom, (int64_t)nTimeTo - std::min(std::max(nSearchInterval, (int64_t)1), (int64_t)MAX_KERNEL_SEARCH_INTERVAL) + 1);
+
+        int nKernel = nTimeFrom <= nTimeTo ? kernels.Find(nTimeFrom, nTimeTo, nTxNewTime, hashProofOfStake, nHashed) : -1;
+        if (nKernel >= 0) {
+            const pair<const CWalletTx*, unsigned int>& pcoin = mapSelected[kernels.GetPrevout(nKernel)];
+            pkernelTx = pcoin.first;
+            nKernelOut = pcoin.second;
+        }
+    }
+    if (nHashed > 0)
+        dKernelsPerSec = 1000000.0 * nHashed / std::max(GetTimeMicros() - nSearchStart, (int64_t)1);
+
+    if (pkernelTx) {
+        const pair<const CWalletTx*, unsigned int> pcoin(pkernelTx, nKernelOut);
+
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        CScript scriptPubKeyOut;
+        scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
+        if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
+            LogPrintf("%s: failed to parse kernel\n", __func__);
+            return false;
+        }
 
-            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
-                if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("%s: no support for kernel type=%d\n", __func__, whichType);
-                break; // only support pay to public key and pay to address
-            } else if (whichType == TX_PUBKEYHASH) { // pay to address type
-                //convert to pay to public key type
-                CKey key;
-                if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("%s: failed to get key for kernel type=%d\n", __func__, whichType);
-                    break; // unable to find corresponding public key
-                }
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("%s: parsed kernel type=%d\n", __func__, whichType);
 
-                scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-            } else {
-                scriptPubKeyOut = scriptPubKeyKernel;
+        if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
+            if (fDebug && GetBoolArg("-printcoinstake", false))
+                LogPrintf("%s: no support for kernel type=%d\n", __func__, whichType);
+            return false; // only support pay to public key and pay to address
+        } else if (whichType == TX_PUBKEYHASH) { // pay to address type
+            //convert to pay to public key type
+            CKey key;
+            if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
+                if (fDebug && GetBoolArg("-printcoinstake", false))
+                    LogPrintf("%s: failed to get key for kernel type=%d\n", __func__, whichType);
+                return false; // unable to find corresponding public key
             }
 
-            auto nValueIn = pcoin.first->vout[pcoin.second].nValue;
-            txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-            bnCentSecond += uint256(nValueIn) * (nTxNewTime - pIndex0->nTime);
-            nCredit += nValueIn;
-            vCoins.push_back(pcoin.first);
-            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+            scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+        } else {
+            scriptPubKeyOut = scriptPubKeyKernel;
+        }
 
-            //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
-            const CBlockIndex* pIndex0 = chainActive.Tip();
-            uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + GetProofOfWorkReward(0, pIndex0->nHeight);
+        auto nValueIn = pcoin.first->vout[pcoin.second].nValue;
+        txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
+        bnCentSecond += uint256(nValueIn) * (nTxNewTime - pIndex0->nTime);
+        nCredit += nValueIn;
+        vCoins.push_back(pcoin.first);
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
 
-            //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
-            if (nTotalSize / 2 > GetStakeCombineThreshold() * COIN)
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+        //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
+        uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + GetProofOfWorkReward(0, pIndex0->nHeight);
 
-            fKernelFound = true;
-            break;
-        }
-        if (fKernelFound) break; // if kernel is found stop searching
+        //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
+        if (nTotalSize / 2 > GetStakeCombineThreshold() * COIN)
+            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
     }
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance) {
         return false;
@@ -1032,6 +1244,21 @@ void Stake::StakingThread(CWallet *wallet)
     LogPrintf("%s: done!\n", __func__);
 }
 
+namespace
+{
+//! Forwards wallet transaction updates to the staking kernel context.
+class StakeValidationInterface : public CValidationInterface
+{
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+    {
+        stake->SyncTransaction(tx, pblock);
+    }
+};
+
+StakeValidationInterface stakeValidationInterface;
+}
+
 void Stake::GenerateStakes(boost::thread_group &group, CWallet *wallet, int procs)
 {
 #if 0
@@ -1048,6 +1275,11 @@ void Stake::GenerateStakes(boost::thread_group &group, CWallet *wallet, int proc
         StakingThreads->create_thread(boost::bind(&Stake::StakingThread, this, wallet));
     }
 #else
+    static bool fRegistered = false;
+    if (!fRegistered) {
+        RegisterValidationInterface(&stakeValidationInterface);
+        fRegistered = true;
+    }
     nStakingInterrupped = procs == 0;
     for (int i = 0; i < procs; ++i) {
         group.create_thread(boost::bind(&Stake::StakingThread, this, wallet));
@@ -6,8 +6,11 @@
 
 #include "uint256.h"
 #include "amount.h"
+#include "primitives/transaction.h"
+#include "sync.h"
 #include <map>
 #include <set>
+#include <vector>
 
 //!<DuzyDoc>: Class Declarations
 class CBlock;
@@ -22,6 +25,57 @@ class CWalletTx;
 
 namespace boost { class thread_group; }
 
+//!<DuzyDoc>: KernelSearch - stakeable outpoints and their serialized kernels, kept as
+//!<DuzyDoc>:       parallel arrays (one slot per coin) so that many coins and
+//!<DuzyDoc>:       timestamps are hashed per batch. The slots persist across staking
+//!<DuzyDoc>:       rounds; only the weighted targets follow nBits.
+class KernelSearch
+{
+public:
+    //!<DuzyDoc>: Offset of nTimeTx within a serialized kernel.
+    static const unsigned int TIME_OFFSET = 52;
+    //!<DuzyDoc>: Room reserved per kernel; fits the advanced staking layout.
+    static const unsigned int STRIDE = 128;
+
+    KernelSearch() : nBits(0) {}
+
+    void Clear();
+    bool Has(const COutPoint& prevout) const { return mapIndex.count(prevout) != 0; }
+
+    //!<DuzyDoc>: KernelSearch::Add - add a coin staked from the block pindexFrom with its
+    //!<DuzyDoc>:       serialized kernel (nTimeTx is patched per candidate time) and the
+    //!<DuzyDoc>:       earliest nTimeTx it allows.
+    void Add(const COutPoint& prevout, const CBlockIndex* pindexFrom, const std::vector<unsigned char>& vKernel, int64_t nValue, unsigned int nMinTime);
+    void Remove(const COutPoint& prevout);
+
+    //!<DuzyDoc>: KernelSearch::SetBits - recompute the weighted targets for a new difficulty.
+    void SetBits(unsigned int nBitsIn);
+    unsigned int GetBits() const { return nBits; }
+
+    //!<DuzyDoc>: KernelSearch::Find - scan nTimeTo down to nTimeFrom and return the first
+    //!<DuzyDoc>:       kernel meeting its target at the latest possible time, or -1.
+    int Find(unsigned int nTimeFrom, unsigned int nTimeTo, unsigned int& nTimeTx, uint256& hashProofOfStake, uint64_t& nHashed);
+
+    size_t size() const { return vPrevout.size(); }
+    const COutPoint& GetPrevout(size_t i) const { return vPrevout[i]; }
+    const CBlockIndex* GetBlockFrom(size_t i) const { return vBlockFrom[i]; }
+
+private:
+    unsigned int nBits;
+    std::map<COutPoint, size_t> mapIndex;
+
+    std::vector<COutPoint> vPrevout;
+    std::vector<const CBlockIndex*> vBlockFrom;
+    std::vector<unsigned char> vData;
+    std::vector<unsigned int> vSize;
+    std::vector<int64_t> vValue;
+    std::vector<uint256> vTarget;
+    std::vector<uint64_t> vTargetTop;
+    std::vector<unsigned int> vMinTime;
+
+    void UpdateTarget(size_t i);
+};
+
 struct StakeKernel //!<DuzyDoc>TODO: private
 {
     //!<DuzyDoc>TODO: fields
@@ -51,6 +105,13 @@ class Stake : StakeKernel
     unsigned int nHashInterval;
 
     CAmount nReserveBalance;
+
+    double dKernelsPerSec;
+
+    //!<DuzyDoc>: Kernel context reused by staking rounds until the tip or the wallet changes.
+    CCriticalSection cs_kernels;
+    KernelSearch kernels;
+    uint256 hashKernelTip;
     
     std::map<COutPoint, unsigned int> mapStakes;
     std::map<unsigned int, unsigned int> mapHashedBlocks;
@@ -59,6 +120,8 @@ class Stake : StakeKernel
 
 private:
 
+    void CheckParams();
+    std::vector<unsigned char> KernelData(uint64_t nStakeModifier, int nStakeModifierHeight, int64_t nStakeModifierTime, unsigned int nTimeBlockFrom, unsigned int nTimeTxPrev, const COutPoint &prevout, unsigned int nTimeTx, const uint256 &bnWeight) const;
     bool SelectStakeCoins(CWallet *wallet, std::set<std::pair<const CWalletTx*, unsigned int> >& stakecoins, const int64_t targetAmount);
     bool CreateCoinStake(CWallet *wallet, const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew, unsigned int& nTxNewTime);
 
@@ -120,6 +183,13 @@ public:
     
     unsigned int GetStakeAge(unsigned int nTime) const;
 
+    //!<DuzyDoc>: Stake::SyncTransaction - drop cached kernels for outpoints a wallet
+    //!<DuzyDoc>:       transaction spends or (re)creates.
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
+    //!<DuzyDoc>: Stake::GetKernelSearchRate - kernels hashed per second by the last search.
+    double GetKernelSearchRate() const;
+
     //!<DuzyDoc>: Stake::CreateBlockStake - create a new stake.
     bool CreateBlockStake(CWallet *wallet, CBlock *block);
 
@@ -4,6 +4,7 @@
 
 #include "coins.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
 
 #include <vector>
@@ -58,6 +59,36 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += memusage::DynamicUsage(it->second.coins.vout);
+            BOOST_FOREACH (const CTxOut& out, it->second.coins.vout) {
+                const std::vector<unsigned char>* script = &out.scriptPubKey;
+                ret += memusage::DynamicUsage(*script);
+            }
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
+
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true, true) {}
+
+    //! Store coins the way versions before the per-output layout did
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins) { db.Write(std::make_pair('c', txid), coins); }
+    bool HaveLegacyCoins(const uint256& txid) const { return db.Exists(std::make_pair('c', txid)); }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -89,8 +120,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -115,6 +146,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 coins.nVersion = insecure_rand();
                 coins.vout.resize(1);
                 coins.vout[0].nValue = insecure_rand();
+                coins.vout[0].scriptPubKey.assign(insecure_rand() & 0x3F, 0);
                 *entry = coins;
             } else {
                 coins.Clear();
@@ -135,6 +167,9 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            BOOST_FOREACH (const CCoinsViewCacheTest* test, stack) {
+                test->SelfTest();
+            }
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +186,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -175,4 +210,147 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+// Coins added with AddFetchedCoins are served from the cache, but don't
+// replace entries already cached.
+BOOST_AUTO_TEST_CASE(coins_cache_add_fetched_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+    uint256 txid = GetRandHash();
+
+    CCoins coins;
+    coins.vout.resize(1);
+    coins.vout[0].nValue = 42;
+    BOOST_CHECK(!cache.HaveCoinsInCache(txid));
+    cache.AddFetchedCoins(txid, coins);
+    BOOST_CHECK(cache.HaveCoinsInCache(txid));
+    BOOST_CHECK(cache.HaveCoins(txid));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid)->vout[0].nValue, 42);
+
+    CCoins other;
+    other.vout.resize(1);
+    other.vout[0].nValue = 43;
+    cache.AddFetchedCoins(txid, other);
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid)->vout[0].nValue, 42);
+}
+
+// The memory usage of the cache follows its entries as they are added,
+// grown, spent and flushed.
+BOOST_AUTO_TEST_CASE(coins_cache_memusage_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    uint256 txid = GetRandHash();
+
+    size_t nEmptyUsage = cache.DynamicMemoryUsage();
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txid);
+        coins->vout.resize(2);
+        coins->vout[0].nValue = 42;
+        coins->vout[1].nValue = 43;
+        coins->vout[1].scriptPubKey.assign(1000, 0);
+    }
+    cache.SelfTest();
+    size_t nUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > nEmptyUsage + 1000);
+
+    // Spending the output with the large script releases it
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txid);
+        coins->Spend(1);
+    }
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() < nUsage - 1000);
+
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    cache.SelfTest();
+}
+
+// The coin database keeps one record per output: spending outputs erases
+// their records and the transaction is gone once all are spent.
+BOOST_AUTO_TEST_CASE(coins_db_per_output_test)
+{
+    CCoinsViewDBTest db;
+    CCoinsViewCache cache(&db);
+    uint256 txid = GetRandHash();
+    uint256 txidOther = GetRandHash();
+
+    CCoins expected;
+    expected.nVersion = 1;
+    expected.nHeight = 100;
+    expected.fCoinStake = true;
+    expected.vout.resize(3);
+    for (unsigned int n = 0; n < expected.vout.size(); n++) {
+        expected.vout[n].nValue = 1000 * (n + 1);
+        expected.vout[n].scriptPubKey.assign(20 + n, n);
+    }
+    *cache.ModifyCoins(txid) = expected;
+    cache.ModifyCoins(txidOther)->vout.assign(1, expected.vout[0]);
+    BOOST_CHECK(cache.Flush());
+
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == expected);
+
+    CTxOut outSpent = expected.vout[1];
+    cache.ModifyCoins(txid)->Spend(1);
+    expected.Spend(1);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == expected);
+    BOOST_CHECK(!coins.IsAvailable(1));
+
+    // Disconnecting the spending block puts the output back
+    cache.ModifyCoins(txid)->vout[1] = outSpent;
+    expected.vout[1] = outSpent;
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins.IsAvailable(1));
+    BOOST_CHECK(coins == expected);
+
+    cache.ModifyCoins(txid)->Spend(1);
+    expected.Spend(1);
+    cache.ModifyCoins(txid)->Spend(2);
+    expected.Spend(2);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == expected);
+    BOOST_CHECK_EQUAL(coins.vout.size(), 1U);
+
+    cache.ModifyCoins(txid)->Spend(0);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK(!db.GetCoins(txid, coins));
+    BOOST_CHECK(db.HaveCoins(txidOther));
+    BOOST_CHECK(!db.HaveCoins(GetRandHash()));
+}
+
+// Per-transaction records of older versions are converted by Upgrade.
+BOOST_AUTO_TEST_CASE(coins_db_upgrade_test)
+{
+    CCoinsViewDBTest db;
+    uint256 txid = GetRandHash();
+
+    CCoins legacy;
+    legacy.nVersion = 1;
+    legacy.nHeight = 200;
+    legacy.fCoinBase = true;
+    legacy.vout.resize(2);
+    legacy.vout[1].nValue = 42;
+    legacy.vout[1].scriptPubKey.assign(25, 1);
+    db.WriteLegacyCoins(txid, legacy);
+    BOOST_CHECK(!db.HaveCoins(txid));
+
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(!db.HaveLegacyCoins(txid));
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == legacy);
+    BOOST_CHECK(!coins.IsAvailable(0));
+
+    // Nothing left to convert
+    BOOST_CHECK(db.Upgrade());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -282,4 +282,31 @@ BOOST_AUTO_TEST_CASE(rfc6979_hmac_sha256)
             ("7597887cbd76321f32e30440679a22cf7f8d9d2eac390e581fea091ce202ba94"));
 }
 
+BOOST_AUTO_TEST_CASE(sha256d_lanes)
+{
+    // The batched engine must agree with two chained CSHA256 passes for every
+    // lane, including partially filled passes and lengths around block edges.
+    const size_t lens[] = {0, 1, 55, 56, 63, 64, 65, 80, 119, 120, 200};
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        const size_t len = lens[l];
+        for (size_t count = 1; count <= 17; count++) {
+            std::vector<std::vector<unsigned char> > msgs(count, std::vector<unsigned char>(len + 1));
+            std::vector<const unsigned char*> in(count);
+            for (size_t i = 0; i < count; i++) {
+                for (size_t j = 0; j < len; j++)
+                    msgs[i][j] = (unsigned char)(i * 31 + j * 7 + len);
+                in[i] = &msgs[i][0];
+            }
+            std::vector<unsigned char> out(CSHA256::OUTPUT_SIZE * count);
+            SHA256DxN(&out[0], &in[0], len, count);
+            for (size_t i = 0; i < count; i++) {
+                unsigned char first[CSHA256::OUTPUT_SIZE], expected[CSHA256::OUTPUT_SIZE];
+                CSHA256().Write(&msgs[i][0], len).Finalize(first);
+                CSHA256().Write(first, sizeof(first)).Finalize(expected);
+                BOOST_CHECK(memcmp(&out[CSHA256::OUTPUT_SIZE * i], expected, CSHA256::OUTPUT_SIZE) == 0);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,12 +2,18 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/phi1612.h"
 #include "hash.h"
+#include "primitives/block.h"
+#include "streams.h"
 #include "utilstrencodings.h"
+#include "version.h"
 
 #include <vector>
 
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
@@ -46,4 +52,122 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(phi1612_lanes)
+{
+    // Every lane of the batched engine must agree with the portable chain,
+    // including partially filled passes and messages spanning several blocks.
+    const size_t lens[] = {0, 1, 63, 64, 65, 80, 127, 128, 200};
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        const size_t len = lens[l];
+        for (size_t count = 1; count <= 2 * PHI1612_MAX_LANES + 1; count++) {
+            std::vector<std::vector<unsigned char> > msgs(count, std::vector<unsigned char>(len + 1));
+            std::vector<const unsigned char*> in(count);
+            for (size_t i = 0; i < count; i++) {
+                for (size_t j = 0; j < len; j++)
+                    msgs[i][j] = (unsigned char)(i * 31 + j * 7 + len);
+                in[i] = &msgs[i][0];
+            }
+            std::vector<unsigned char> out(PHI1612_OUTPUT_SIZE * count);
+            Phi1612xN(&out[0], &in[0], len, count);
+            for (size_t i = 0; i < count; i++) {
+                uint256 expected = Phi1612(msgs[i].begin(), msgs[i].begin() + len);
+                BOOST_CHECK(memcmp(&out[PHI1612_OUTPUT_SIZE * i], expected.begin(), PHI1612_OUTPUT_SIZE) == 0);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(phi1612_block_headers)
+{
+    std::vector<CBlockHeader> headers(11);
+    std::vector<const CBlockHeader*> vpHeaders;
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i].nTime = 1500000000 + i;
+        headers[i].nBits = 0x1e0fffff;
+        headers[i].nNonce = i * 1000;
+        vpHeaders.push_back(&headers[i]);
+    }
+    std::vector<uint256> hashes;
+    CBlockHeader::GetHashes(vpHeaders, hashes);
+    BOOST_CHECK_EQUAL(hashes.size(), headers.size());
+    for (size_t i = 0; i < headers.size(); i++)
+        BOOST_CHECK(hashes[i] == Phi1612(BEGIN(headers[i].nVersion), END(headers[i].nNonce)));
+}
+
+static void HashBlockHeader(const CBlockHeader* pheader, uint256* phash)
+{
+    for (int i = 0; i < 100; i++)
+        *phash = pheader->GetHash();
+}
+
+BOOST_AUTO_TEST_CASE(block_header_hash_cache)
+{
+    uint64_t nHashes = CBlockHeader::GetTotalHashComputations();
+    CBlock block;
+    block.nTime = 1500000000;
+    block.nBits = 0x1e0fffff;
+    uint256 hash = block.GetHash();
+    BOOST_CHECK(hash == Phi1612(BEGIN(block.nVersion), END(block.nNonce)));
+    BOOST_CHECK(block.GetHash() == hash);
+    BOOST_CHECK_EQUAL(CBlockHeader::GetTotalHashComputations() - nHashes, 1U);
+
+    // Copies share the cached hash
+    CBlockHeader header = block.GetBlockHeader();
+    BOOST_CHECK(header.GetHash() == hash);
+    CBlock blockCopy(block);
+    BOOST_CHECK(blockCopy.GetHash() == hash);
+    BOOST_CHECK_EQUAL(CBlockHeader::GetTotalHashComputations() - nHashes, 1U);
+
+    // Modifying the header invalidates it
+    block.nNonce++;
+    BOOST_CHECK(block.GetHash() == Phi1612(BEGIN(block.nVersion), END(block.nNonce)));
+    BOOST_CHECK(block.GetHash() != hash);
+    BOOST_CHECK_EQUAL(CBlockHeader::GetTotalHashComputations() - nHashes, 2U);
+
+    // Deserializing too
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block.GetBlockHeader();
+    ss >> header;
+    BOOST_CHECK(header.GetHash() == block.GetHash());
+
+    // Several threads can hash the same header
+    block.nNonce++;
+    std::vector<uint256> vHashes(4);
+    boost::thread_group threads;
+    for (size_t i = 0; i < vHashes.size(); i++)
+        threads.create_thread(boost::bind(&HashBlockHeader, &block, &vHashes[i]));
+    threads.join_all();
+    for (size_t i = 0; i < vHashes.size(); i++)
+        BOOST_CHECK(vHashes[i] == Phi1612(BEGIN(block.nVersion), END(block.nNonce)));
+}
+
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    // Test vectors from the SipHash-2-4 reference implementation
+    CSipHasher hasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x726fdb47dd0e0e31ull);
+    static const unsigned char t0[1] = {0};
+    hasher.Write(t0, 1);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x74f839c593dc67fdull);
+    static const unsigned char t1[7] = {1, 2, 3, 4, 5, 6, 7};
+    hasher.Write(t1, 7);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x93f5f5799a932462ull);
+    hasher.Write(0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x3f2acc7f57c29bdbull);
+    static const unsigned char t2[2] = {16, 17};
+    hasher.Write(t2, 2);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x4bc1b3f0968dd39cull);
+    static const unsigned char t3[9] = {18, 19, 20, 21, 22, 23, 24, 25, 26};
+    hasher.Write(t3, 9);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x2f2e6163076bcfadull);
+    static const unsigned char t4[5] = {27, 28, 29, 30, 31};
+    hasher.Write(t4, 5);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x7127512f72f27cceull);
+
+    // SipHashUint256 matches hashing the 32 bytes of the uint256
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL,
+                          uint256("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100")),
+        0x7127512f72f27cceull);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
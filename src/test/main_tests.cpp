@@ -5,7 +5,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "primitives/transaction.h"
+#include "blockfilecache.h"
+#include "clientversion.h"
+#include "keystore.h"
 #include "main.h"
+#include "script/sign.h"
+#include "streams.h"
+#include "txdb.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -24,4 +30,173 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 2099999997690000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(block_file_cache_test)
+{
+    CBlock block;
+    block.nTime = 1500000000;
+    block.vtx.resize(1);
+    block.vtx[0] = CMutableTransaction();
+
+    // Write two blocks to a file no other test uses
+    CDiskBlockPos pos1(9999, 0), pos2;
+    BOOST_CHECK(WriteBlockToDisk(block, pos1));
+    pos2 = CDiskBlockPos(9999, pos1.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION));
+    block.nNonce = 1;
+    BOOST_CHECK(WriteBlockToDisk(block, pos2));
+
+    CBlockFileCacheStats before, after;
+    GetBlockFileCacheStats(before);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    std::vector<unsigned char> vchBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, pos2));
+    BOOST_CHECK(std::vector<unsigned char>(ss.begin(), ss.end()) == vchBlock);
+
+    CBlockFileReader reader(SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(OpenBlockFileRecord(pos1, "blk", 0, reader));
+    CBlock block1;
+    reader >> block1;
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK(block1.nNonce == 0);
+    BOOST_CHECK(block1.vtx.size() == 1);
+
+    // Not a record
+    BOOST_CHECK(!OpenBlockFileRecord(CDiskBlockPos(9999, pos1.nPos + 1), "blk", 0, reader));
+
+    GetBlockFileCacheStats(after);
+#ifndef WIN32
+    BOOST_CHECK_EQUAL(after.nMisses, before.nMisses + 1);
+    BOOST_CHECK_EQUAL(after.nHits, before.nHits + 2);
+#endif
+
+    InvalidateBlockFileCache(9999);
+}
+
+BOOST_AUTO_TEST_CASE(block_index_records_test)
+{
+    LOCK(cs_main);
+    bool fAddressIndexOld = fAddressIndex, fSpentIndexOld = fSpentIndex, fTimestampIndexOld = fTimestampIndex;
+    fAddressIndex = fSpentIndex = fTimestampIndex = true;
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    CKeyID keyID = key.GetPubKey().GetID();
+    CScript scriptPubKey = GetScriptForDestination(keyID);
+
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    CCoinsViewCache view(pcoinsTip);
+    BOOST_CHECK(view.GetBestBlock() == pindexPrev->GetBlockHash());
+
+    CBlock block;
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.nTime = pindexPrev->nTime + 1;
+
+    // An output paying to the key for the block to spend
+    CMutableTransaction txPrev;
+    txPrev.nTime = block.nTime;
+    txPrev.vin.resize(1);
+    txPrev.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txPrev.vout.resize(1);
+    txPrev.vout[0].nValue = 10 * COIN;
+    txPrev.vout[0].scriptPubKey = scriptPubKey;
+    view.ModifyCoins(txPrev.GetHash())->FromTx(txPrev, pindexPrev->nHeight);
+
+    CMutableTransaction txCoinbase;
+    txCoinbase.nTime = block.nTime;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].prevout.SetNull();
+    txCoinbase.vin[0].scriptSig = CScript() << (pindexPrev->nHeight + 1) << OP_0;
+    txCoinbase.vout.resize(1);
+    txCoinbase.vout[0].nValue = 1 * COIN;
+    txCoinbase.vout[0].scriptPubKey = scriptPubKey;
+
+    CMutableTransaction txSpend;
+    txSpend.nTime = block.nTime;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = 9 * COIN;
+    txSpend.vout[0].scriptPubKey = scriptPubKey;
+    BOOST_CHECK(SignSignature(keystore, txPrev, txSpend, 0));
+
+    block.vtx.push_back(txCoinbase);
+    block.vtx.push_back(txSpend);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    uint256 hashBlock = block.GetHash();
+
+    CBlockIndex index(block);
+    CBlockIndex* pindex = &index;
+    pindex->phashBlock = &hashBlock;
+    pindex->pprev = pindexPrev;
+    pindex->nHeight = pindexPrev->nHeight + 1;
+
+    CValidationState state;
+    BOOST_CHECK(ConnectBlock(block, state, pindex, view));
+
+    // 'a': the receive of txPrev is not indexed, the spend of it and both new outputs are
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRESS_INDEX_PUBKEYHASH, keyID, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 3U);
+    CAmount nBalance = 0;
+    for (unsigned int i = 0; i < addressIndex.size(); i++) {
+        BOOST_CHECK_EQUAL(addressIndex[i].first.blockHeight, pindex->nHeight);
+        nBalance += addressIndex[i].second;
+    }
+    BOOST_CHECK_EQUAL(nBalance, 0);
+
+    // 'u': only the outputs created by the block
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentIndex;
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(ADDRESS_INDEX_PUBKEYHASH, keyID, unspentIndex));
+    BOOST_CHECK_EQUAL(unspentIndex.size(), 2U);
+    for (unsigned int i = 0; i < unspentIndex.size(); i++)
+        BOOST_CHECK(unspentIndex[i].first.txhash != txPrev.GetHash());
+
+    // 'p': the spent output points at the spending input
+    CSpentIndexValue spentValue;
+    BOOST_CHECK(pblocktree->ReadSpentIndex(CSpentIndexKey(txPrev.GetHash(), 0), spentValue));
+    BOOST_CHECK(spentValue.txid == txSpend.GetHash());
+    BOOST_CHECK_EQUAL(spentValue.inputIndex, 0U);
+    BOOST_CHECK_EQUAL(spentValue.blockHeight, pindex->nHeight);
+    BOOST_CHECK_EQUAL(spentValue.satoshis, 10 * COIN);
+
+    // 's': the block under its timestamp
+    std::vector<uint256> vHashes;
+    BOOST_CHECK(pblocktree->ReadTimestampIndex(block.nTime + 1, block.nTime, vHashes));
+    BOOST_CHECK(std::find(vHashes.begin(), vHashes.end(), hashBlock) != vHashes.end());
+
+    BOOST_CHECK(DisconnectBlock(block, state, pindex, view));
+    BOOST_CHECK(view.GetBestBlock() == pindexPrev->GetBlockHash());
+
+    addressIndex.clear();
+    BOOST_CHECK(pblocktree->ReadAddressIndex(ADDRESS_INDEX_PUBKEYHASH, keyID, addressIndex));
+    BOOST_CHECK(addressIndex.empty());
+
+    // The spent output is unspent again
+    unspentIndex.clear();
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(ADDRESS_INDEX_PUBKEYHASH, keyID, unspentIndex));
+    BOOST_CHECK_EQUAL(unspentIndex.size(), 1U);
+    if (!unspentIndex.empty()) {
+        BOOST_CHECK(unspentIndex[0].first.txhash == txPrev.GetHash());
+        BOOST_CHECK_EQUAL(unspentIndex[0].second.satoshis, 10 * COIN);
+    }
+
+    BOOST_CHECK(!pblocktree->ReadSpentIndex(CSpentIndexKey(txPrev.GetHash(), 0), spentValue));
+
+    vHashes.clear();
+    BOOST_CHECK(pblocktree->ReadTimestampIndex(block.nTime + 1, block.nTime, vHashes));
+    BOOST_CHECK(std::find(vHashes.begin(), vHashes.end(), hashBlock) == vHashes.end());
+
+    // ConnectBlock marked the index dirty, write it out before it goes out of scope
+    FlushStateToDisk();
+
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    fAddressIndex = fAddressIndexOld;
+    fSpentIndex = fSpentIndexOld;
+    fTimestampIndex = fTimestampIndexOld;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -99,4 +99,87 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolPackageStateTest)
+{
+    // Chain of three transactions: parent -> child -> grandchild
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0)
+            tx[i].vin[0].prevout = COutPoint(tx[i - 1].GetHash(), 0);
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+
+    CTxMemPool pool(CFeeRate(0));
+    CTxMemPoolEntry entry[3] = {
+        CTxMemPoolEntry(tx[0], 1000LL, 0, 0.0, 1),
+        CTxMemPoolEntry(tx[1], 2000LL, 0, 0.0, 1),
+        CTxMemPoolEntry(tx[2], 3000LL, 0, 0.0, 1)};
+    for (int i = 0; i < 3; i++)
+        pool.addUnchecked(tx[i].GetHash(), entry[i]);
+
+    size_t nSize = entry[0].GetTxSize() + entry[1].GetTxSize() + entry[2].GetTxSize();
+    CTxMemPool::txiter it0 = pool.mapTx.find(tx[0].GetHash());
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx[2].GetHash());
+    BOOST_CHECK_EQUAL(it0->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(it0->GetSizeWithDescendants(), nSize);
+    BOOST_CHECK_EQUAL(it0->GetModFeesWithDescendants(), 6000LL);
+    BOOST_CHECK_EQUAL(it2->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(it2->GetSizeWithAncestors(), nSize);
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithAncestors(), 6000LL);
+
+    // The grandchild pays for its ancestors: its package has the best fee rate
+    BOOST_CHECK(pool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash() == tx[2].GetHash());
+    BOOST_CHECK(pool.mapTx.get<ancestor_score>().rbegin()->GetTx().GetHash() == tx[0].GetHash());
+    BOOST_CHECK(pool.mapTx.get<mining_score>().begin()->GetTx().GetHash() == tx[2].GetHash());
+
+    // Prioritising the parent changes the package fees of all descendants
+    pool.PrioritiseTransaction(tx[0].GetHash(), tx[0].GetHash().ToString(), 0.0, 500LL);
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithAncestors(), 6500LL);
+    BOOST_CHECK_EQUAL(it0->GetModFeesWithDescendants(), 6500LL);
+
+    // Confirming the parent leaves the child as root of the package
+    std::list<CTransaction> conflicts;
+    std::vector<CTransaction> vtx(1, tx[0]);
+    pool.removeForBlock(vtx, 2, conflicts);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK_EQUAL(it2->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithAncestors(), 5000LL);
+    CTxMemPool::txiter it1 = pool.mapTx.find(tx[1].GetHash());
+    BOOST_CHECK_EQUAL(it1->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it1->GetCountWithDescendants(), 2);
+    BOOST_CHECK(pool.GetMemPoolParents(it1).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // Two unrelated transactions, one paying more than the other
+    CMutableTransaction tx[2];
+    for (int i = 0; i < 2; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11 << i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 10000LL, 0, 0.0, 1));
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 5000LL, 0, 0.0, 1));
+    BOOST_CHECK(pool.GetMinFee(pool.DynamicMemoryUsage()) == CFeeRate(0));
+
+    // Trimming to anything smaller evicts the cheaper one and raises the minimum fee
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(tx[0].GetHash()));
+    BOOST_CHECK(!pool.exists(tx[1].GetHash()));
+    BOOST_CHECK(pool.GetMinFee(1) > CFeeRate(1000));
+
+    // Expire everything that entered before the given time
+    BOOST_CHECK_EQUAL(pool.Expire(1), 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,112 @@
+// Copyright (c) 2014 The Bitcoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "script/sigcache.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <string.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+// An entry whose first word selects the shard and second word the slot
+static uint256 MakeEntry(uint32_t nShard, uint32_t nSlot, uint32_t nTag)
+{
+    uint256 entry;
+    uint32_t words[8] = {nShard, nSlot, nTag, nTag, 1, 1, 1, 1};
+    memcpy(entry.begin(), words, sizeof(words));
+    return entry;
+}
+
+static CSignatureCacheStats GetStats(CSignatureCache& cache)
+{
+    CSignatureCacheStats stats;
+    cache.GetStats(stats);
+    return stats;
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_insert_lookup)
+{
+    CSignatureCache cache(1 << 20);
+    BOOST_CHECK_EQUAL(GetStats(cache).nCapacity, (1 << 20) / sizeof(uint256));
+
+    for (uint32_t i = 0; i < CSignatureCache::SHARDS; i++)
+        BOOST_CHECK(!cache.Get(MakeEntry(i, i, i)));
+
+    for (uint32_t i = 0; i < CSignatureCache::SHARDS; i++) {
+        cache.Set(MakeEntry(i, i, i));
+        cache.Set(MakeEntry(i, i, i)); // already present, not stored twice
+    }
+    for (uint32_t i = 0; i < CSignatureCache::SHARDS; i++) {
+        BOOST_CHECK(cache.Get(MakeEntry(i, i, i)));
+        BOOST_CHECK(!cache.Get(MakeEntry(i, i, i + 1)));
+    }
+
+    CSignatureCacheStats stats = GetStats(cache);
+    BOOST_CHECK_EQUAL(stats.nEntries, CSignatureCache::SHARDS);
+    BOOST_CHECK_EQUAL(stats.nInserts, CSignatureCache::SHARDS);
+    BOOST_CHECK_EQUAL(stats.nEvictions, 0U);
+    BOOST_CHECK_EQUAL(stats.nHits, CSignatureCache::SHARDS);
+    BOOST_CHECK_EQUAL(stats.nMisses, 2 * CSignatureCache::SHARDS);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_eviction)
+{
+    // one probe run per shard
+    const uint32_t nProbe = CSignatureCache::PROBE;
+    CSignatureCache cache(CSignatureCache::SHARDS * nProbe * sizeof(uint256));
+
+    for (uint32_t i = 0; i < CSignatureCache::SHARDS; i++)
+        for (uint32_t j = 0; j < nProbe; j++)
+            cache.Set(MakeEntry(i, 0, j));
+    BOOST_CHECK_EQUAL(GetStats(cache).nEntries, CSignatureCache::SHARDS * nProbe);
+    BOOST_CHECK_EQUAL(GetStats(cache).nEvictions, 0U);
+
+    // overflowing shard 0 only evicts from shard 0
+    for (uint32_t j = nProbe; j < 2 * nProbe; j++) {
+        cache.Set(MakeEntry(0, 0, j));
+        BOOST_CHECK(cache.Get(MakeEntry(0, 0, j)));
+    }
+    BOOST_CHECK_EQUAL(GetStats(cache).nEvictions, nProbe);
+    BOOST_CHECK_EQUAL(GetStats(cache).nEntries, CSignatureCache::SHARDS * nProbe);
+
+    unsigned int nFound = 0;
+    for (uint32_t j = 0; j < 2 * nProbe; j++)
+        nFound += cache.Get(MakeEntry(0, 0, j));
+    BOOST_CHECK_EQUAL(nFound, nProbe);
+
+    for (uint32_t i = 1; i < CSignatureCache::SHARDS; i++)
+        for (uint32_t j = 0; j < nProbe; j++)
+            BOOST_CHECK(cache.Get(MakeEntry(i, 0, j)));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_size)
+{
+    // a cache without slots stores nothing
+    CSignatureCache cacheEmpty(0);
+    cacheEmpty.Set(MakeEntry(0, 0, 0));
+    BOOST_CHECK(!cacheEmpty.Get(MakeEntry(0, 0, 0)));
+    BOOST_CHECK_EQUAL(GetStats(cacheEmpty).nCapacity, 0U);
+
+    BOOST_CHECK_EQUAL(GetSignatureCacheBytes(), (int64_t)DEFAULT_MAX_SIG_CACHE_SIZE << 20);
+
+    mapArgs["-sigcachemaxmb"] = "-1";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBytes(), 0);
+    mapArgs["-sigcachemaxmb"] = "1000000";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBytes(), MAX_MAX_SIG_CACHE_SIZE << 20);
+    mapArgs.erase("-sigcachemaxmb");
+
+    // the deprecated option counts entries
+    mapArgs["-maxsigcachesize"] = "100";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBytes(), 100 * (int64_t)sizeof(uint256));
+    mapArgs["-maxsigcachesize"] = "-100";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBytes(), 0);
+    mapArgs["-maxsigcachesize"] = "100000000";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBytes(), MAX_MAX_SIG_CACHE_SIZE << 20);
+    mapArgs.erase("-maxsigcachesize");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 #include "random.h"
 #include "util.h"
 
+#include <limits>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -99,4 +100,65 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(findtimerange_test)
+{
+    // Timestamps that mostly increase, but sometimes go back in time
+    std::vector<uint256> vHashMain(10000);
+    std::vector<CBlockIndex> vBlocksMain(10000);
+    for (unsigned int i = 0; i < vBlocksMain.size(); i++) {
+        vHashMain[i] = i;
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].nTime = i * 10 + insecure_rand() % 150;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].phashBlock = &vHashMain[i];
+        vBlocksMain[i].nTimeMax = std::max(vBlocksMain[i].nTime, i ? vBlocksMain[i - 1].nTimeMax : 0);
+        vBlocksMain[i].BuildSkip();
+    }
+
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+
+    for (unsigned int n = 0; n < 1000; n++) {
+        int64_t nTime = insecure_rand() % 100500;
+        CBlockIndex* pindexFirst = chain.FindEarliestAtLeast(nTime);
+        CBlockIndex* pindexLast = chain.FindLatestBefore(nTime);
+        // Every block before the first and after the last is on the right side
+        for (int i = 0; i < (int)vBlocksMain.size(); i++) {
+            if (!pindexFirst || i < pindexFirst->nHeight)
+                BOOST_CHECK(vBlocksMain[i].nTime < nTime);
+            if (!pindexLast || i > pindexLast->nHeight)
+                BOOST_CHECK(vBlocksMain[i].nTime >= nTime);
+        }
+        // and they are as close as possible
+        if (pindexFirst)
+            BOOST_CHECK(pindexFirst->nTime >= nTime);
+        if (pindexLast)
+            BOOST_CHECK(pindexLast->nTime < nTime);
+    }
+
+    // The minimum times follow the chain when blocks are disconnected
+    // and a branch with earlier timestamps is connected
+    std::vector<uint256> vHashSide(100);
+    std::vector<CBlockIndex> vBlocksSide(100);
+    for (unsigned int i = 0; i < vBlocksSide.size(); i++) {
+        vHashSide[i] = i + 9900 + (uint256(1) << 128);
+        vBlocksSide[i].nHeight = i + 9900;
+        vBlocksSide[i].nTime = 50000 + i;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[9899];
+        vBlocksSide[i].phashBlock = &vHashSide[i];
+        vBlocksSide[i].nTimeMax = std::max(vBlocksSide[i].nTime, vBlocksSide[i].pprev->nTimeMax);
+        vBlocksSide[i].BuildSkip();
+    }
+    chain.SetTip(&vBlocksSide.back());
+    BOOST_CHECK(chain.FindLatestBefore(50001) == &vBlocksSide[0]);
+    chain.SetTip(&vBlocksMain[9899]);
+    BOOST_CHECK(chain.FindLatestBefore(50001)->nTime < 50001);
+    BOOST_CHECK(chain.FindLatestBefore(50001)->nHeight < 5100);
+
+    // An empty chain has no blocks on either side of any time
+    chain.SetTip(NULL);
+    BOOST_CHECK(chain.FindEarliestAtLeast(0) == NULL);
+    BOOST_CHECK(chain.FindLatestBefore(std::numeric_limits<int64_t>::max()) == NULL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,8 @@
 
 #define BOOST_TEST_MODULE Lux Test Suite
 
+#include "crypto/phi1612.h"
+#include "crypto/sha256.h"
 #include "main.h"
 #include "random.h"
 #include "txdb.h"
@@ -32,6 +34,8 @@ struct TestingSetup {
     TestingSetup() {
         SetupEnvironment();
         fPrintToDebugLog = false; // don't want to write to debug.log file
+        Phi1612AutoDetect();
+        SHA256DAutoDetect();
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::UNITTEST);
         noui_connect();
@@ -5,43 +5,195 @@
 
 #include "txdb.h"
 
+#include "init.h"
 #include "main.h"
 #include "pow.h"
 #include "stake.h"
+#include "ui_interface.h"
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
 extern map<uint256, uint256> mapProofOfStake;
 
 using namespace std;
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+namespace {
+
+/**
+ * The coin database keeps one record per unspent output, keyed by 'C', the
+ * txid and the output index, so spending an output erases only its record.
+ * A 'T' + txid record marks transactions with unspent outputs, so lookups of
+ * others are answered by a point read, which leveldb's bloom filter serves
+ * without touching the table files. Before, a single 'c' record per
+ * transaction held all of its unspent outputs (see CCoins);
+ * CCoinsViewDB::Upgrade converts those.
+ */
+struct CCoinsOutKey
 {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+    uint256 txid;
+    uint32_t n;
+
+    CCoinsOutKey() : n(0) {}
+    CCoinsOutKey(const uint256& txidIn, uint32_t nIn) : txid(txidIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        char chType = 'C';
+        READWRITE(chType);
+        READWRITE(txid);
+        READWRITE(VARINT(n));
+    }
+};
+
+/** Key of the record marking a transaction with unspent outputs */
+inline std::pair<char, uint256> CoinsTxKey(const uint256& txid)
+{
+    return std::make_pair('T', txid);
+}
+
+/**
+ * An unspent output along with the transaction data CCoins keeps for it:
+ * - VARINT(nVersion)
+ * - VARINT(nHeight * 4 + fCoinStake * 2 + fCoinBase)
+ * - the compressed CTxOut
+ */
+class CCoinsOutRecord
+{
+public:
+    bool fCoinBase;
+    bool fCoinStake;
+    int nVersion;
+    int nHeight;
+    CTxOut out;
+
+    CCoinsOutRecord() : fCoinBase(false), fCoinStake(false), nVersion(0), nHeight(0) {}
+    CCoinsOutRecord(const CCoins& coins, unsigned int n) : fCoinBase(coins.fCoinBase), fCoinStake(coins.fCoinStake), nVersion(coins.nVersion), nHeight(coins.nHeight), out(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(VARINT(this->nVersion));
+        unsigned int nCode = nHeight * 4 + (fCoinStake ? 2 : 0) + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        fCoinBase = nCode & 1;
+        fCoinStake = (nCode & 2) != 0;
+        nHeight = nCode / 4;
+        CTxOutCompressor compressor(out);
+        READWRITE(compressor);
+    }
+};
+
+/**
+ * Write the outputs of a cache entry that were added since it was fetched
+ * and erase the ones that were spent. Outputs of a transaction never change,
+ * so the ones the database had when the entry was fetched are left alone.
+ */
+void BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoinsCacheEntry& entry, size_t& nChanged)
+{
+    const CCoins& coins = entry.coins;
+    bool fBaseAny = false;
+    unsigned int nOutputs = std::max(coins.vout.size(), entry.vBaseAvailable.size());
+    for (unsigned int n = 0; n < nOutputs; n++) {
+        bool fBase = entry.IsBaseAvailable(n);
+        fBaseAny |= fBase;
+        if (coins.IsAvailable(n)) {
+            if (!fBase) {
+                batch.Write(CCoinsOutKey(hash, n), CCoinsOutRecord(coins, n));
+                nChanged++;
+            }
+        } else if (fBase) {
+            batch.Erase(CCoinsOutKey(hash, n));
+            nChanged++;
+        }
+    }
+    if (coins.IsPruned() && fBaseAny)
+        batch.Erase(CoinsTxKey(hash));
+    else if (!coins.IsPruned() && !fBaseAny)
+        batch.Write(CoinsTxKey(hash), '1');
 }
 
-void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
+void BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
 {
     batch.Write('B', hash);
 }
 
+/**
+ * Collect the output records of the transaction at the cursor into coins and
+ * leave the cursor at the next transaction. Returns false if the cursor is not
+ * at an output record.
+ */
+bool ReadCoinsRecords(leveldb::Iterator* pcursor, uint256& txid, CCoins& coins, size_t& nSize)
+{
+    coins.Clear();
+    nSize = 0;
+    bool fFound = false;
+    while (pcursor->Valid()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.empty() || slKey[0] != 'C')
+            break;
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        CCoinsOutKey key;
+        ssKey >> key;
+        if (fFound && key.txid != txid)
+            break;
+        txid = key.txid;
+
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        CCoinsOutRecord record;
+        ssValue >> record;
+        coins.fCoinBase = record.fCoinBase;
+        coins.fCoinStake = record.fCoinStake;
+        coins.nVersion = record.nVersion;
+        coins.nHeight = record.nHeight;
+        if (coins.vout.size() <= key.n)
+            coins.vout.resize(key.n + 1);
+        coins.vout[key.n] = record.out;
+        nSize += slKey.size() + slValue.size();
+        fFound = true;
+        pcursor->Next();
+    }
+    return fFound;
+}
+
+} // anon namespace
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
 {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
-    return db.Read(make_pair('c', txid), coins);
+    // Most lookups are for transactions without unspent outputs
+    if (!db.Exists(CoinsTxKey(txid)))
+        return false;
+
+    /* It seems that there are no "const iterators" for LevelDB.  Since we
+       only need read operations on it, use a const-cast to get around
+       that restriction.  */
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << CCoinsOutKey(txid, 0);
+    pcursor->Seek(ssKeySet.str());
+
+    uint256 txidFound;
+    size_t nSize;
+    return ReadCoinsRecords(pcursor.get(), txidFound, coins, nSize) && txidFound == txid;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
-    return db.Exists(make_pair('c', txid));
+    return db.Exists(CoinsTxKey(txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
@@ -57,9 +209,12 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
+    size_t changedOutputs = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            // Only outputs that were added or spent since the entry was read
+            // are written. A fresh entry has no records in the database yet.
+            BatchWriteCoins(batch, it->first, it->second, changedOutputs);
             changed++;
         }
         count++;
@@ -69,10 +224,76 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed outputs of %u changed transactions (out of %u) to coin database...\n", (unsigned int)changedOutputs, (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::Upgrade()
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'c';
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid() || pcursor->key()[0] != 'c')
+        return true;
+
+    uiInterface.InitMessage(_("Upgrading coin database..."));
+
+    LogPrintf("Upgrading coin database to one record per unspent output...\n");
+    CLevelDBBatch batch;
+    size_t nBatch = 0;
+    size_t nTransactions = 0;
+    size_t nOutputs = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            return false;
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'c')
+                break;
+            uint256 txid;
+            ssKey >> txid;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+            for (unsigned int n = 0; n < coins.vout.size(); n++) {
+                if (coins.IsAvailable(n)) {
+                    batch.Write(CCoinsOutKey(txid, n), CCoinsOutRecord(coins, n));
+                    nBatch++;
+                    nOutputs++;
+                }
+            }
+            if (!coins.IsPruned())
+                batch.Write(CoinsTxKey(txid), '1');
+            batch.Erase(make_pair('c', txid));
+            nTransactions++;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        // Every batch is committed on its own, so an interrupted upgrade
+        // continues from the first transaction that was not converted yet
+        if (++nBatch >= 100000) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch = CLevelDBBatch();
+            nBatch = 0;
+            LogPrintf("Upgrading coin database: %u transactions converted\n", (unsigned int)nTransactions);
+        }
+        pcursor->Next();
+    }
+    if (!db.WriteBatch(batch))
+        return false;
+    LogPrintf("Upgraded coin database: %u transactions, %u unspent outputs\n", (unsigned int)nTransactions, (unsigned int)nOutputs);
+    return true;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
 {
 }
@@ -143,44 +364,38 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'C';
+    pcursor->Seek(ssKeySet.str());
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
+    while (true) {
         boost::this_thread::interruption_point();
         try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+            uint256 txhash;
+            CCoins coins;
+            size_t nSize;
+            if (!ReadCoinsRecords(pcursor.get(), txhash, coins, nSize))
+                break;
+            ss << txhash;
+            ss << VARINT(coins.nVersion);
+            ss << (coins.fCoinBase ? 'c' : 'n');
+            ss << VARINT(coins.nHeight);
+            stats.nTransactions++;
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                const CTxOut& out = coins.vout[i];
+                if (!out.IsNull()) {
+                    stats.nTransactionOutputs++;
+                    ss << VARINT(i + 1);
+                    ss << out;
+                    nTotalAmount += out.nValue;
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
             }
-            pcursor->Next();
+            stats.nSerializedSize += nSize;
+            ss << VARINT(0);
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
@@ -204,6 +419,164 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value)
+{
+    return Read(make_pair('p', key), value);
+}
+
+bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >& vect)
+{
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it = vect.begin(); it != vect.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('p', it->first));
+        else
+            batch.Write(make_pair('p', it->first), it->second);
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(unsigned int type, const uint160& addressHash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vect)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('u', CAddressUnspentIteratorKey(type, addressHash));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'u')
+                break;
+            CAddressUnspentKey key;
+            ssKey >> key;
+            if (key.type != type || key.hashBytes != addressHash)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressUnspentValue value;
+            ssValue >> value;
+            vect.push_back(make_pair(key, value));
+            pcursor->Next();
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vect)
+{
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = vect.begin(); it != vect.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('u', it->first));
+        else
+            batch.Write(make_pair('u', it->first), it->second);
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(unsigned int type, const uint160& addressHash, std::vector<std::pair<CAddressIndexKey, CAmount> >& vect, int nStart, int nEnd)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('a', CAddressIndexIteratorKey(type, addressHash, nStart > 0 ? nStart : 0));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'a')
+                break;
+            CAddressIndexKey key;
+            ssKey >> key;
+            if (key.type != type || key.hashBytes != addressHash)
+                break;
+            if (nEnd > 0 && key.blockHeight > nEnd)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAmount nValue;
+            ssValue >> nValue;
+            vect.push_back(make_pair(key, nValue));
+            pcursor->Next();
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> >& vect)
+{
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = vect.begin(); it != vect.end(); it++)
+        batch.Write(make_pair('a', it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> >& vect)
+{
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = vect.begin(); it != vect.end(); it++)
+        batch.Erase(make_pair('a', it->first));
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadTimestampIndex(unsigned int nHigh, unsigned int nLow, std::vector<uint256>& vect)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('s', CTimestampIndexIteratorKey(nLow));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 's')
+                break;
+            CTimestampIndexKey key;
+            ssKey >> key;
+            if (key.timestamp >= nHigh)
+                break;
+
+            vect.push_back(key.blockHash);
+            pcursor->Next();
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey& key)
+{
+    return Write(make_pair('s', key), '0');
+}
+
+bool CBlockTreeDB::EraseTimestampIndex(const CTimestampIndexKey& key)
+{
+    return Erase(make_pair('s', key));
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string& name, bool fValue)
 {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
@@ -218,8 +591,41 @@ bool CBlockTreeDB::ReadFlag(const std::string& name, bool& fValue)
     return true;
 }
 
+/** Recompute the header hash of every nThreads-th entry of vIndex, starting at nStart */
+static void VerifyBlockIndexHashes(const std::vector<CBlockIndex*>& vIndex, size_t nStart, size_t nThreads, CBlockIndex** ppindexBad)
+{
+    for (size_t i = nStart; i < vIndex.size(); i += nThreads) {
+        const CBlockIndex* pindex = vIndex[i];
+        if (pindex->GetBlockHeader().GetHash() != pindex->GetBlockHash()) {
+            *ppindexBad = vIndex[i];
+            return;
+        }
+    }
+}
+
+/** Check that each index entry is stored under the hash of its header, on all cores */
+static bool VerifyBlockIndex(const std::vector<CBlockIndex*>& vIndex)
+{
+    size_t nThreads = std::max(1u, boost::thread::hardware_concurrency());
+    std::vector<CBlockIndex*> vBad(nThreads, (CBlockIndex*)NULL);
+    boost::thread_group threadGroup;
+    for (size_t i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&VerifyBlockIndexHashes, boost::cref(vIndex), i, nThreads, &vBad[i]));
+    threadGroup.join_all();
+
+    BOOST_FOREACH (const CBlockIndex* pindex, vBad) {
+        if (pindex)
+            return error("%s: block index entry %s at height %d does not match its header", __func__,
+                         pindex->GetBlockHash().GetHex(), pindex->nHeight);
+    }
+    return true;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
+    int64_t nStart = GetTimeMillis();
+    std::vector<CBlockIndex*> vLoaded;
+
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
 
     CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
@@ -241,13 +647,16 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
             char chType;
             ssKey >> chType;
             if (chType == 'b') {
+                // Entries are stored under their block hash, so it does not need to be recomputed
+                uint256 hash;
+                ssKey >> hash;
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
                 CDiskBlockIndex diskindex;
                 ssValue >> diskindex;
 
                 // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
+                CBlockIndex* pindexNew = InsertBlockIndex(hash);
                 pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
                 pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
                 pindexNew->nHeight = diskindex.nHeight;
@@ -273,14 +682,12 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
                 bool isPoW = (diskindex.nNonce != 0) && pindexNew->nHeight <= Params().LAST_POW_BLOCK();
                 if (isPoW) {
-                    auto const &hash(pindexNew->GetBlockHash());
                     if (!CheckProofOfWork(hash, pindexNew->nBits)) {
                         unsigned int nBits = pindexPrev ? pindexPrev->nBits : 0;
                         return error("%s: CheckProofOfWork failed: %d %s (%d, %d)", __func__, pindexNew->nHeight, hash.GetHex(), pindexNew->nBits, nBits);
                     }
                 } else {
                     stake->MarkStake(pindexNew->prevoutStake, pindexNew->nStakeTime);
-                    auto const &hash(pindexNew->GetBlockHash());
                     uint256 proof;
                     if (pindexNew->hashProofOfStake == 0) {
                         LogPrint("debug", "skip invalid indexed orphan block %d %s with empty data\n", pindexNew->nHeight, hash.GetHex());
@@ -298,6 +705,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                     }
                 }
 
+                if (fCheckBlockIndex)
+                    vLoaded.push_back(pindexNew);
                 pindexPrev = pindexNew;
                 pcursor->Next();
             } else {
@@ -308,6 +717,15 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
         }
     }
 
+    LogPrintf("%s: loaded %u block index entries in %dms\n", __func__, mapBlockIndex.size(), GetTimeMillis() - nStart);
+
+    if (fCheckBlockIndex) {
+        nStart = GetTimeMillis();
+        if (!VerifyBlockIndex(vLoaded))
+            return false;
+        LogPrintf("%s: verified %u block hashes in %dms\n", __func__, vLoaded.size(), GetTimeMillis() - nStart);
+    }
+
     if (nDiscarded) {
         if (WriteBatch(batch)) {
             LogPrintf("pruned %d orphaned blocks from disk index\n", nDiscarded);